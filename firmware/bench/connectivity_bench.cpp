@@ -0,0 +1,232 @@
+// Connectivity state machine against a fake network: boot during a WiFi outage, the link comes back, drops for a few
+// seconds and blips.
+//
+// The fake backend completes each connection attempt after a fixed time (fast reconnect with the cached access point
+// or full connect with a scan) and fails it if the link of the simulated network (host_network.h) is down then. The
+// main loop is driven on a virtual clock in 10 ms steps, with a sample every second as on the device. Checks that
+// the first sample is taken at boot and none is skipped during the outages, that the attempts follow the fast path
+// and the backoff at the expected times, that uploads wait for the time sync, and the transition times and
+// reconnect latencies kept for the status. Prints the timeline and exits with 1 on a failed check, for CI.
+//
+//   pio run -e connectivity_bench
+//   .pio/build/connectivity_bench/program
+#include <Arduino.h>
+
+#include <climits>
+#include <vector>
+
+#include "connectivity.h"
+#include "host_network.h"
+#include "sample_scheduler.h"
+
+// Times of the fake network in ms.
+#define BENCH_FAST_CONNECT_MS 100
+#define BENCH_FULL_CONNECT_MS 800
+#define BENCH_TIME_SYNC_MS 400  // After the services are started
+#define BENCH_MQTT_CONNECT_MS 600
+
+#define BENCH_RECONNECT_INTERVAL 30000
+#define BENCH_MEASURE_INTERVAL 1000
+#define BENCH_STEP_MS 10
+
+struct Attempt {
+  unsigned long at;
+  bool fast;
+
+  bool operator==(const Attempt &other) const { return at == other.at && fast == other.fast; }
+};
+
+static unsigned long virtualMs = 0;
+
+// ConnectivityBackend on top of the simulated network.
+class FakeBackend : public ConnectivityBackend {
+ public:
+  std::vector<Attempt> attempts;
+  int serviceStarts = 0;
+
+  void beginWifi() override { start(false); }
+  void reconnectWifi() override { start(false); }
+
+  bool reconnectWifiFast() override {
+    if (!cached) {
+      return false;
+    }
+    start(true);
+    return true;
+  }
+
+  bool takeWifiFailure() override {
+    bool failed = failure;
+    failure = false;
+    return failed;
+  }
+
+  void onWifiUp(bool fast) override { cached = true; }
+
+  bool isWifiConnected() override { return connected; }
+
+  void startServices() override {
+    serviceStarts++;
+    servicesAt = virtualMs;
+  }
+
+  bool isTimeValid() override { return serviceStarts > 0 && virtualMs >= servicesAt + BENCH_TIME_SYNC_MS; }
+
+  bool isMqttConnected() override {
+    return connected && serviceStarts > 0 && virtualMs >= servicesAt + BENCH_MQTT_CONNECT_MS;
+  }
+
+  // Completes the pending attempt and follows the link.
+  void tick() {
+    bool up = hostNetwork().up;
+    if (!up) {
+      connected = false;
+    }
+    if (pending && virtualMs >= attemptAt + (attemptFast ? BENCH_FAST_CONNECT_MS : BENCH_FULL_CONNECT_MS)) {
+      pending = false;
+      connected = up;
+      failure = !up;
+    }
+  }
+
+ private:
+  bool cached = false;
+  bool connected = false;
+  bool failure = false;
+  bool pending = false;
+  bool attemptFast = false;
+  unsigned long attemptAt = 0;
+  unsigned long servicesAt = 0;
+
+  // A new attempt drops the current one.
+  void start(bool fast) {
+    attempts.push_back({virtualMs, fast});
+    connected = false;
+    pending = true;
+    attemptFast = fast;
+    attemptAt = virtualMs;
+  }
+};
+
+static bool ok = true;
+
+static void check(bool condition, const char *what, unsigned long value, unsigned long expected) {
+  printf("%-4s %-34s %8lu (expected %lu)\n", condition ? "ok" : "FAIL", what, value, expected);
+  ok = condition && ok;
+}
+
+int main() {
+  FakeBackend backend;
+  Connectivity connectivity(backend, BENCH_RECONNECT_INTERVAL);
+  SampleScheduler scheduler(BENCH_MEASURE_INTERVAL);
+
+  // Link changes: down at boot, up at 45 s, down from 100 s to 105 s, a 50 ms blip at 150 s.
+  struct LinkChange {
+    unsigned long at;
+    bool up;
+  } changes[] = {{0, false}, {45000, true}, {100000, false}, {105000, true}, {150000, false}, {150050, true}};
+  const unsigned long endMs = 200000;
+
+  size_t change = 0;
+  unsigned long firstSampleAt = ULONG_MAX;
+  unsigned long httpReadyAt = ULONG_MAX;
+  bool wasUp = false;
+  Connectivity::WifiState state = Connectivity::WIFI_IDLE;
+
+  // Boot as in setup(): connectivity first, then the sample schedule, nothing waits for WiFi
+  hostNetworkSetUp(false);
+  connectivity.begin(virtualMs);
+  scheduler.begin(virtualMs);
+
+  for (virtualMs = 0; virtualMs <= endMs; virtualMs += BENCH_STEP_MS) {
+    while (change < sizeof(changes) / sizeof(changes[0]) && changes[change].at <= virtualMs) {
+      hostNetworkSetUp(changes[change].up);
+      printf("%7lu ms  link %s\n", virtualMs, changes[change].up ? "up" : "down");
+      change++;
+    }
+    backend.tick();
+    connectivity.loop(virtualMs);
+    if (connectivity.isHttpReady() && httpReadyAt == ULONG_MAX) {
+      httpReadyAt = virtualMs;
+    }
+    if (scheduler.isDue(virtualMs) && firstSampleAt == ULONG_MAX) {
+      firstSampleAt = virtualMs;
+    }
+
+    if (connectivity.getWifiState() != state) {
+      static const char *names[] = {"idle", "connecting", "connected"};
+      state = connectivity.getWifiState();
+      printf("%7lu ms  WiFi %s\n", virtualMs, names[state]);
+    }
+    if (connectivity.isWifiConnected() && !wasUp && connectivity.getLastReconnectMs() > 0) {
+      printf("%7lu ms  reconnected after %lu ms\n", virtualMs, connectivity.getLastReconnectMs());
+    }
+    wasUp = connectivity.isWifiConnected();
+  }
+
+  printf("\nattempts:");
+  for (const Attempt &a : backend.attempts) {
+    printf(" %lu%s", a.at, a.fast ? " (fast)" : "");
+  }
+  printf("\n\n");
+
+  // Sampling from the first loop iteration, every slot taken through all outages
+  check(firstSampleAt == 0, "first sample at", firstSampleAt, 0);
+  check(scheduler.getTaken() == endMs / BENCH_MEASURE_INTERVAL + 1, "samples taken", scheduler.getTaken(),
+        endMs / BENCH_MEASURE_INTERVAL + 1);
+  check(scheduler.getMissed() == 0, "samples missed", scheduler.getMissed(), 0);
+  check(scheduler.getMaxGapMs() == BENCH_MEASURE_INTERVAL, "longest sample gap", scheduler.getMaxGapMs(),
+        BENCH_MEASURE_INTERVAL);
+
+  // Boot outage: full connects with the backoff doubling from WIFI_RECONNECT_MIN_INTERVAL up to the reconnect
+  // interval. Drop: fast reconnect, a full connect right after it failed, then the backoff again. Blip: fast path.
+  const unsigned long m = WIFI_RECONNECT_MIN_INTERVAL;
+  std::vector<Attempt> expected = {{0, false}};
+  unsigned long at = 0;
+  for (unsigned long backoff = m; at < 45000; backoff *= 2) {
+    at += backoff < BENCH_RECONNECT_INTERVAL ? backoff : BENCH_RECONNECT_INTERVAL;
+    expected.push_back({at, false});
+  }
+  const unsigned long bootUpAt = at + BENCH_FULL_CONNECT_MS;
+  const unsigned long fullAt = 100000 + BENCH_FAST_CONNECT_MS;
+  expected.push_back({100000, true});
+  expected.push_back({fullAt, false});
+  at = fullAt;
+  for (unsigned long backoff = m; at < 105000; backoff *= 2) {
+    at += backoff;
+    expected.push_back({at, false});
+  }
+  const unsigned long dropUpAt = at + BENCH_FULL_CONNECT_MS;
+  expected.push_back({150000, true});
+
+  bool attemptsMatch = backend.attempts == expected;
+  check(attemptsMatch, "attempts at the expected times", backend.attempts.size(), expected.size());
+  if (!attemptsMatch) {
+    printf("     expected:");
+    for (const Attempt &a : expected) {
+      printf(" %lu%s", a.at, a.fast ? " (fast)" : "");
+    }
+    printf("\n");
+  }
+
+  check(connectivity.getWifiUpAt() == bootUpAt, "WiFi up at", connectivity.getWifiUpAt(), bootUpAt);
+  check(connectivity.getTimeValidAt() == bootUpAt + BENCH_TIME_SYNC_MS, "time valid at",
+        connectivity.getTimeValidAt(), bootUpAt + BENCH_TIME_SYNC_MS);
+  check(connectivity.getMqttUpAt() == bootUpAt + BENCH_MQTT_CONNECT_MS, "MQTT up at", connectivity.getMqttUpAt(),
+        bootUpAt + BENCH_MQTT_CONNECT_MS);
+  // Uploads wait for the time sync, the samples before it are not restamped yet
+  check(httpReadyAt == bootUpAt + BENCH_TIME_SYNC_MS, "uploads ready at", httpReadyAt,
+        bootUpAt + BENCH_TIME_SYNC_MS);
+  check(backend.serviceStarts == 1, "service starts", backend.serviceStarts, 1);
+  check(connectivity.getMaxReconnectMs() == dropUpAt - 100000, "longest reconnect (drop)",
+        connectivity.getMaxReconnectMs(), dropUpAt - 100000);
+  check(connectivity.getLastReconnectMs() == BENCH_FAST_CONNECT_MS, "last reconnect (blip, fast)",
+        connectivity.getLastReconnectMs(), BENCH_FAST_CONNECT_MS);
+  check(connectivity.getFastReconnects() == 1, "fast reconnects", connectivity.getFastReconnects(), 1);
+  check(connectivity.getReconnects() == expected.size() - 1, "reconnect attempts", connectivity.getReconnects(),
+        expected.size() - 1);
+  check(connectivity.isWifiConnected(), "connected at the end", connectivity.isWifiConnected(), 1);
+
+  printf("\n%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
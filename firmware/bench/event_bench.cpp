@@ -0,0 +1,204 @@
+// Event detection on a synthetic solar day (SyntheticSensor) with injected events: shading, inverter trips and MPPT
+// hunting.
+//
+// Every sample goes through EventDetector::add() into a record sink, as on the device. Reports the events found, the
+// injected events captured at full rate, by a trigger at most BENCH_DETECT_WINDOW samples after the onset or by the
+// post-trigger window of an earlier event (a cloud edge), the records kept against the samples taken and the
+// detection cost per sample. The records must stay in timestamp order. With limits set it exits with 1 when an
+// injected event is missed or a limit is exceeded, for CI.
+//
+//   pio run -e event_bench
+//   .pio/build/event_bench/program --days 7 --interval 1000 --max-ns-per-sample 200 --max-records-pct 20
+#include <Arduino.h>
+
+#include <chrono>
+#include <vector>
+
+#include "event_detector.h"
+#include "synthetic_sensor.h"
+
+// Samples after the onset within which an injected event must be detected.
+#define BENCH_DETECT_WINDOW 5
+
+// An injected event is also covered by a trigger up to this many samples before its onset: the post-trigger window.
+#define BENCH_COVER_SAMPLES (EVENT_POST_SAMPLES - 1)
+
+typedef std::chrono::steady_clock Clock;
+
+enum InjectedKind { INJECT_SHADE, INJECT_TRIP, INJECT_HUNT };
+
+static const char *injectedNames[] = {"shade", "trip", "hunt"};
+
+struct Injected {
+  InjectedKind kind;
+  uint64_t startMs;  // Simulated time
+  uint64_t lengthMs;
+  int64_t triggeredAfter = -1;  // Samples after the onset, -1: none
+  bool covered = false;         // Onset within the post-trigger window of an earlier event
+};
+
+static uint64_t virtualMs = 0;
+
+static uint64_t virtualMillis() { return virtualMs; }
+
+static int64_t nanosSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// Applies the injected events to the sensor value at the simulated time nowMs.
+static int32_t inject(const std::vector<Injected> &events, uint64_t nowMs, int32_t value) {
+  for (const Injected &e : events) {
+    if (nowMs < e.startMs || nowMs >= e.startMs + e.lengthMs) {
+      continue;
+    }
+    uint64_t t = nowMs - e.startMs;
+    switch (e.kind) {
+      case INJECT_SHADE:
+        return value * 3 / 10;
+      case INJECT_TRIP:
+        return 0;
+      case INJECT_HUNT:
+        // The tracker swings around the operating point, +-15 % every 2 s
+        return (t / 2000) % 2 == 0 ? value * 115 / 100 : value * 85 / 100;
+    }
+  }
+  return value;
+}
+
+int main(int argc, char **argv) {
+  uint32_t days = 1;
+  uint32_t interval = 1000;
+  uint32_t seed = 1;
+  double maxNsPerSample = 0;
+  double maxRecordsPct = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--days") == 0 && i + 1 < argc) {
+      days = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+      interval = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--max-ns-per-sample") == 0 && i + 1 < argc) {
+      maxNsPerSample = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--max-records-pct") == 0 && i + 1 < argc) {
+      maxRecordsPct = atof(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "usage: %s [--days n] [--interval ms] [--seed n] [--max-ns-per-sample ns] [--max-records-pct p]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  // The same events every day, in the bright hours
+  std::vector<Injected> templates = {
+      {INJECT_SHADE, 9 * 3600000ULL, 120000},  {INJECT_TRIP, 10 * 3600000ULL + 1800000, 60000},
+      {INJECT_HUNT, 12 * 3600000ULL, 60000},   {INJECT_SHADE, 13 * 3600000ULL + 900000, 30000},
+      {INJECT_TRIP, 15 * 3600000ULL, 300000},  {INJECT_HUNT, 16 * 3600000ULL + 600000, 120000},
+  };
+
+  SyntheticSensor sensor(seed, 1.0f, 0.0f);
+  sensor.setTimeSource(virtualMillis);
+  sensor.setup();
+
+  EventDetector<> detector;
+  uint32_t records = 0;
+  uint32_t callRecords = 0;
+  bool ordered = true;
+  int64_t lastTimestamp = INT64_MIN;
+  auto store = [&](const Measurement &m) {
+    if (m.timestamp < lastTimestamp) {
+      ordered = false;
+    }
+    lastTimestamp = m.timestamp;
+    records++;
+    callRecords++;
+  };
+
+  std::vector<Injected> injected;
+  int64_t detectNs = 0;
+  uint32_t maxCallRecords = 0;
+  uint64_t samples = (uint64_t)days * 86400000ULL / interval;
+  for (uint64_t i = 0; i < samples; i++) {
+    virtualMs = i * interval;
+    uint64_t day = virtualMs / 86400000ULL;
+    uint64_t dayMs = virtualMs % 86400000ULL;
+    if (dayMs == 0) {
+      for (Injected e : templates) {
+        e.startMs += day * 86400000ULL;
+        injected.push_back(e);
+      }
+    }
+    Measurement m = {.value = inject(injected, virtualMs, sensor.getCurrentInUa()), .timestamp = (int64_t)virtualMs};
+
+    callRecords = 0;
+    Clock::time_point start = Clock::now();
+    uint8_t kinds = detector.add(m, store);
+    detectNs += nanosSince(start);
+    if (callRecords > maxCallRecords) {
+      maxCallRecords = callRecords;
+    }
+
+    if (kinds != 0) {
+      for (Injected &e : injected) {
+        if (e.triggeredAfter < 0 && virtualMs >= e.startMs &&
+            virtualMs < e.startMs + BENCH_DETECT_WINDOW * interval) {
+          e.triggeredAfter = (virtualMs - e.startMs) / interval;
+        }
+        if (virtualMs < e.startMs && virtualMs + BENCH_COVER_SAMPLES * interval >= e.startMs) {
+          e.covered = true;
+        }
+      }
+    }
+  }
+  detector.flush(store);
+
+  const EventStats &stats = detector.getStats();
+  double nsPerSample = samples > 0 ? (double)detectNs / samples : 0;
+  double recordsPct = samples > 0 ? 100.0 * records / samples : 0;
+  printf("simulated:        %u days, %llu samples every %u ms\n", days, (unsigned long long)samples, interval);
+  printf("events:           %u detected, %.1f per day\n", stats.events, (double)stats.events / days);
+  uint32_t missed = 0;
+  for (size_t k = 0; k < templates.size(); k++) {
+    uint32_t triggered = 0;
+    uint32_t covered = 0;
+    int64_t latest = 0;
+    for (size_t d = 0; d < days; d++) {
+      const Injected &e = injected[d * templates.size() + k];
+      if (e.triggeredAfter >= 0) {
+        triggered++;
+        latest = e.triggeredAfter > latest ? e.triggeredAfter : latest;
+      } else if (e.covered) {
+        covered++;
+      }
+    }
+    missed += days - triggered - covered;
+    printf("  %-5s %6.2f h:   %u/%u triggered, at most %lld samples late, %u covered by an earlier event\n",
+           injectedNames[templates[k].kind], templates[k].startMs / 3600000.0, triggered, days, (long long)latest,
+           covered);
+  }
+  printf("records:          %u (%.1f %% of the samples), %u full rate, %u summaries\n", records, recordsPct,
+         stats.stored, stats.summaries);
+  printf("detection:        %.1f ns per sample, at most %u records per sample (pre-trigger window of %d)\n",
+         nsPerSample, maxCallRecords, EVENT_PRE_SAMPLES);
+
+  bool failed = false;
+  if (!ordered) {
+    printf("FAIL: records out of timestamp order\n");
+    failed = true;
+  }
+  if (missed > 0) {
+    printf("FAIL: %u injected events missed\n", missed);
+    failed = true;
+  }
+  if (maxNsPerSample > 0 && nsPerSample > maxNsPerSample) {
+    printf("FAIL: %.1f ns per sample > %.1f\n", nsPerSample, maxNsPerSample);
+    failed = true;
+  }
+  if (maxRecordsPct > 0 && recordsPct > maxRecordsPct) {
+    printf("FAIL: %.1f %% records > %.1f %%\n", recordsPct, maxRecordsPct);
+    failed = true;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,242 @@
+// Long-run heap soak of the firmware pipeline on the simulated heap (host/include/host_heap.h).
+//
+// Weeks of always-on operation run on a virtual clock in minutes: sampling into the ring buffer, the MQTT
+// measurement and status publishes, the HTTP batches with server errors and WiFi outages with reconnects and
+// catch-up, on the fake network of host/include/host_network.h. The firmware modules are the real ones, including the
+// status record of esp_status.h, and the host String (host/include/WString.h) allocates as the one of the ESP32 core,
+// so their Strings and copies hit the heap as on the device. Allocations are counted per call site of the main loop.
+//
+//   pio run -e heap_soak
+//   .pio/build/heap_soak/program --days 28 --max-allocs-per-sample 8 --max-fragmentation 30
+//
+// Exits with 1 if a limit is exceeded, so CI catches regressions of the per-sample allocations.
+#include <Arduino.h>
+#include <host_heap.h>
+#include <host_network.h>
+
+#include "connectivity.h"
+#include "esp_status.h"
+#include "http_sender.h"
+#include "json_helper.h"
+#include "mqtt_handler.h"
+#include "ringbuffer.h"
+#include "synthetic_sensor.h"
+
+#define SOAK_BUFFER_SIZE 3600
+#define SOAK_CHUNK_SIZE 64
+
+static uint64_t virtualMs = 0;
+
+static uint64_t virtualMillis() { return virtualMs; }
+
+static Measurement storage[SOAK_BUFFER_SIZE];
+static RingBuffer<SOAK_BUFFER_SIZE> ringBuffer(storage);
+static Measurement sendBuffer[SOAK_CHUNK_SIZE];
+static int sendBufferSize = 0;
+static JsonHelper<SOAK_CHUNK_SIZE> jsonHelper;
+static HttpSender http;
+static MqttHandler mqttHandler;
+static EspStatus espStatus;
+
+// WiFi of the fake network, reconnects take one attempt.
+class SoakConnectivityBackend : public ConnectivityBackend {
+ public:
+  void beginWifi() override {}
+  void reconnectWifi() override {}
+  bool isWifiConnected() override { return hostNetwork().up; }
+  void startServices() override { mqttHandler.setup("mqtt://soak:1883", "soak"); }
+  bool isTimeValid() override { return true; }
+  bool isMqttConnected() override { return mqttHandler.isConnected(); }
+};
+
+static SoakConnectivityBackend backend;
+
+// xorshift32, independent of the sensor
+static uint32_t randomState = 1;
+
+static double uniform() {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState / 4294967296.0;
+}
+
+static uint8_t fragmentation(const HostHeapStats &stats) {
+  return stats.freeBytes > 0 ? 100 - (uint8_t)(stats.largestFreeBlock * 100 / stats.freeBytes) : 0;
+}
+
+int main(int argc, char **argv) {
+  double days = 14;
+  uint32_t interval = 1000;        // Sample interval, simulated ms
+  uint32_t sendInterval = 5000;    // Send interval, simulated ms
+  uint32_t statusInterval = 60000;
+  bool mqtt = true;
+  bool https = false;
+  double failureRate = 0.01;       // Share of HTTP requests answered with 503
+  double outageEvery = 24;         // Mean hours between WiFi outages, 0: none
+  double outageLength = 10;        // Minutes
+  uint32_t seed = 1;
+  double maxAllocsPerSample = 0;   // Limits, 0: not checked
+  int maxFragmentation = 0;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--days") == 0) days = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--interval") == 0) interval = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--send-interval") == 0) sendInterval = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--status-interval") == 0) statusInterval = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--mqtt") == 0) mqtt = atoi(argv[i + 1]) != 0;
+    else if (strcmp(argv[i], "--https") == 0) https = atoi(argv[i + 1]) != 0;
+    else if (strcmp(argv[i], "--failure-rate") == 0) failureRate = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--outage-every") == 0) outageEvery = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--outage-length") == 0) outageLength = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--seed") == 0) seed = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--max-allocs-per-sample") == 0) maxAllocsPerSample = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--max-fragmentation") == 0) maxFragmentation = atoi(argv[i + 1]);
+    else {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  randomState = seed ? seed : 1;
+
+  // Setup as in app.cpp
+  SyntheticSensor sensor(seed);
+  sensor.setTimeSource(virtualMillis);
+  sensor.setup();
+  Connectivity connectivity(backend, 30000);
+  {
+    HeapSite site("setup");
+    jsonHelper.setDevice("soak");
+    http.setServerUrl(https ? "https://soak:7777/api/v1/data" : "http://soak:7777/api/v1/data");
+    http.setApiToken("1234567890");
+    http.setFailureCallback([](int httpCode, const String &response) {});
+    http.setSuccessCallback(
+        [](int httpCode, const String &response) { ringBuffer.removeChunk(sendBuffer, sendBufferSize); });
+    connectivity.begin(0);
+    connectivity.loop(0);
+  }
+  hostNetwork().responseBody = "OK";
+  hostHeapResetCounters();
+  const HostHeapStats start = hostHeapStats();
+
+  const uint64_t duration = (uint64_t)(days * 86400000.0);
+  const int64_t epoch = 1710590900000LL;
+  uint64_t samples = 0, batches = 0, outages = 0;
+  uint64_t outageUntil = 0, lastSend = 0, lastStatus = 0;
+  uint8_t maxFrag = 0;
+  size_t minLargestBlock = start.largestFreeBlock;
+  double outageChance = outageEvery > 0 ? interval / (outageEvery * 3600000.0) : 0;
+
+  for (virtualMs = 0; virtualMs < duration; virtualMs += interval) {
+    // Network: outages and server errors
+    if (outageUntil == 0 && uniform() < outageChance) {
+      outageUntil = virtualMs + (uint64_t)(outageLength * 60000.0);
+      hostNetworkSetUp(false);
+      outages++;
+    } else if (outageUntil != 0 && virtualMs >= outageUntil) {
+      outageUntil = 0;
+      hostNetworkSetUp(true);
+    }
+    hostNetwork().httpCode = uniform() < failureRate ? 503 : 200;
+    {
+      HeapSite site("connectivity");
+      connectivity.loop(virtualMs);
+    }
+    {
+      HeapSite site("http.response");
+      hostNetworkPoll();
+    }
+
+    Measurement m = {.value = 0, .timestamp = epoch + (int64_t)virtualMs};
+    {
+      HeapSite site("sample");
+      m.value = sensor.getCurrentInUa();
+      ringBuffer.addMeasurement(m);
+      samples++;
+    }
+    if (mqtt) {
+      HeapSite site("mqtt.measurement");
+      String jsonPayload;
+      jsonHelper.toJson(m, jsonPayload);
+      mqttHandler.publishMeasurement(jsonPayload);
+    }
+
+    if (virtualMs - lastSend >= sendInterval && connectivity.isHttpReady() && !http.isSending()) {
+      HeapSite site("sendChunk");
+      lastSend = virtualMs;
+      int sendCount = ringBuffer.getChunk(sendBuffer, SOAK_CHUNK_SIZE);
+      if (sendCount > 0) {
+        String jsonPayload;
+        jsonHelper.toJson(sendBuffer, sendCount, epoch + (int64_t)virtualMs, jsonPayload);
+        http.sendRequest(jsonPayload);
+        sendBufferSize = sendCount;
+        batches++;
+      }
+    }
+
+    if (virtualMs - lastStatus >= statusInterval) {
+      lastStatus = virtualMs;
+      HostHeapStats stats = hostHeapStats();
+      if (fragmentation(stats) > maxFrag) {
+        maxFrag = fragmentation(stats);
+      }
+      if (stats.largestFreeBlock < minLargestBlock) {
+        minLargestBlock = stats.largestFreeBlock;
+      }
+      if (mqtt) {
+        // As sendStatus() in app.cpp
+        HeapSite site("status");
+        espStatus.setWifiReconnects(connectivity.getReconnects());
+        espStatus.setReconnectLatency(connectivity.getFastReconnects(), connectivity.getLastReconnectMs(),
+                                      connectivity.getMaxReconnectMs());
+        espStatus.setBufferFill(ringBuffer.getCount(), ringBuffer.getCapacity());
+        const HttpStats &httpStats = http.getStats();
+        espStatus.setHttpStats(httpStats.requests, httpStats.connections, httpStats.lastSetupMs,
+                               httpStats.maxSetupMs, httpStats.maxHeapDrop);
+        espStatus.update();
+        mqttHandler.publishStatus(espStatus.toJson("soak"));
+      }
+    }
+  }
+  hostNetworkPoll();
+
+  const HostHeapStats end = hostHeapStats();
+  int siteCount;
+  const HostHeapSite *sites = hostHeapSites(siteCount);
+  uint64_t allocs = 0;
+  for (int i = 0; i < siteCount; i++) {
+    allocs += sites[i].allocs;
+  }
+  double allocsPerSample = samples ? (double)allocs / samples : 0;
+
+  printf("simulated:        %.1f days, %llu samples, %llu batches, %llu outages, %u reconnects\n", days,
+         (unsigned long long)samples, (unsigned long long)batches, (unsigned long long)outages,
+         connectivity.getReconnects());
+  printf("network:          %llu HTTP requests, %llu MQTT publishes\n",
+         (unsigned long long)hostNetwork().httpRequests, (unsigned long long)hostNetwork().mqttPublishes);
+  printf("heap:             arena %zu, min free %zu, peak live %zu, live %zu -> %zu bytes\n", end.arenaSize,
+         end.minFreeBytes, end.peakLiveBytes, start.liveBytes, end.liveBytes);
+  printf("fragmentation:    %u %% at the end, %u %% max, min largest free block %zu, %u free blocks\n",
+         fragmentation(end), maxFrag, minLargestBlock, end.freeBlocks);
+  printf("allocs/sample:    %.2f\n\n", allocsPerSample);
+  printf("%-18s %12s %10s %12s %10s\n", "site", "allocs", "/sample", "bytes/alloc", "live");
+  for (int i = 0; i < siteCount; i++) {
+    if (sites[i].allocs == 0 && sites[i].liveBytes == 0) {
+      continue;
+    }
+    printf("%-18s %12llu %10.3f %12.0f %10lld\n", sites[i].name, (unsigned long long)sites[i].allocs,
+           samples ? (double)sites[i].allocs / samples : 0.0,
+           sites[i].allocs ? (double)sites[i].bytes / sites[i].allocs : 0.0, (long long)sites[i].liveBytes);
+  }
+
+  int result = 0;
+  if (maxAllocsPerSample > 0 && allocsPerSample > maxAllocsPerSample) {
+    printf("\nFAIL: %.2f allocations per sample, limit %.2f\n", allocsPerSample, maxAllocsPerSample);
+    result = 1;
+  }
+  if (maxFragmentation > 0 && maxFrag > maxFragmentation) {
+    printf("\nFAIL: fragmentation %u %%, limit %d %%\n", maxFrag, maxFragmentation);
+    result = 1;
+  }
+  return result;
+}
@@ -0,0 +1,89 @@
+// Sampling during a simulated OTA update (host/include/ArduinoOTA.h).
+//
+// The main loop samples into the ring buffer on the SampleScheduler grid while an image is received. With --mode task
+// the image is received by the OTA task as on the device, with --mode loop from the main loop, which then blocks for
+// the whole transfer. Flash sector writes stall the loop in both modes, as the disabled cache does on the ESP32.
+// Reports the OTA throughput and the sample continuity: samples taken against the slots of the update window,
+// skipped slots and the longest gap.
+//
+//   pio run -e ota_bench
+//   .pio/build/ota_bench/program --image 1024 --rate 150 --sector-ms 40 --interval 100 --mode task
+#include <Arduino.h>
+#include <ArduinoOTA.h>
+
+#include "ota.h"
+#include "ringbuffer.h"
+#include "sample_scheduler.h"
+#include "synthetic_sensor.h"
+
+#define BENCH_BUFFER_SIZE 4096
+
+static Measurement storage[BENCH_BUFFER_SIZE];
+static RingBuffer<BENCH_BUFFER_SIZE> ringBuffer(storage);
+
+int main(int argc, char **argv) {
+  uint32_t imageKb = 1024;
+  uint32_t rateKbps = 150;  // kB/s
+  uint32_t sectorMs = 40;   // Erase and write of a 4 kB sector
+  uint32_t interval = 100;  // Sample interval, ms
+  bool ownTask = true;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--image") == 0) imageKb = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--rate") == 0) rateKbps = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--sector-ms") == 0) sectorMs = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--interval") == 0) interval = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--mode") == 0) ownTask = strcmp(argv[i + 1], "loop") != 0;
+    else {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  SyntheticSensor sensor(1);
+  sensor.setup();
+  OTAHandler ota;
+  ota.setup("bench", ownTask);
+  SampleScheduler scheduler(interval);
+  scheduler.begin(millis());
+
+  // Settle for a second, then start the update
+  uint32_t start = millis();
+  uint32_t otaStart = 0, otaEnd = 0;
+  bool queued = false;
+  uint32_t samplesBefore = 0, missedBefore = 0;
+  while (otaEnd == 0 || millis() - otaEnd < 1000) {
+    uint32_t now = millis();
+    if (!queued && now - start >= 1000) {
+      queued = true;
+      otaStart = now;
+      samplesBefore = scheduler.getTaken();
+      missedBefore = scheduler.getMissed();
+      scheduler.resetStats();
+      ArduinoOTA.hostOtaStart(imageKb * 1024, rateKbps * 1024, sectorMs);
+    }
+    ota.loop();
+
+    hostFlashGate();
+    if (scheduler.isDue(millis())) {
+      ringBuffer.addMeasurement({.value = sensor.getCurrentInUa(), .timestamp = (int64_t)millis()});
+    }
+    if (queued && otaEnd == 0 && ota.getStats().updates > 0) {
+      otaEnd = millis();
+    }
+    delay(1);
+  }
+
+  const OtaStats &stats = ota.getStats();
+  uint32_t window = millis() - otaStart;
+  printf("mode:             %s\n", ownTask ? "task" : "loop");
+  printf("ota:              %u bytes in %u ms, %.1f kB/s\n", stats.lastBytes, stats.lastMs,
+         stats.lastBytesPerSec / 1024.0);
+  printf("before update:    %u samples, %u skipped\n", samplesBefore, missedBefore);
+  printf("update window:    %u ms, %u slots\n", window, window / interval);
+  printf("samples:          %u taken, %u skipped, max gap %u ms (interval %u ms)\n", scheduler.getTaken(),
+         scheduler.getMissed(), scheduler.getMaxGapMs(), interval);
+  printf("ring buffer:      %d records\n", ringBuffer.getCount());
+  printf("restart:          %s\n", ota.isRestartRequested() ? "requested" : "not requested");
+  return 0;
+}
@@ -0,0 +1,171 @@
+// Host driver for the sampling pipeline: sensor -> ring buffer -> JSON serializer -> sender.
+//
+// The sensor runs on a virtual clock, so the pipeline can be driven at a multiple of the real rate (--speed) or as
+// fast as possible (--speed 0) to find the throughput ceiling. The sender is a sink that acknowledges every batch.
+// --version selects the batch layout (see JSON_BATCH_VERSION), the payload is reported per batch and per sample.
+//
+//   pio run -e pipeline_bench
+//   .pio/build/pipeline_bench/program --hours 24 --interval 1000 --speed 0
+//   .pio/build/pipeline_bench/program --trace day.csv --speed 100
+//   .pio/build/pipeline_bench/program --speed 0 --send-interval 60000 --version 2
+#include <Arduino.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "json_helper.h"
+#include "replay_sensor.h"
+#include "ringbuffer.h"
+#include "synthetic_sensor.h"
+
+#define BENCH_BUFFER_SIZE 4096
+#define BENCH_CHUNK_SIZE 64
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t virtualMs = 0;
+
+static uint64_t virtualMillis() { return virtualMs; }
+
+static Measurement storage[BENCH_BUFFER_SIZE];
+static RingBuffer<BENCH_BUFFER_SIZE> ringBuffer(storage);
+static JsonHelper<BENCH_CHUNK_SIZE> jsonHelper;
+static Measurement sendBuffer[BENCH_CHUNK_SIZE];
+
+static int64_t nanosSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+static bool loadTrace(const char *path, std::vector<TraceSample> &trace) {
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    return false;
+  }
+  std::vector<char> data;
+  char block[4096];
+  size_t n;
+  while ((n = fread(block, 1, sizeof(block), f)) > 0) {
+    data.insert(data.end(), block, block + n);
+  }
+  fclose(f);
+  data.push_back('\0');
+
+  size_t len = strlen(path);
+  if (len > 4 && strcmp(path + len - 4, ".csv") == 0) {
+    trace.resize(data.size() / 4 + 1);
+    trace.resize(ReplaySensor::parseCsv(data.data(), trace.data(), trace.size()));
+  } else {
+    trace.resize((data.size() - 1) / sizeof(TraceSample));
+    ReplaySensor::parseBinary((const uint8_t *)data.data(), data.size() - 1, trace.data(), trace.size());
+  }
+  return !trace.empty();
+}
+
+int main(int argc, char **argv) {
+  double hours = 24;
+  uint32_t interval = 1000;       // Sample interval, simulated ms
+  uint32_t sendInterval = 5000;   // Send interval, simulated ms
+  double speed = 100;             // Simulated per real time, 0: as fast as possible
+  uint32_t seed = 1;
+  int version = JSON_BATCH_VERSION;
+  const char *tracePath = nullptr;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--hours") == 0) hours = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--interval") == 0) interval = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--send-interval") == 0) sendInterval = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--speed") == 0) speed = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--seed") == 0) seed = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--trace") == 0) tracePath = argv[i + 1];
+    else if (strcmp(argv[i], "--version") == 0) version = atoi(argv[i + 1]);
+    else {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::vector<TraceSample> trace;
+  SyntheticSensor synthetic(seed);
+  ReplaySensor *replay = nullptr;
+  Sensor *sensor = &synthetic;
+  if (tracePath != nullptr) {
+    if (!loadTrace(tracePath, trace)) {
+      fprintf(stderr, "Can't read trace %s\n", tracePath);
+      return 1;
+    }
+    replay = new ReplaySensor(trace.data(), trace.size());
+    replay->setTimeSource(virtualMillis);
+    sensor = replay;
+  } else {
+    synthetic.setTimeSource(virtualMillis);
+  }
+  sensor->setup();
+  jsonHelper.setDevice("bench");
+  jsonHelper.setVersion(version);
+
+  const uint64_t duration = (uint64_t)(hours * 3600000.0);
+  const int64_t epoch = 1710590900000LL;
+  uint64_t samples = 0;
+  uint64_t batches = 0;
+  uint64_t payloadBytes = 0;
+  uint64_t sentSamples = 0;
+  int maxFill = 0;
+  int64_t sensorNs = 0, addNs = 0, serializeNs = 0, removeNs = 0;
+  uint64_t lastSend = 0;
+  String payload;
+
+  Clock::time_point start = Clock::now();
+  for (virtualMs = 0; virtualMs < duration; virtualMs += interval) {
+    if (speed > 0) {
+      std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t)(virtualMs * 1000.0 / speed)));
+    }
+
+    Clock::time_point t = Clock::now();
+    Measurement m = {.value = sensor->getCurrentInUa(), .timestamp = epoch + (int64_t)virtualMs};
+    sensorNs += nanosSince(t);
+
+    t = Clock::now();
+    ringBuffer.addMeasurement(m);
+    addNs += nanosSince(t);
+    samples++;
+
+    if (virtualMs - lastSend >= sendInterval) {
+      lastSend = virtualMs;
+      int fill = ringBuffer.getCount();
+      if (fill > maxFill) {
+        maxFill = fill;
+      }
+
+      t = Clock::now();
+      int count = ringBuffer.getChunk(sendBuffer, BENCH_CHUNK_SIZE);
+      payload = "";
+      jsonHelper.toJson(sendBuffer, count, epoch + (int64_t)virtualMs, payload);
+      serializeNs += nanosSince(t);
+      payloadBytes += payload.length();
+      sentSamples += count;
+      batches++;
+
+      t = Clock::now();
+      ringBuffer.removeChunk(sendBuffer, count);
+      removeNs += nanosSince(t);
+    }
+  }
+  double wallS = nanosSince(start) / 1e9;
+
+  printf("sensor:           %s\n", tracePath != nullptr ? tracePath : "synthetic");
+  printf("simulated:        %.1f h, %llu samples, %llu batches\n", hours, (unsigned long long)samples,
+         (unsigned long long)batches);
+  printf("wall time:        %.3f s (%.0fx real time)\n", wallS, duration / 1000.0 / wallS);
+  printf("throughput:       %.0f samples/s, %.0f batches/s, %.1f KB/s payload\n", samples / wallS, batches / wallS,
+         payloadBytes / wallS / 1024.0);
+  printf("per sample:       sensor %.0f ns, buffer add %.0f ns\n", (double)sensorNs / samples, (double)addNs / samples);
+  printf("per batch:        chunk + JSON %.0f ns, remove %.0f ns, %.0f bytes\n",
+         batches ? (double)serializeNs / batches : 0.0, batches ? (double)removeNs / batches : 0.0,
+         batches ? (double)payloadBytes / batches : 0.0);
+  printf("payload:          version %d, %.1f bytes per sample\n", version,
+         sentSamples ? (double)payloadBytes / sentSamples : 0.0);
+  printf("max buffer fill:  %d/%d\n", maxFill, ringBuffer.getCapacity());
+  delete replay;
+  return 0;
+}
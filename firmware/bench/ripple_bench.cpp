@@ -0,0 +1,178 @@
+// Ripple analysis: accuracy and speed of the real FFT in ripple_analyzer.h.
+//
+// The FFT is checked against a direct DFT in double precision on random input. Captures with known tones (DC, the
+// ripple of a single phase inverter at twice the grid frequency and its harmonics, noise, the 9 bit steps of the
+// INA219) must give the tones back within a quarter bin and 5 % of their amplitude. One capture also goes through
+// SyntheticSensor::captureBurst(), as on the device. Reports the time per analysis for several capture sizes and
+// exits with 1 on a failed check, for CI. On the device the capture and analysis times are part of every record.
+//
+//   pio run -e ripple_bench
+//   .pio/build/ripple_bench/program --rate 8000 --grid 50
+#include <Arduino.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "ripple_analyzer.h"
+#include "synthetic_sensor.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Tone {
+  float hz;
+  float amplitudeUa;
+};
+
+static int64_t nanosSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// Largest error of the FFT against the direct DFT, relative to the largest bin.
+template <size_t N>
+static double fftError(RippleAnalyzer<N> &analyzer, std::mt19937 &random) {
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  std::vector<float> x(N);
+  for (float &v : x) {
+    v = uniform(random);
+  }
+  analyzer.transform(x.data());
+
+  double largest = 0;
+  double error = 0;
+  for (size_t k = 0; k < RippleAnalyzer<N>::kBins; k++) {
+    double re = 0;
+    double im = 0;
+    for (size_t n = 0; n < N; n++) {
+      re += x[n] * cos(2 * M_PI * k * n / N);
+      im -= x[n] * sin(2 * M_PI * k * n / N);
+    }
+    largest = fmax(largest, hypot(re, im));
+    error = fmax(error, hypot(re - analyzer.getRe(k), im - analyzer.getIm(k)));
+  }
+  return error / largest;
+}
+
+// Checks the peaks of a record against the tones, strongest first. Prints the mismatches.
+static bool checkPeaks(const RippleRecord &record, const std::vector<Tone> &tones, float binHz) {
+  bool ok = record.peakCount == tones.size();
+  for (size_t i = 0; i < tones.size() && i < record.peakCount; i++) {
+    float hz = record.peaks[i].milliHz / 1000.0f;
+    float amplitude = (float)record.peaks[i].amplitudeUa;
+    if (fabsf(hz - tones[i].hz) > binHz / 4 || fabsf(amplitude - tones[i].amplitudeUa) > tones[i].amplitudeUa / 20) {
+      ok = false;
+    }
+  }
+  if (!ok) {
+    printf("  expected:");
+    for (const Tone &t : tones) {
+      printf(" %.1f Hz %.2f mA", t.hz, t.amplitudeUa / 1000);
+    }
+    printf("\n  found:   ");
+    for (int i = 0; i < record.peakCount; i++) {
+      printf(" %.1f Hz %.2f mA", record.peaks[i].milliHz / 1000.0f, record.peaks[i].amplitudeUa / 1000.0f);
+    }
+    printf("\n");
+  }
+  return ok;
+}
+
+template <size_t N>
+static bool run(uint32_t rate, float gridHz, uint32_t runs) {
+  static RippleAnalyzer<N> analyzer;
+  std::mt19937 random(N);
+  std::normal_distribution<float> noise(0.0f, 300.0f);
+  bool ok = true;
+
+  double error = fftError(analyzer, random);
+  if (error > 1e-5) {
+    printf("FAIL: N %zu, FFT error %.2e against the DFT\n", N, error);
+    ok = false;
+  }
+
+  // 1.2 A with 100 Hz ripple, its third harmonic and a switching residue; off-bin frequencies and the 100 µA steps
+  // of the current register at 9 bit
+  std::vector<Tone> tones = {{2 * gridHz, 40000}, {6 * gridHz + 3.3f, 12000}, {rate / 5.0f + 7.1f, 5000}};
+  uint32_t periodUs = 1000000 / rate;
+  int32_t *samples = analyzer.getSamples();
+  for (size_t i = 0; i < N; i++) {
+    float t = i * periodUs / 1e6f;
+    float v = 1200000.0f + noise(random);
+    for (const Tone &tone : tones) {
+      v += tone.amplitudeUa * sinf(2 * (float)M_PI * tone.hz * t + tone.hz);
+    }
+    samples[i] = (int32_t)lroundf(v / 100) * 100;
+  }
+  RippleRecord record = {};
+  uint32_t spanUs = (N - 1) * periodUs;
+  analyzer.analyze(spanUs, record);
+  float binHz = (float)record.sampleRateHz / N;
+  if (!checkPeaks(record, tones, binHz)) {
+    printf("FAIL: N %zu, tones not found\n", N);
+    ok = false;
+  }
+  // The mean is biased by the ripple periods cut off at the ends of the capture
+  if (abs(record.dcUa - 1200000) > tones[0].amplitudeUa / 10) {
+    printf("FAIL: N %zu, mean %d µA\n", N, record.dcUa);
+    ok = false;
+  }
+
+  // Time per analysis, the samples are restored from a copy each run
+  std::vector<int32_t> copy(samples, samples + N);
+  int64_t ns = 0;
+  for (uint32_t r = 0; r < runs; r++) {
+    std::copy(copy.begin(), copy.end(), samples);
+    Clock::time_point start = Clock::now();
+    analyzer.analyze(spanUs, record);
+    ns += nanosSince(start);
+  }
+  printf("N %5zu:  %6.1f Hz per bin, %5.1f ms capture, analysis %7.2f µs, FFT error %.1e\n", N, binHz,
+         spanUs / 1000.0f, ns / 1000.0 / runs, error);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  uint32_t rate = 1000000 / RIPPLE_SAMPLE_US;
+  float gridHz = 50.0f;
+  uint32_t runs = 2000;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+      rate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+      gridHz = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--rate Hz] [--grid Hz] [--runs n]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (rate == 0 || rate > 1000000) {
+    fprintf(stderr, "rate must be 1..1000000 Hz\n");
+    return 1;
+  }
+
+  bool ok = run<256>(rate, gridHz, runs);
+  ok = run<512>(rate, gridHz, runs) && ok;
+  ok = run<1024>(rate, gridHz, runs) && ok;
+  ok = run<2048>(rate, gridHz, runs) && ok;
+
+  // End to end through the burst capture of the synthetic sensor
+  static RippleAnalyzer<> analyzer;
+  SyntheticSensor sensor(1, 1.0f, 12.0f);
+  sensor.setNoise(0.3f);
+  sensor.setRipple(2 * gridHz, 25.0f);
+  sensor.setup();
+  uint32_t spanUs = sensor.captureBurst(analyzer.getSamples(), RIPPLE_SAMPLES, 1000000 / rate);
+  RippleRecord record = {};
+  analyzer.analyze(spanUs, record);
+  char json[RIPPLE_JSON_SIZE];
+  record.toJson(json);
+  printf("synthetic sensor: %s\n", json);
+  if (!checkPeaks(record, {{2 * gridHz, 25000}}, (float)record.sampleRateHz / RIPPLE_SAMPLES)) {
+    printf("FAIL: ripple of the synthetic sensor not found\n");
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
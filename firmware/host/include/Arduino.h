@@ -0,0 +1,53 @@
+// Minimal Arduino API for the host (native) builds of the firmware modules.
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "WString.h"
+
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define EXT_RAM_ATTR
+#define F(x) x
+
+// Serial writes to stdout.
+class HostSerial {
+ public:
+  void begin(unsigned long) {}
+  void flush() { fflush(stdout); }
+  size_t write(const uint8_t *data, size_t n) { return fwrite(data, 1, n, stdout); }
+  size_t print(const char *s) { return fputs(s, stdout); }
+  size_t print(const String &s) { return print(s.c_str()); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t println(const char *s = "") { return printf("%s\n", s); }
+  size_t println(const String &s) { return println(s.c_str()); }
+  size_t println(long v) { return printf("%ld\n", v); }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, format);
+    int n = vprintf(format, args);
+    va_end(args);
+    return n > 0 ? n : 0;
+  }
+};
+
+extern HostSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+float temperatureRead();  // °C, fixed
+
+#endif  // HOST_ARDUINO_H
@@ -0,0 +1,92 @@
+// ArduinoOTA for the host builds: handle() receives a simulated image queued with hostOtaStart().
+//
+// The image arrives in packets of 1460 bytes at the given rate and is written in sectors of 4096 bytes. A sector
+// write holds the flash for sectorWriteMs: on the ESP32 the cache of both cores is disabled meanwhile, so code running
+// from flash on the other core stalls. Host code marks such places with hostFlashGate().
+#ifndef HOST_ARDUINO_OTA_H
+#define HOST_ARDUINO_OTA_H
+
+#include <Arduino.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+typedef enum {
+  OTA_AUTH_ERROR,
+  OTA_BEGIN_ERROR,
+  OTA_CONNECT_ERROR,
+  OTA_RECEIVE_ERROR,
+  OTA_END_ERROR
+} ota_error_t;
+
+inline std::mutex &hostFlashMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// Waits while a sector is written.
+inline void hostFlashGate() { std::lock_guard<std::mutex> lock(hostFlashMutex()); }
+
+class ArduinoOTAClass {
+ public:
+  typedef std::function<void(void)> THandlerFunction;
+  typedef std::function<void(ota_error_t)> THandlerFunction_Error;
+  typedef std::function<void(unsigned int, unsigned int)> THandlerFunction_Progress;
+
+  ArduinoOTAClass &setHostname(const char *hostname) { return *this; }
+  ArduinoOTAClass &setPassword(const char *password) { return *this; }
+  ArduinoOTAClass &setRebootOnSuccess(bool reboot) { return *this; }
+  ArduinoOTAClass &onStart(THandlerFunction fn) { startCallback = fn; return *this; }
+  ArduinoOTAClass &onEnd(THandlerFunction fn) { endCallback = fn; return *this; }
+  ArduinoOTAClass &onError(THandlerFunction_Error fn) { errorCallback = fn; return *this; }
+  ArduinoOTAClass &onProgress(THandlerFunction_Progress fn) { progressCallback = fn; return *this; }
+  void begin() {}
+
+  // Queues an image of size bytes, received at bytesPerSec.
+  void hostOtaStart(uint32_t size, uint32_t bytesPerSec, uint32_t sectorWriteMs) {
+    pendingSize = size;
+    pendingRate = bytesPerSec;
+    pendingSectorMs = sectorWriteMs;
+    pending = true;
+  }
+
+  // Receives a queued image, blocks until it is written like the ESP32 implementation.
+  void handle() {
+    if (!pending.exchange(false)) {
+      return;
+    }
+    if (startCallback) startCallback();
+    auto start = std::chrono::steady_clock::now();
+    uint32_t written = 0;
+    uint32_t flashed = 0;
+    while (written < pendingSize) {
+      uint32_t packet = pendingSize - written < 1460 ? pendingSize - written : 1460;
+      written += packet;
+      std::this_thread::sleep_until(start + std::chrono::microseconds((uint64_t)written * 1000000 / pendingRate));
+      while (written - flashed >= 4096 || (written == pendingSize && flashed < written)) {
+        std::lock_guard<std::mutex> lock(hostFlashMutex());
+        std::this_thread::sleep_for(std::chrono::milliseconds(pendingSectorMs));
+        flashed += written - flashed < 4096 ? written - flashed : 4096;
+      }
+      if (progressCallback) progressCallback(written, pendingSize);
+    }
+    if (endCallback) endCallback();
+  }
+
+ private:
+  THandlerFunction startCallback;
+  THandlerFunction endCallback;
+  THandlerFunction_Error errorCallback;
+  THandlerFunction_Progress progressCallback;
+  std::atomic<bool> pending{false};
+  uint32_t pendingSize = 0;
+  uint32_t pendingRate = 1;
+  uint32_t pendingSectorMs = 0;
+};
+
+inline ArduinoOTAClass ArduinoOTA;
+
+#endif  // HOST_ARDUINO_OTA_H
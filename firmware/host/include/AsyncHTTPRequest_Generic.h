@@ -0,0 +1,9 @@
+// AsyncHTTPRequest for the host builds, see host_http_request.h.
+#ifndef HOST_ASYNC_HTTP_REQUEST_H
+#define HOST_ASYNC_HTTP_REQUEST_H
+
+#include "host_http_request.h"
+
+class AsyncHTTPRequest : public HostHttpRequest<AsyncHTTPRequest> {};
+
+#endif  // HOST_ASYNC_HTTP_REQUEST_H
@@ -0,0 +1,9 @@
+// AsyncHTTPSRequest for the host builds, see host_http_request.h.
+#ifndef HOST_ASYNC_HTTPS_REQUEST_H
+#define HOST_ASYNC_HTTPS_REQUEST_H
+
+#include "host_http_request.h"
+
+class AsyncHTTPSRequest : public HostHttpRequest<AsyncHTTPSRequest> {};
+
+#endif  // HOST_ASYNC_HTTPS_REQUEST_H
@@ -0,0 +1,32 @@
+// Base64 encoding as provided by the Base64 library of the ESP32 Arduino core, for the host builds.
+#ifndef HOST_BASE64_H
+#define HOST_BASE64_H
+
+#include <Arduino.h>
+
+namespace base64 {
+
+inline String encode(const String &text) {
+  static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  String out;
+  size_t i = 0;
+  for (; i + 2 < text.length(); i += 3) {
+    uint32_t v = (uint8_t)text[i] << 16 | (uint8_t)text[i + 1] << 8 | (uint8_t)text[i + 2];
+    out.concat(kAlphabet[v >> 18]);
+    out.concat(kAlphabet[(v >> 12) & 63]);
+    out.concat(kAlphabet[(v >> 6) & 63]);
+    out.concat(kAlphabet[v & 63]);
+  }
+  if (i < text.length()) {
+    uint32_t v = (uint8_t)text[i] << 16 | (i + 1 < text.length() ? (uint8_t)text[i + 1] << 8 : 0);
+    out.concat(kAlphabet[v >> 18]);
+    out.concat(kAlphabet[(v >> 12) & 63]);
+    out.concat(i + 1 < text.length() ? kAlphabet[(v >> 6) & 63] : '=');
+    out.concat('=');
+  }
+  return out;
+}
+
+}  // namespace base64
+
+#endif  // HOST_BASE64_H
@@ -0,0 +1,77 @@
+// Fake PsychicMqttClient for the host builds. The client is connected while the fake network (host_network.h) is
+// up. A publish copies topic and payload like the outbox of esp-mqtt and releases the copy once "sent".
+#ifndef HOST_PSYCHIC_MQTT_CLIENT_H
+#define HOST_PSYCHIC_MQTT_CLIENT_H
+
+#include <Arduino.h>
+
+#include <functional>
+
+#include "host_network.h"
+
+class PsychicMqttClient {
+ public:
+  typedef std::function<void(bool sessionPresent)> OnConnectUserCallback;
+  typedef std::function<void(bool sessionPresent)> OnDisconnectUserCallback;
+  typedef std::function<void(int msgId)> OnPublishUserCallback;
+
+  PsychicMqttClient &setServer(const char *uri) {
+    server = uri;
+    return *this;
+  }
+
+  PsychicMqttClient &onConnect(OnConnectUserCallback cb) {
+    connectCallback = cb;
+    return *this;
+  }
+
+  PsychicMqttClient &onDisconnect(OnDisconnectUserCallback cb) {
+    disconnectCallback = cb;
+    return *this;
+  }
+
+  PsychicMqttClient &onPublish(OnPublishUserCallback cb) {
+    publishCallback = cb;
+    return *this;
+  }
+
+  void connect() { started = true; }
+
+  bool connected() {
+    bool up = started && hostNetwork().up;
+    if (up != isConnected) {
+      isConnected = up;
+      if (up && connectCallback) {
+        connectCallback(false);
+      } else if (!up && disconnectCallback) {
+        disconnectCallback(false);
+      }
+    }
+    return isConnected;
+  }
+
+  int publish(const char *topic, int qos, bool retain, const char *payload, int length = 0, bool async = true) {
+    if (!connected()) {
+      return -1;
+    }
+    size_t topicLength = strlen(topic);
+    size_t payloadLength = length > 0 ? length : strlen(payload);
+    char *outbox = new char[topicLength + payloadLength + 16];
+    memcpy(outbox, topic, topicLength);
+    memcpy(outbox + topicLength, payload, payloadLength);
+    delete[] outbox;
+    hostNetwork().mqttPublishes++;
+    return ++msgId;
+  }
+
+ private:
+  String server;
+  bool started = false;
+  bool isConnected = false;
+  int msgId = 0;
+  OnConnectUserCallback connectCallback;
+  OnDisconnectUserCallback disconnectCallback;
+  OnPublishUserCallback publishCallback;
+};
+
+#endif  // HOST_PSYCHIC_MQTT_CLIENT_H
@@ -0,0 +1,326 @@
+// String of the ESP32 Arduino core (2.x) for the host builds. The allocations follow WString.cpp, so the heap soak
+// counts what the device does: short strings are kept in place (SSO, in the space of the pointer fields on the 32-bit
+// device), longer ones are grown by realloc() to the next multiple of 16 bytes above the length, at most 65535 bytes.
+// The memory comes from heap_caps_realloc(), i.e. the simulated heap with HOST_SIM_HEAP.
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+
+#include <esp_heap_caps.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+class String {
+ public:
+  String() { init(); }
+  String(const char *cstr) {
+    init();
+    if (cstr != nullptr) {
+      copy(cstr, strlen(cstr));
+    }
+  }
+  String(const char *cstr, unsigned int length) {
+    init();
+    if (cstr != nullptr) {
+      copy(cstr, length);
+    }
+  }
+  String(const String &other) {
+    init();
+    *this = other;
+  }
+  String(String &&other) {
+    init();
+    move(other);
+  }
+  explicit String(char c) {
+    init();
+    char buf[2] = {c, '\0'};
+    copy(buf, 1);
+  }
+  explicit String(int value) : String((long)value) {}
+  explicit String(unsigned int value) : String((unsigned long)value) {}
+  explicit String(long value) {
+    init();
+    char buf[2 + 8 * sizeof(long)];
+    copy(buf, snprintf(buf, sizeof(buf), "%ld", value));
+  }
+  explicit String(unsigned long value) {
+    init();
+    char buf[1 + 8 * sizeof(unsigned long)];
+    copy(buf, snprintf(buf, sizeof(buf), "%lu", value));
+  }
+  ~String() {
+    if (!sso) {
+      heap_caps_free(ptr);
+    }
+  }
+
+  String &operator=(const String &rhs) {
+    if (this != &rhs) {
+      if (rhs.buffer() != nullptr) {
+        copy(rhs.buffer(), rhs.len);
+      } else {
+        invalidate();
+      }
+    }
+    return *this;
+  }
+  String &operator=(String &&rhs) {
+    if (this != &rhs) {
+      move(rhs);
+    }
+    return *this;
+  }
+  String &operator=(const char *cstr) {
+    if (cstr != nullptr) {
+      copy(cstr, strlen(cstr));
+    } else {
+      invalidate();
+    }
+    return *this;
+  }
+
+  // Makes room for size characters. Returns false if out of memory.
+  bool reserve(unsigned int size) {
+    if (buffer() != nullptr && capacity() >= size) {
+      return true;
+    }
+    if (changeBuffer(size)) {
+      if (len == 0) {
+        wbuffer()[0] = '\0';
+      }
+      return true;
+    }
+    return false;
+  }
+
+  bool concat(const String &s) { return concat(s.buffer(), s.len); }
+  bool concat(const char *cstr) { return cstr != nullptr && concat(cstr, strlen(cstr)); }
+  bool concat(const char *cstr, unsigned int length) {
+    unsigned int newLen = len + length;
+    if (cstr == nullptr) {
+      return false;
+    }
+    if (length == 0) {
+      return true;
+    }
+    // cstr may point into this string, which reserve() can move
+    bool inside = buffer() != nullptr && cstr >= buffer() && cstr < buffer() + len;
+    size_t offset = inside ? cstr - buffer() : 0;
+    if (!reserve(newLen)) {
+      return false;
+    }
+    memmove(wbuffer() + len, inside ? buffer() + offset : cstr, length);
+    len = newLen;
+    wbuffer()[len] = '\0';
+    return true;
+  }
+  bool concat(char c) { return concat(&c, 1); }
+  bool concat(int value) { return concat((long)value); }
+  bool concat(unsigned int value) { return concat((unsigned long)value); }
+  bool concat(long value) {
+    char buf[2 + 8 * sizeof(long)];
+    return concat(buf, snprintf(buf, sizeof(buf), "%ld", value));
+  }
+  bool concat(unsigned long value) {
+    char buf[1 + 8 * sizeof(unsigned long)];
+    return concat(buf, snprintf(buf, sizeof(buf), "%lu", value));
+  }
+
+  template <typename T>
+  String &operator+=(const T &rhs) {
+    concat(rhs);
+    return *this;
+  }
+
+  unsigned int length() const { return buffer() != nullptr ? len : 0; }
+  bool isEmpty() const { return length() == 0; }
+  void clear() {
+    if (buffer() != nullptr) {
+      len = 0;
+      wbuffer()[0] = '\0';
+    }
+  }
+  const char *c_str() const { return buffer() != nullptr ? buffer() : ""; }
+  char operator[](unsigned int index) const { return index < len ? buffer()[index] : '\0'; }
+  char charAt(unsigned int index) const { return (*this)[index]; }
+
+  bool equals(const char *cstr) const { return strcmp(c_str(), cstr != nullptr ? cstr : "") == 0; }
+  bool operator==(const String &rhs) const { return len == rhs.len && equals(rhs.c_str()); }
+  bool operator==(const char *cstr) const { return equals(cstr); }
+  bool operator!=(const String &rhs) const { return !(*this == rhs); }
+  bool operator!=(const char *cstr) const { return !equals(cstr); }
+
+  bool startsWith(const char *prefix) const {
+    size_t n = strlen(prefix);
+    return n <= len && strncmp(c_str(), prefix, n) == 0;
+  }
+  bool startsWith(const String &prefix) const { return startsWith(prefix.c_str()); }
+  bool endsWith(const char *suffix) const {
+    size_t n = strlen(suffix);
+    return n <= len && strcmp(c_str() + len - n, suffix) == 0;
+  }
+
+  int indexOf(char c, unsigned int from = 0) const {
+    if (from >= len) {
+      return -1;
+    }
+    const char *found = strchr(buffer() + from, c);
+    return found != nullptr ? found - buffer() : -1;
+  }
+  int indexOf(const char *s, unsigned int from = 0) const {
+    if (from >= len) {
+      return -1;
+    }
+    const char *found = strstr(buffer() + from, s);
+    return found != nullptr ? found - buffer() : -1;
+  }
+  int indexOf(const String &s, unsigned int from = 0) const { return indexOf(s.c_str(), from); }
+
+  String substring(unsigned int left) const { return substring(left, len); }
+  String substring(unsigned int left, unsigned int right) const {
+    if (left > right) {
+      unsigned int temp = right;
+      right = left;
+      left = temp;
+    }
+    String out;
+    if (left >= len) {
+      return out;
+    }
+    if (right > len) {
+      right = len;
+    }
+    out.copy(buffer() + left, right - left);
+    return out;
+  }
+
+  long toInt() const { return buffer() != nullptr ? atol(buffer()) : 0; }
+
+  void trim() {
+    if (buffer() == nullptr || len == 0) {
+      return;
+    }
+    char *begin = wbuffer();
+    while (*begin == ' ' || *begin == '\t' || *begin == '\r' || *begin == '\n') {
+      begin++;
+    }
+    char *end = wbuffer() + len - 1;
+    while (end >= begin && (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')) {
+      end--;
+    }
+    len = end + 1 - begin;
+    if (begin > wbuffer()) {
+      memmove(wbuffer(), begin, len);
+    }
+    wbuffer()[len] = '\0';
+  }
+
+  void toLowerCase() {
+    for (unsigned int i = 0; i < length(); i++) {
+      char c = wbuffer()[i];
+      wbuffer()[i] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
+  }
+
+ private:
+  static const unsigned int kSsoSize = 11;  // sizeof(pointer, capacity, length) + 4 - 1 on the device
+  static const unsigned int kCapacityMax = 65535;
+
+  char *ptr;
+  unsigned int cap;
+  unsigned int len;
+  bool sso;
+  char ssoBuffer[kSsoSize];
+
+  void init() {
+    ptr = nullptr;
+    cap = 0;
+    len = 0;
+    sso = false;
+  }
+
+  const char *buffer() const { return sso ? ssoBuffer : ptr; }
+  char *wbuffer() { return sso ? ssoBuffer : ptr; }
+  unsigned int capacity() const { return sso ? kSsoSize - 1 : cap; }
+
+  void invalidate() {
+    if (!sso) {
+      heap_caps_free(ptr);
+    }
+    init();
+  }
+
+  // As String::changeBuffer() of the core: short strings move into the SSO buffer, others are reallocated.
+  bool changeBuffer(unsigned int maxStrLen) {
+    if (maxStrLen < kSsoSize - 1) {
+      if (!sso && ptr != nullptr) {
+        char temp[kSsoSize];
+        memcpy(temp, ptr, maxStrLen);
+        heap_caps_free(ptr);
+        memcpy(ssoBuffer, temp, maxStrLen);
+      }
+      sso = true;
+      return true;
+    }
+    size_t newSize = (maxStrLen + 16) & ~0xf;
+    if (newSize > kCapacityMax) {
+      return false;
+    }
+    char *newBuffer = static_cast<char *>(heap_caps_realloc(sso ? nullptr : ptr, newSize, MALLOC_CAP_8BIT));
+    if (newBuffer == nullptr) {
+      return false;
+    }
+    if (sso) {
+      memcpy(newBuffer, ssoBuffer, kSsoSize);
+    }
+    size_t oldSize = capacity() + 1;
+    if (newSize > oldSize) {
+      memset(newBuffer + oldSize, 0, newSize - oldSize);
+    }
+    sso = false;
+    ptr = newBuffer;
+    cap = newSize - 1;
+    return true;
+  }
+
+  void copy(const char *cstr, unsigned int length) {
+    if (!reserve(length)) {
+      invalidate();
+      return;
+    }
+    memmove(wbuffer(), cstr, length);
+    len = length;
+    wbuffer()[len] = '\0';
+  }
+
+  // Takes over the buffer of rhs, or copies its SSO buffer.
+  void move(String &rhs) {
+    invalidate();
+    if (rhs.sso) {
+      memcpy(ssoBuffer, rhs.ssoBuffer, kSsoSize);
+      sso = true;
+    } else {
+      ptr = rhs.ptr;
+      cap = rhs.cap;
+    }
+    len = rhs.len;
+    rhs.init();
+  }
+};
+
+inline String operator+(String lhs, const String &rhs) {
+  lhs.concat(rhs);
+  return lhs;
+}
+
+inline String operator+(String lhs, const char *rhs) {
+  lhs.concat(rhs);
+  return lhs;
+}
+
+inline String operator+(const char *lhs, const String &rhs) { return String(lhs) + rhs; }
+
+#endif  // HOST_WSTRING_H
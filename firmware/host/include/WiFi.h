@@ -0,0 +1,17 @@
+// WiFi of the ESP32 Arduino core for the host builds: the link state of the fake network (host_network.h).
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include <stdint.h>
+
+#include "host_network.h"
+
+class HostWiFi {
+ public:
+  // A fixed signal while the link is up.
+  int8_t RSSI() { return hostNetwork().up ? -60 : 0; }
+};
+
+extern HostWiFi WiFi;
+
+#endif  // HOST_WIFI_H
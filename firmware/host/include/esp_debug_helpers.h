@@ -0,0 +1,6 @@
+// Backtrace helpers of ESP-IDF for the host builds. Only used by the watchdog capture of the loop supervisor
+// (LOOP_WATCHDOG_TIMEOUT), which the host builds do not set.
+#ifndef HOST_ESP_DEBUG_HELPERS_H
+#define HOST_ESP_DEBUG_HELPERS_H
+
+#endif  // HOST_ESP_DEBUG_HELPERS_H
@@ -0,0 +1,23 @@
+// Heap capabilities for the host builds: all allocations go to malloc, there is no PSRAM.
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+// Size of the simulated heap reported by the size queries.
+#ifndef HOST_HEAP_SIZE
+#define HOST_HEAP_SIZE (320 * 1024)
+#endif
+
+void *heap_caps_malloc(size_t size, uint32_t caps);
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps);
+void heap_caps_free(void *ptr);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+#endif  // HOST_ESP_HEAP_CAPS_H
@@ -0,0 +1,27 @@
+// Reset reason and minimum free heap of ESP-IDF for the host builds.
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+typedef enum {
+  ESP_RST_UNKNOWN,
+  ESP_RST_POWERON,
+  ESP_RST_EXT,
+  ESP_RST_SW,
+  ESP_RST_PANIC,
+  ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT,
+  ESP_RST_WDT,
+  ESP_RST_DEEPSLEEP,
+  ESP_RST_BROWNOUT,
+  ESP_RST_SDIO,
+} esp_reset_reason_t;
+
+// Always a power-on reset.
+esp_reset_reason_t esp_reset_reason();
+
+// Lowest free heap so far: of the simulated heap with HOST_SIM_HEAP, HOST_HEAP_SIZE otherwise.
+uint32_t esp_get_minimum_free_heap_size();
+
+#endif  // HOST_ESP_SYSTEM_H
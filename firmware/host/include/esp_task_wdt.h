@@ -0,0 +1,6 @@
+// Task watchdog of ESP-IDF for the host builds. Nothing is guarded: the loop supervisor arms it only with
+// LOOP_WATCHDOG_TIMEOUT, which the host builds do not set.
+#ifndef HOST_ESP_TASK_WDT_H
+#define HOST_ESP_TASK_WDT_H
+
+#endif  // HOST_ESP_TASK_WDT_H
@@ -0,0 +1,9 @@
+// Monotonic µs counter for the host builds.
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
+
+#endif  // HOST_ESP_TIMER_H
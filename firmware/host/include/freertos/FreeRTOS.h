@@ -0,0 +1,45 @@
+// FreeRTOS types and critical sections for the host builds.
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portNUM_PROCESSORS 2
+#define configMAX_TASK_NAME_LEN 16
+#define tskNO_AFFINITY 0x7fffffff
+
+// Spinlock as portMUX_TYPE.
+struct portMUX_TYPE {
+  std::atomic<int> locked;
+};
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+inline void portEnterCritical(portMUX_TYPE *mux) {
+  int expected = 0;
+  while (!mux->locked.compare_exchange_weak(expected, 1, std::memory_order_acquire)) {
+    expected = 0;
+  }
+}
+
+inline void portExitCritical(portMUX_TYPE *mux) { mux->locked.store(0, std::memory_order_release); }
+
+#define portENTER_CRITICAL(mux) portEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) portExitCritical(mux)
+
+#endif  // HOST_FREERTOS_H
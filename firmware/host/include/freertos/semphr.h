@@ -0,0 +1,12 @@
+// FreeRTOS mutexes for the host builds.
+#ifndef HOST_FREERTOS_SEMPHR_H
+#define HOST_FREERTOS_SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex);
+void vSemaphoreDelete(SemaphoreHandle_t mutex);
+
+#endif  // HOST_FREERTOS_SEMPHR_H
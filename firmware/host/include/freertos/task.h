@@ -0,0 +1,25 @@
+// FreeRTOS tasks as threads for the host builds.
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+
+// Starts a detached thread. Priority and core are ignored.
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackDepth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+
+void vTaskDelay(TickType_t ticks);
+
+// The main thread and the tasks started so far. Without the trace facility (configUSE_TRACE_FACILITY), as on the
+// device, only the calling task can be inspected.
+UBaseType_t uxTaskGetNumberOfTasks();
+
+// "loopTask" for any task, the names are not kept.
+const char *pcTaskGetName(TaskHandle_t task);
+
+// There is no stack watermark on the host: returns 0.
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+#endif  // HOST_FREERTOS_TASK_H
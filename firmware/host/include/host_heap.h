@@ -0,0 +1,54 @@
+// Simulated heap for the host builds with HOST_SIM_HEAP: operator new/delete and heap_caps_malloc/realloc are
+// served from a fixed arena of HOST_HEAP_SIZE bytes with an address ordered first fit allocator, like the heap of
+// the ESP32. So the free heap, the largest free block and the minimum free heap behave as on the device, and every
+// allocation is counted for the call site that is active when it happens.
+#ifndef HOST_HEAP_H
+#define HOST_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of distinct call sites. Allocations of further sites are counted as "other".
+#define HOST_HEAP_MAX_SITES 32
+
+// Counters of a call site.
+struct HostHeapSite {
+  const char *name;
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t bytes;  // Requested bytes of all allocations
+  int64_t liveBytes;
+};
+
+// Counters of the whole arena.
+struct HostHeapStats {
+  size_t arenaSize;
+  size_t freeBytes;
+  size_t minFreeBytes;   // Lowest free heap so far, like esp_get_minimum_free_heap_size()
+  size_t largestFreeBlock;
+  size_t liveBytes;      // Requested bytes currently allocated
+  size_t peakLiveBytes;
+  uint32_t freeBlocks;
+};
+
+// Marks the call site of the allocations within its scope. The name must be a string literal. Scopes nest, the
+// innermost one counts.
+class HeapSite {
+ public:
+  explicit HeapSite(const char *name);
+  ~HeapSite();
+
+ private:
+  const char *previous;
+};
+
+// Returns the counters of the arena. Walks the free list, so the fragmentation is current.
+HostHeapStats hostHeapStats();
+
+// Returns the call sites seen so far, count receives their number.
+const HostHeapSite *hostHeapSites(int &count);
+
+// Clears the per site counters and the peak, e.g. after the setup phase. Live bytes are kept.
+void hostHeapResetCounters();
+
+#endif  // HOST_HEAP_H
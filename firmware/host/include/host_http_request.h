@@ -0,0 +1,121 @@
+// Fake of the AsyncHTTPRequest_Generic / AsyncHTTPSRequest_Generic clients for the host builds. Requests go to the
+// fake network (host_network.h). The allocations follow the library: the URL, every header name and value and the
+// body are copied when the request is built and kept until the next open(), the response is returned as a String.
+#ifndef HOST_HTTP_REQUEST_H
+#define HOST_HTTP_REQUEST_H
+
+#include <Arduino.h>
+
+#include <strings.h>
+
+#include <functional>
+
+#include "host_network.h"
+
+#define readyStateUnsent 0
+#define readyStateOpened 1
+#define readyStateHdrsRecvd 2
+#define readyStateLoading 3
+#define readyStateDone 4
+
+#define HOST_HTTP_MAX_HEADERS 8
+
+template <typename Self>
+class HostHttpRequest {
+ public:
+  typedef std::function<void(void *, Self *, int)> readyStateChangeCB;
+
+  ~HostHttpRequest() { release(); }
+
+  int readyState() const { return state; }
+
+  bool open(const char *method, const char *url) {
+    release();
+    this->url = copy(url);
+    state = readyStateOpened;
+    return true;
+  }
+
+  void setReqHeader(const char *name, const char *value) {
+    if (headerCount < HOST_HTTP_MAX_HEADERS) {
+      headers[headerCount][0] = copy(name);
+      headers[headerCount][1] = copy(value);
+      headerCount++;
+    }
+  }
+
+  void onReadyStateChange(readyStateChangeCB cb, void *arg = nullptr) {
+    callback = cb;
+    callbackArg = arg;
+  }
+
+  bool send(const char *body) {
+    if (state != readyStateOpened) {
+      return false;
+    }
+    this->body = copy(body);
+    return hostNetworkQueue(this, HostHttpRequest::complete);
+  }
+
+  int responseHTTPcode() const { return code; }
+
+  String responseHTTPString() const { return String(responseBody != nullptr ? responseBody : ""); }
+
+  char *respHeaderValue(const char *name) {
+    return strcasecmp(name, "X-Connection-Request") == 0 ? connectionRequest : nullptr;
+  }
+
+ private:
+  int state = readyStateUnsent;
+  char *url = nullptr;
+  char *headers[HOST_HTTP_MAX_HEADERS][2];
+  int headerCount = 0;
+  char *body = nullptr;
+  char *responseBody = nullptr;
+  char connectionRequest[12];
+  int code = 0;
+  readyStateChangeCB callback;
+  void *callbackArg = nullptr;
+
+  static char *copy(const char *s) {
+    char *out = new char[strlen(s) + 1];
+    strcpy(out, s);
+    return out;
+  }
+
+  void release() {
+    delete[] url;
+    delete[] body;
+    delete[] responseBody;
+    for (int i = 0; i < headerCount; i++) {
+      delete[] headers[i][0];
+      delete[] headers[i][1];
+    }
+    url = body = responseBody = nullptr;
+    headerCount = 0;
+  }
+
+  static void complete(void *request) { static_cast<HostHttpRequest *>(request)->finish(); }
+
+  void finish() {
+    HostNetwork &network = hostNetwork();
+    code = network.up ? network.httpCode : -4;  // Timeout
+    Self *self = static_cast<Self *>(this);
+    if (code > 0) {
+      snprintf(connectionRequest, sizeof(connectionRequest), "%u", ++network.connectionRequests);
+      responseBody = copy(network.responseBody);
+      state = readyStateHdrsRecvd;
+      if (callback) {
+        callback(callbackArg, self, state);
+      }
+    } else {
+      network.connectionRequests = 0;
+    }
+    state = readyStateDone;
+    if (callback) {
+      callback(callbackArg, self, state);
+    }
+  }
+};
+
+#endif  // HOST_HTTP_REQUEST_H
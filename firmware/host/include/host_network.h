@@ -0,0 +1,63 @@
+// Fake network of the host builds. The fake HTTP and MQTT clients (AsyncHTTPRequest_Generic.h,
+// PsychicMqttClient.h) talk to it instead of a socket; a driver sets the outcome and completes the pending HTTP
+// requests with hostNetworkPoll(), e.g. to replay outages and server errors.
+#ifndef HOST_NETWORK_H
+#define HOST_NETWORK_H
+
+#include <stdint.h>
+
+#define HOST_NETWORK_MAX_PENDING 8
+
+typedef void (*HostCompletion)(void *request);
+
+struct HostNetwork {
+  bool up = true;                 // WiFi connected
+  int httpCode = 200;             // Code of the next completed HTTP requests, <= 0: network error
+  const char *responseBody = "";  // Body of the HTTP responses
+  uint32_t connectionRequests = 0;  // Requests on the current keep-alive connection, reset by an outage
+  uint64_t httpRequests = 0;
+  uint64_t mqttPublishes = 0;
+
+  struct Pending {
+    void *request;
+    HostCompletion complete;
+  } pending[HOST_NETWORK_MAX_PENDING];
+  int pendingCount = 0;
+};
+
+inline HostNetwork &hostNetwork() {
+  static HostNetwork network;
+  return network;
+}
+
+// Queues a sent HTTP request until the next hostNetworkPoll().
+inline bool hostNetworkQueue(void *request, HostCompletion complete) {
+  HostNetwork &network = hostNetwork();
+  if (network.pendingCount == HOST_NETWORK_MAX_PENDING) {
+    return false;
+  }
+  network.pending[network.pendingCount++] = {request, complete};
+  network.httpRequests++;
+  return true;
+}
+
+// Completes the pending HTTP requests with the current outcome.
+inline void hostNetworkPoll() {
+  HostNetwork &network = hostNetwork();
+  int count = network.pendingCount;
+  network.pendingCount = 0;
+  for (int i = 0; i < count; i++) {
+    network.pending[i].complete(network.pending[i].request);
+  }
+}
+
+// Switches the network on or off. An outage drops the keep-alive connection.
+inline void hostNetworkSetUp(bool up) {
+  HostNetwork &network = hostNetwork();
+  if (!up) {
+    network.connectionRequests = 0;
+  }
+  network.up = up;
+}
+
+#endif  // HOST_NETWORK_H
@@ -0,0 +1,85 @@
+// Host implementation of the Arduino, FreeRTOS and ESP-IDF functions used by the firmware modules.
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+HostSerial Serial;
+HostWiFi WiFi;
+
+// The main thread counts as the loop task.
+static std::atomic<UBaseType_t> taskCount(1);
+
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long millis() { return (unsigned long)(esp_timer_get_time() / 1000); }
+
+unsigned long micros() { return (unsigned long)esp_timer_get_time(); }
+
+void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+void yield() { std::this_thread::yield(); }
+
+float temperatureRead() { return 45.0f; }
+
+esp_reset_reason_t esp_reset_reason() { return ESP_RST_POWERON; }
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackDepth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+  std::thread thread(task, param);
+  if (handle != nullptr) {
+    *handle = reinterpret_cast<TaskHandle_t>(thread.native_handle());
+  }
+  thread.detach();
+  taskCount++;
+  return pdPASS;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks() { return taskCount; }
+
+const char *pcTaskGetName(TaskHandle_t task) { return "loopTask"; }
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 0; }
+
+void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return new std::mutex(); }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks) {
+  static_cast<std::mutex *>(mutex)->lock();
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) {
+  static_cast<std::mutex *>(mutex)->unlock();
+  return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t mutex) { delete static_cast<std::mutex *>(mutex); }
+
+#ifndef HOST_SIM_HEAP
+// With HOST_SIM_HEAP the heap functions are served by the simulated heap, see sim_heap.cpp.
+void *heap_caps_malloc(size_t size, uint32_t caps) { return caps & MALLOC_CAP_SPIRAM ? nullptr : malloc(size); }
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+  return caps & MALLOC_CAP_SPIRAM ? nullptr : realloc(ptr, size);
+}
+
+void heap_caps_free(void *ptr) { free(ptr); }
+
+size_t heap_caps_get_free_size(uint32_t caps) { return caps & MALLOC_CAP_SPIRAM ? 0 : HOST_HEAP_SIZE; }
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) { return caps & MALLOC_CAP_SPIRAM ? 0 : HOST_HEAP_SIZE; }
+
+uint32_t esp_get_minimum_free_heap_size() { return HOST_HEAP_SIZE; }
+#endif  // HOST_SIM_HEAP
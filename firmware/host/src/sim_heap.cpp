@@ -0,0 +1,325 @@
+// Simulated heap of the host builds, see host_heap.h. Only compiled with HOST_SIM_HEAP, otherwise host.cpp maps the
+// heap functions to malloc.
+#ifdef HOST_SIM_HEAP
+
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#include <host_heap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+
+// Block granularity and header size. operator new must return 16 byte aligned memory on the host; the ESP32 heap
+// has smaller headers, so the absolute overhead is higher here, the allocation pattern is the same.
+static const size_t kAlign = 16;
+
+struct BlockHeader {
+  uint32_t size;       // Including the header
+  uint32_t requested;  // Bytes asked for, 0 if the block is free
+  uint32_t site;
+  uint32_t reserved;
+};
+
+struct FreeBlock {
+  BlockHeader header;
+  FreeBlock *next;  // Next free block by address
+};
+
+static const size_t kMinBlock = (sizeof(FreeBlock) + kAlign - 1) / kAlign * kAlign;
+
+alignas(16) static uint8_t arena[HOST_HEAP_SIZE];
+static FreeBlock *freeList = nullptr;
+static bool initialized = false;
+static std::atomic_flag lock = ATOMIC_FLAG_INIT;
+
+static HostHeapSite sites[HOST_HEAP_MAX_SITES] = {{"other", 0, 0, 0, 0}};
+static int siteCount = 1;
+static thread_local const char *currentSite = nullptr;
+
+static size_t freeBytes = HOST_HEAP_SIZE;
+static size_t minFreeBytes = HOST_HEAP_SIZE;
+static size_t liveBytes = 0;
+static size_t peakLiveBytes = 0;
+
+class ArenaLock {
+ public:
+  ArenaLock() {
+    while (lock.test_and_set(std::memory_order_acquire)) {
+    }
+  }
+  ~ArenaLock() { lock.clear(std::memory_order_release); }
+};
+
+static void initArena() {
+  freeList = reinterpret_cast<FreeBlock *>(arena);
+  freeList->header.size = HOST_HEAP_SIZE / kAlign * kAlign;
+  freeList->header.requested = 0;
+  freeList->next = nullptr;
+  freeBytes = minFreeBytes = freeList->header.size;
+  initialized = true;
+}
+
+static uint32_t siteIndex(const char *name) {
+  if (name == nullptr) {
+    return 0;
+  }
+  for (int i = 1; i < siteCount; i++) {
+    if (sites[i].name == name) {
+      return i;
+    }
+  }
+  if (siteCount == HOST_HEAP_MAX_SITES) {
+    return 0;
+  }
+  sites[siteCount] = {name, 0, 0, 0, 0};
+  return siteCount++;
+}
+
+static bool inArena(const void *ptr) { return ptr >= arena && ptr < arena + sizeof(arena); }
+
+// Block size for an allocation of size bytes.
+static size_t blockSize(size_t size) {
+  size_t needed = (size + sizeof(BlockHeader) + kAlign - 1) / kAlign * kAlign;
+  return needed < kMinBlock ? kMinBlock : needed;
+}
+
+// Counts an allocation of size bytes in block for the current site. Must be called with the lock held.
+static void countAlloc(FreeBlock *block, size_t size) {
+  uint32_t site = siteIndex(currentSite);
+  block->header.requested = size;
+  block->header.site = site;
+  sites[site].allocs++;
+  sites[site].bytes += size;
+  sites[site].liveBytes += size;
+  liveBytes += size;
+  if (liveBytes > peakLiveBytes) {
+    peakLiveBytes = liveBytes;
+  }
+}
+
+// Counts the release of the allocation in block for its site. Must be called with the lock held.
+static void countFree(FreeBlock *block) {
+  HostHeapSite &site = sites[block->header.site];
+  site.frees++;
+  site.liveBytes -= block->header.requested;
+  liveBytes -= block->header.requested;
+  block->header.requested = 0;
+}
+
+// Inserts a block into the free list by address and merges it with its neighbours. Must be called with the lock
+// held.
+static void insertFree(FreeBlock *block) {
+  FreeBlock *previous = nullptr;
+  FreeBlock *next = freeList;
+  while (next != nullptr && next < block) {
+    previous = next;
+    next = next->next;
+  }
+  block->next = next;
+  if (next != nullptr && reinterpret_cast<uint8_t *>(block) + block->header.size == reinterpret_cast<uint8_t *>(next)) {
+    block->header.size += next->header.size;
+    block->next = next->next;
+  }
+  if (previous == nullptr) {
+    freeList = block;
+  } else if (reinterpret_cast<uint8_t *>(previous) + previous->header.size == reinterpret_cast<uint8_t *>(block)) {
+    previous->header.size += block->header.size;
+    previous->next = block->next;
+  } else {
+    previous->next = block;
+  }
+}
+
+static void *arenaAlloc(size_t size) {
+  if (size == 0) {
+    size = 1;
+  }
+  size_t needed = blockSize(size);
+
+  ArenaLock guard;
+  if (!initialized) {
+    initArena();
+  }
+  // First fit in address order
+  FreeBlock **link = &freeList;
+  while (*link != nullptr && (*link)->header.size < needed) {
+    link = &(*link)->next;
+  }
+  FreeBlock *block = *link;
+  if (block == nullptr) {
+    return nullptr;
+  }
+  if (block->header.size - needed >= kMinBlock) {
+    FreeBlock *rest = reinterpret_cast<FreeBlock *>(reinterpret_cast<uint8_t *>(block) + needed);
+    rest->header.size = block->header.size - needed;
+    rest->header.requested = 0;
+    rest->next = block->next;
+    *link = rest;
+    block->header.size = needed;
+  } else {
+    *link = block->next;
+  }
+
+  countAlloc(block, size);
+  freeBytes -= block->header.size;
+  if (freeBytes < minFreeBytes) {
+    minFreeBytes = freeBytes;
+  }
+  return reinterpret_cast<uint8_t *>(block) + sizeof(BlockHeader);
+}
+
+static void arenaFree(void *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  if (!inArena(ptr)) {
+    free(ptr);
+    return;
+  }
+
+  ArenaLock guard;
+  FreeBlock *block = reinterpret_cast<FreeBlock *>(static_cast<uint8_t *>(ptr) - sizeof(BlockHeader));
+  countFree(block);
+  freeBytes += block->header.size;
+  insertFree(block);
+}
+
+// As multi_heap_realloc() of the ESP32: the block is shrunk or grown into a free successor in place if possible,
+// otherwise moved. Every call that does not free is counted as an allocation of the current site and a release of
+// the old one, in place or not.
+static void *arenaRealloc(void *ptr, size_t size) {
+  if (ptr == nullptr) {
+    return arenaAlloc(size);
+  }
+  if (size == 0) {
+    arenaFree(ptr);
+    return nullptr;
+  }
+  if (!inArena(ptr)) {
+    return realloc(ptr, size);
+  }
+
+  size_t needed = blockSize(size);
+  size_t oldSize;
+  {
+    ArenaLock guard;
+    FreeBlock *block = reinterpret_cast<FreeBlock *>(static_cast<uint8_t *>(ptr) - sizeof(BlockHeader));
+    oldSize = block->header.requested;
+    if (block->header.size < needed) {
+      uint8_t *end = reinterpret_cast<uint8_t *>(block) + block->header.size;
+      FreeBlock **link = &freeList;
+      while (*link != nullptr && reinterpret_cast<uint8_t *>(*link) < end) {
+        link = &(*link)->next;
+      }
+      FreeBlock *next = *link;
+      if (next != nullptr && reinterpret_cast<uint8_t *>(next) == end &&
+          block->header.size + next->header.size >= needed) {
+        *link = next->next;
+        freeBytes -= next->header.size;
+        block->header.size += next->header.size;
+      }
+    }
+    if (block->header.size >= needed) {
+      if (block->header.size - needed >= kMinBlock) {
+        FreeBlock *rest = reinterpret_cast<FreeBlock *>(reinterpret_cast<uint8_t *>(block) + needed);
+        rest->header.size = block->header.size - needed;
+        rest->header.requested = 0;
+        block->header.size = needed;
+        freeBytes += rest->header.size;
+        insertFree(rest);
+      }
+      if (freeBytes < minFreeBytes) {
+        minFreeBytes = freeBytes;
+      }
+      countFree(block);
+      countAlloc(block, size);
+      return ptr;
+    }
+  }
+
+  void *moved = arenaAlloc(size);
+  if (moved != nullptr) {
+    memcpy(moved, ptr, oldSize < size ? oldSize : size);
+    arenaFree(ptr);
+  }
+  return moved;
+}
+
+static void *allocOrThrow(size_t size) {
+  void *ptr = arenaAlloc(size);
+  if (ptr == nullptr) {
+    fprintf(stderr, "Simulated heap exhausted: %zu bytes requested, %zu free\n", size, freeBytes);
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+HeapSite::HeapSite(const char *name) : previous(currentSite) { currentSite = name; }
+
+HeapSite::~HeapSite() { currentSite = previous; }
+
+HostHeapStats hostHeapStats() {
+  ArenaLock guard;
+  if (!initialized) {
+    initArena();
+  }
+  HostHeapStats stats = {sizeof(arena), freeBytes, minFreeBytes, 0, liveBytes, peakLiveBytes, 0};
+  for (FreeBlock *block = freeList; block != nullptr; block = block->next) {
+    if (block->header.size - sizeof(BlockHeader) > stats.largestFreeBlock) {
+      stats.largestFreeBlock = block->header.size - sizeof(BlockHeader);
+    }
+    stats.freeBlocks++;
+  }
+  return stats;
+}
+
+const HostHeapSite *hostHeapSites(int &count) {
+  count = siteCount;
+  return sites;
+}
+
+void hostHeapResetCounters() {
+  ArenaLock guard;
+  for (int i = 0; i < siteCount; i++) {
+    sites[i].allocs = sites[i].frees = sites[i].bytes = 0;
+  }
+  peakLiveBytes = liveBytes;
+  minFreeBytes = freeBytes;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) { return caps & MALLOC_CAP_SPIRAM ? nullptr : arenaAlloc(size); }
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+  return caps & MALLOC_CAP_SPIRAM ? nullptr : arenaRealloc(ptr, size);
+}
+
+void heap_caps_free(void *ptr) { arenaFree(ptr); }
+
+size_t heap_caps_get_free_size(uint32_t caps) { return caps & MALLOC_CAP_SPIRAM ? 0 : hostHeapStats().freeBytes; }
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  return caps & MALLOC_CAP_SPIRAM ? 0 : hostHeapStats().largestFreeBlock;
+}
+
+uint32_t esp_get_minimum_free_heap_size() { return hostHeapStats().minFreeBytes; }
+
+void *operator new(size_t size) { return allocOrThrow(size); }
+
+void *operator new[](size_t size) { return allocOrThrow(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return arenaAlloc(size); }
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return arenaAlloc(size); }
+
+void operator delete(void *ptr) noexcept { arenaFree(ptr); }
+
+void operator delete[](void *ptr) noexcept { arenaFree(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { arenaFree(ptr); }
+
+void operator delete[](void *ptr, size_t) noexcept { arenaFree(ptr); }
+
+#endif  // HOST_SIM_HEAP
@@ -1,16 +1,31 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <esp_heap_caps.h>
+#include <esp_ota_ops.h>
 
 #include "config.h"
+#include "connectivity.h"
 #include "esp_status.h"
+#include "event_detector.h"
 #include "http_sender.h"
 #include "json_helper.h"
+#include "log_ring.h"
+#include "loop_supervisor.h"
 #include "mqtt_handler.h"
 #include "ntp.h"
 #include "ota.h"
+#include "patch_server.h"
+#include "power_manager.h"
+#include "pull_server.h"
+#include "replay_sensor.h"
+#include "ripple_analyzer.h"
 #include "ringbuffer.h"
+#include "sample_clock.h"
+#include "sample_scheduler.h"
 #include "sensor.h"
+#include "stream_uploader.h"
+#include "synthetic_sensor.h"
+#include "wifi_cache.h"
 
 SET_LOOP_TASK_STACK_SIZE(16 * 1024);
 
@@ -22,97 +37,404 @@ static_assert(sizeof(WIFI_PASSWORD) > 0, "WIFI_PASSWORD must not be empty!");
 
 static_assert(sizeof(BUFFER_SIZE) > 0, "BUFFER_SIZE must not be empty!");
 static_assert(sizeof(CHUNK_SIZE) > 0, "CHUNK_SIZE must not be empty!");
-static_assert(sizeof(JSON_BUFFER_SIZE) > 0, "JSON_BUFFER_SIZE must not be empty!");
+static_assert(CHUNK_SIZE > 0, "CHUNK_SIZE must be greater than 0!");
+static_assert(BUFFER_SIZE == 0 || BUFFER_SIZE >= CHUNK_SIZE, "BUFFER_SIZE must be 0 (automatic) or >= CHUNK_SIZE!");
+#ifdef RING_BUFFER_PERSISTENT
+static_assert(BUFFER_SIZE > 0, "RING_BUFFER_PERSISTENT requires a static buffer (BUFFER_SIZE > 0)!");
+#endif
 
 static_assert(sizeof(USE_HTTP_SENDER) > 0, "USE_HTTP_SENDER must not be empty!");
 static_assert(sizeof(HTTP_SERVER_URL) > 0, "HTTP_SERVER_URL must not be empty!");
+static_assert(JSON_BATCH_VERSION == 1 || JSON_BATCH_VERSION == 2, "JSON_BATCH_VERSION must be 1 or 2!");
 
 static_assert(sizeof(USE_MQTT_SENDER) > 0, "USE_MQTT_SENDER must not be empty!");
 static_assert(sizeof(MQTT_SERVER_URL) > 0, "MQTT_SERVER_URL must not be empty!");
 
+#if defined(SYNTHETIC_SENSOR_SPEED)
+SyntheticSensor syntheticSensor(SYNTHETIC_SENSOR_SEED, SYNTHETIC_SENSOR_SPEED);
+Sensor &sensor = syntheticSensor;
+#elif defined(REPLAY_TRACE)
+TraceSample replayTrace[REPLAY_TRACE_MAX_SAMPLES];
+ReplaySensor replaySensor(replayTrace, ReplaySensor::parseCsv(REPLAY_TRACE, replayTrace, REPLAY_TRACE_MAX_SAMPLES),
+                          REPLAY_TRACE_SPEED);
+Sensor &sensor = replaySensor;
+#else
 INA219Sensor sensorINA219;
 Sensor &sensor = sensorINA219;
+#endif
 
-unsigned long lastMeasureTime = 0;
+SampleScheduler sampleScheduler(MEASURE_INTERVAL);
 unsigned long lastSendTime = 0;
 
 // Status
 EspStatus espStatus;
+LoopSupervisor supervisor;
 unsigned long lastStatusTime = 0;
 
+// Power
+PowerManager power(POWER_MODE, UPLOAD_INTERVAL, UPLOAD_FILL_THRESHOLD, UPLOAD_TIMEOUT);
+bool uploadFailed = false;
+
 // OTA
 OTAHandler ota;
+#ifdef OTA_PATCH_PORT
+PatchServer patchServer(ota, OTA_PATCH_PORT);
+#endif
 
 // NTP
 NTPHandler ntp;
+SampleClock sampleClock;
 
 // Sending stuff
 Measurement sendBuffer[CHUNK_SIZE];
 int sendBufferSize = 0;
-RingBuffer ringBuffer(BUFFER_SIZE);
+
+#ifndef RING_BUFFER_STORAGE_ATTR
+#ifdef RING_BUFFER_PERSISTENT
+#define RING_BUFFER_STORAGE_ATTR __NOINIT_ATTR
+#else
+#define RING_BUFFER_STORAGE_ATTR
+#endif
+#endif
+
+#if BUFFER_SIZE > 0
+Measurement ringBufferStorage[BUFFER_SIZE] RING_BUFFER_STORAGE_ATTR;
+RingBuffer<BUFFER_SIZE> ringBuffer(ringBufferStorage);
+#ifdef RING_BUFFER_PERSISTENT
+// Indices and checksum of the store, not cleared on a warm reset either
+RingBufferState ringBufferState __NOINIT_ATTR;
+#endif
+#else
+RingBuffer<0> ringBuffer;
+#endif
+typedef decltype(ringBuffer) MeasurementBuffer;
+
+#ifdef PULL_SERVER_PORT
+PullServer<MeasurementBuffer> pullServer(ringBuffer, PULL_SERVER_PORT);
+#endif
 
 HttpSender http;
-JsonHelper<JSON_BUFFER_SIZE> jsonHelper(CHUNK_SIZE);
+#ifdef HTTP_STATUS_URL
+HttpSender statusHttp;
+#endif
+JsonHelper<CHUNK_SIZE> jsonHelper;
 MqttHandler mqttHandler;
+#ifdef STREAM_UPLOAD
+StreamUploader<MeasurementBuffer> uploader(ringBuffer);
+#endif
+#ifdef EVENT_DETECTION
+EventDetector<EVENT_PRE_SAMPLES> eventDetector;
+#endif
+#ifdef RIPPLE_ANALYSIS
+RippleAnalyzer<RIPPLE_SAMPLES> rippleAnalyzer;
+RippleRecord rippleRecord = {};
+unsigned long lastRippleTime = 0;
+#endif
 
-unsigned long lastWifiReconnectAttempt = 0;
-
-void wifiReconnect() {
-  if (WiFi.status() == WL_CONNECTED) {
-    return;
+// Connectivity on top of the ESP32 WiFi, SNTP and MQTT stack. WiFi state changes arrive as events. Reconnects are
+// scheduled by Connectivity, so the reconnect of the WiFi driver is switched off.
+class EspConnectivityBackend : public ConnectivityBackend {
+ public:
+  // Registers the WiFi event handlers. Must be called in setup() before the radio is switched on.
+  void begin() {
+    WiFi.onEvent([](WiFiEvent_t event, WiFiEventInfo_t info) { wifiConnected = true; },
+                 ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    WiFi.onEvent(
+        [](WiFiEvent_t event, WiFiEventInfo_t info) {
+          wifiConnected = false;
+          wifiFailed = true;
+        },
+        ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    WiFi.setHostname(HOST_NAME);
+    WiFi.setAutoReconnect(false);
+    wifiCache.begin();
   }
 
-  unsigned long currentMillis = millis();
-  if (currentMillis - lastWifiReconnectAttempt >= WIFI_RECONNECT_INTERVAL) {
-    lastWifiReconnectAttempt = currentMillis;
-    Serial.println("WiFi disconnected. Attempting reconnect...");
+  void beginWifi() override { WiFi.begin(WIFI_SSID, WIFI_PASSWORD); }
 
+  void reconnectWifi() override {
     WiFi.disconnect();
-
+    // Back to DHCP after a fast attempt with the cached address
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+    staticAddress = false;
     WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
   }
+
+  // Joins the cached access point on its channel, skipping the scan, and reuses the address of a recent lease,
+  // skipping DHCP.
+  bool reconnectWifiFast() override {
+    const WifiLease *lease = wifiCache.get();
+    if (lease == nullptr) {
+      return false;
+    }
+    WiFi.disconnect();
+    staticAddress = wifiCache.isAddressValid(epochMs());
+    if (staticAddress) {
+      WiFi.config(IPAddress(lease->ip), IPAddress(lease->gateway), IPAddress(lease->subnet), IPAddress(lease->dns));
+    } else {
+      WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+    }
+    wifiFailed = false;
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD, lease->channel, lease->bssid);
+    return true;
+  }
+
+  bool takeWifiFailure() override {
+    bool failed = wifiFailed;
+    wifiFailed = false;
+    return failed;
+  }
+
+  void onWifiUp(bool fast) override { wifiCache.store(!staticAddress, epochMs()); }
+
+  bool isWifiConnected() override { return wifiConnected; }
+
+  void startServices() override;
+
+  bool isTimeValid() override { return sampleClock.isValid(); }
+
+  bool isMqttConnected() override { return USE_MQTT_SENDER && mqttHandler.isConnected(); }
+
+ private:
+  static volatile bool wifiConnected;
+  static volatile bool wifiFailed;
+  WifiCache wifiCache;
+  bool staticAddress = false;
+
+  static int64_t epochMs() { return sampleClock.isValid() ? sampleClock.nowMs() : 0; }
+};
+
+volatile bool EspConnectivityBackend::wifiConnected = false;
+volatile bool EspConnectivityBackend::wifiFailed = false;
+
+EspConnectivityBackend connectivityBackend;
+Connectivity connectivity(connectivityBackend, WIFI_RECONNECT_INTERVAL);
+
+// Time after boot of the first sample
+unsigned long firstSampleAt = 0;
+
+bool isUploading() {
+#ifdef STREAM_UPLOAD
+  return uploader.isSending();
+#else
+  return http.isSending();
+#endif
 }
 
 void sendChunk() {
-  if (http.isSending()) {
-    Serial.println("Already sending. Skip.");
+  if (isUploading()) {
+    LOG_DEBUG("Already sending. Skip.");
     return;
   }
 
+#ifdef STREAM_UPLOAD
+  // The upload task streams the backlog
+  uploader.requestUpload();
+  return;
+#endif
+
   int sendCount = ringBuffer.getChunk(sendBuffer, CHUNK_SIZE);
   if (sendCount == 0) {
-    Serial.println("No data available for sending.");
+    LOG_DEBUG("No data available for sending.");
     return;
   }
 
   String jsonPayload;
-  jsonHelper.toJson(sendBuffer, sendCount, jsonPayload);
+  jsonHelper.toJson(sendBuffer, sendCount, sampleClock.nowMs(), jsonPayload);
   http.sendRequest(jsonPayload);
 
   sendBufferSize = sendCount;
 
-  Serial.print("Asynchronous sending process started for ");
-  Serial.print(sendCount);
-  Serial.println(" records.");
+  LOG_DEBUG("Asynchronous sending process started for %d records.", sendCount);
+}
+
+// Burst upload of the backlog in the duty-cycled power modes: WiFi is switched on when an upload is due and off
+// again once the ring buffer is empty, the upload failed or timed out.
+void uploadBurst() {
+  if (!power.isRadioOn()) {
+    if (power.isUploadDue(ringBuffer.getCount())) {
+      uploadFailed = false;
+      power.startUpload(WIFI_SSID, WIFI_PASSWORD);
+    }
+    return;
+  }
+
+  if (uploadFailed || power.isUploadTimedOut()) {
+    power.finishUpload(false);
+    return;
+  }
+  // Not before the time sync, see Connectivity::isHttpReady(); a burst without it ends by the upload timeout
+  if (WiFi.status() != WL_CONNECTED || !connectivity.isTimeValid() || isUploading()) {
+    return;
+  }
+  if (ringBuffer.getCount() == 0) {
+    power.finishUpload(true);
+    return;
+  }
+  sendChunk();
+}
+
+// Restarts into an installed update. The new image starts with an empty ring buffer (see RingBuffer::persist()), so
+// the backlog is uploaded first, for at most OTA_DRAIN_TIMEOUT.
+void restartAfterUpdate() {
+  bool drained = !USE_HTTP_SENDER || (ringBuffer.getCount() == 0 && !isUploading());
+  if (ota.isRestartDue(drained)) {
+    if (!drained) {
+      LOG_WARN("Restarting into the update with %d unsent records.", ringBuffer.getCount());
+    }
+    // Time for the log task and the response of the patch server
+    delay(500);
+    ESP.restart();
+  }
+  if (!drained && !isUploading() && connectivity.isHttpReady()) {
+    sendChunk();
+  }
+}
+
+// Keeps a record for the upload and publishes it.
+void storeMeasurement(const Measurement &m) {
+  if (USE_HTTP_SENDER) {
+    ringBuffer.addMeasurement(m);
+  }
+  if (USE_MQTT_SENDER) {
+    // Back to the caller's section afterwards, the rest of the sample section is not MQTT time
+    LoopSubsystem previous = supervisor.enter(LOOP_MQTT);
+    String jsonPayload;
+    jsonHelper.toJson(m, jsonPayload);
+    mqttHandler.publishMeasurement(jsonPayload);
+    supervisor.enter(previous);
+  }
 }
 
+#ifdef RIPPLE_ANALYSIS
+// Bursts the sensor, analyzes the ripple and publishes the record. Blocks the loop for the capture, RIPPLE_SAMPLES *
+// RIPPLE_SAMPLE_US, and the analysis.
+void captureRipple() {
+  uint32_t start = micros();
+  uint32_t spanUs = sensor.captureBurst(rippleAnalyzer.getSamples(), RIPPLE_SAMPLES, RIPPLE_SAMPLE_US);
+  uint32_t captureUs = micros() - start;
+  if (spanUs == 0) {
+    LOG_WARN("Ripple: the sensor has no burst mode.");
+    return;
+  }
+  start = micros();
+  rippleAnalyzer.analyze(spanUs, rippleRecord);
+  rippleRecord.analyzeUs = micros() - start;
+  rippleRecord.captureUs = captureUs;
+  rippleRecord.timestamp = sampleClock.nowMs();
+
+  char ripple[RIPPLE_JSON_SIZE];
+  rippleRecord.toJson(ripple);
+  // Numbers only: the log ring keeps %s as a pointer, the JSON buffer is gone by the time it is drained
+  const RipplePeak *peak = rippleRecord.peakCount > 0 ? &rippleRecord.peaks[0] : nullptr;
+  LOG_INFO("Ripple: rms %d uA, p2p %d uA, peak %d mHz %d uA, analyzed in %u us", (int)rippleRecord.rmsUa,
+           (int)rippleRecord.peakToPeakUa, peak ? (int)peak->milliHz : 0, peak ? (int)peak->amplitudeUa : 0,
+           (unsigned)rippleRecord.analyzeUs);
+  if (USE_MQTT_SENDER) {
+    mqttHandler.publishRipple(ripple);
+  }
+}
+#endif
+
 void sendStatus() {
-  String status;
-  espStatus.getStatus(status);
-  Serial.println(status);
+  espStatus.setWifiReconnects(connectivity.getReconnects());
+  espStatus.setReconnectLatency(connectivity.getFastReconnects(), connectivity.getLastReconnectMs(),
+                                connectivity.getMaxReconnectMs());
+  espStatus.setBootStats(firstSampleAt, connectivity.getWifiUpAt(), connectivity.getTimeValidAt(),
+                         connectivity.getMqttUpAt());
+  espStatus.setBufferFill(ringBuffer.getCount(), ringBuffer.getCapacity());
+  espStatus.setPowerStats(power.getRadioOnMsPerHour(), power.getWakesPerHour());
+#ifdef STREAM_UPLOAD
+  const HttpStats &httpStats = uploader.getStats();
+#else
+  const HttpStats &httpStats = http.getStats();
+#endif
+  espStatus.setHttpStats(httpStats.requests, httpStats.connections, httpStats.lastSetupMs, httpStats.maxSetupMs,
+                         httpStats.maxHeapDrop);
+  espStatus.setLogStats(logRing().getDropped());
+  espStatus.setLoopStats(supervisor);
+  espStatus.setSampleStats(sampleScheduler.getMissed(), sampleScheduler.getMaxGapMs());
+#ifdef RIPPLE_ANALYSIS
+  const RipplePeak *ripplePeak = rippleRecord.peakCount > 0 ? &rippleRecord.peaks[0] : nullptr;
+  espStatus.setRippleStats(rippleRecord.rmsUa, rippleRecord.peakToPeakUa, ripplePeak ? ripplePeak->milliHz : 0,
+                           ripplePeak ? ripplePeak->amplitudeUa : 0, rippleRecord.analyzeUs);
+#endif
+#ifdef EVENT_DETECTION
+  const EventStats &eventStats = eventDetector.getStats();
+  espStatus.setEventStats(eventStats.events, eventStats.samples, eventStats.stored + eventStats.summaries);
+#endif
+  const OtaStats &otaStats = ota.getStats();
+  espStatus.setOtaStats(otaStats.updates, otaStats.failures, otaStats.lastMs, otaStats.lastBytes,
+                        otaStats.lastImageBytes, otaStats.lastBytesPerSec);
+  espStatus.update();
+  const char *status = espStatus.toJson(HOST_NAME);
+  const StatusRecord &record = espStatus.getRecord();
+  LOG_INFO("Status: free heap %u, buffer %u/%u, dropped logs %u, staging overflows %u", record.freeHeap,
+           record.bufferCount, record.bufferCapacity, record.logDropped, ringBuffer.getStagingOverflows());
   if (USE_MQTT_SENDER) {
     mqttHandler.publishStatus(status);
   }
+#ifdef HTTP_STATUS_URL
+  // The status carries no sample timestamps, it does not wait for the time sync
+  if (connectivity.isWifiConnected() && !statusHttp.isSending()) {
+    statusHttp.sendRequest(status);
+  }
+#endif
 }
 
-int64_t getCurrentEpochUnixTimestamp() {
-  timeval tv;
-  gettimeofday(&tv, nullptr);
-  return (int64_t)tv.tv_sec * 1000LL + (int64_t)tv.tv_usec / 1000LL;
+// Samples taken before the first NTP sync carry the time since power-on. Once the clock is synchronized they are
+// corrected in bulk. Runs in the loop task (SampleClock::poll()), which also stamps and stores the samples.
+void restampSamples(int64_t deltaMs) {
+  int restamped = ringBuffer.restamp(CLOCK_VALID_EPOCH_MS, deltaMs);
+  power.restampRtc(CLOCK_VALID_EPOCH_MS, deltaMs);
+#ifdef EVENT_DETECTION
+  eventDetector.restamp(CLOCK_VALID_EPOCH_MS, deltaMs);
+#endif
+  LOG_INFO("Clock stepped by %lld ms, re-stamped %d samples.", deltaMs, restamped);
+}
+
+// Called once WiFi is up for the first time.
+void EspConnectivityBackend::startServices() {
+  Serial.print("IP address: ");
+  Serial.println(WiFi.localIP());
+
+  // OTA, received by a task of its own
+  ota.setup(HOST_NAME);
+#ifdef OTA_PATCH_PORT
+  patchServer.setup();
+#endif
+
+  // Synchronize NTP time
+  ntp.setup(sampleClock);
+
+#ifdef PULL_SERVER_PORT
+  pullServer.setup();
+#endif
+
+  // MQTT
+  if (USE_MQTT_SENDER) {
+    mqttHandler.setup(MQTT_SERVER_URL, HOST_NAME);
+    // Log lines up to MQTT_LOG_LEVEL also go to <HOST_NAME>/log
+    logRing().setSink([](uint8_t level, const char *line) { mqttHandler.publishLog(line); }, MQTT_LOG_LEVEL);
+  }
 }
 
 void setup() {
   Serial.begin(115200);
+  logRing().begin();
+
+  sampleClock.begin();
+
+  // Deep sleep mode: a timer wake only takes a sample, unless an upload is due
+  power.begin();
+  if (power.isSampleWake()) {
+    sensor.setup();
+    power.storeInRtc({.value = sensor.getCurrentInUa(), .timestamp = sampleClock.nowMs()});
+    if (!power.isUploadDue(power.getRtcCount())) {
+      power.deepSleep(MEASURE_INTERVAL);
+    }
+  }
+
   Serial.println("SolarCurrentLogger starting...");
 
   Serial.println("Stacksize is: " + String(getArduinoLoopTaskStackSize()));
@@ -121,28 +443,34 @@ void setup() {
   Serial.println("FreeHeap: " + String(esp_get_free_heap_size()) + " Bytes");
   Serial.println("MinFreeHeap: " + String(esp_get_minimum_free_heap_size()) + " Bytes");
 
-  // Initialize sensor
-  sensor.setup();
-
-  // Establish WiFi connection
-  WiFi.setHostname(HOST_NAME);
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  Serial.print("Connecting to WiFi");
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
+  // Allocate the measurement store (PSRAM if available) unless it is static
+  ringBuffer.begin();
+#ifdef RING_BUFFER_PERSISTENT
+  // The backlog survives a panic, a watchdog and a software reset of the same image, internal RAM is not retained
+  // otherwise. A new image (OTA update) places the store elsewhere: its ELF hash tells persist() to start empty.
+  esp_reset_reason_t resetReason = esp_reset_reason();
+  if (resetReason != ESP_RST_SW && resetReason != ESP_RST_PANIC && resetReason != ESP_RST_INT_WDT &&
+      resetReason != ESP_RST_TASK_WDT && resetReason != ESP_RST_WDT) {
+    ringBufferState.magic = 0;
   }
-  Serial.println("\nWiFi connected");
-  Serial.println("IP address: ");
-  Serial.println(WiFi.localIP());
-
-  // OTA
-  ota.setup(HOST_NAME);
+  uint32_t recoverStart = micros();
+  const uint8_t *elfSha = esp_ota_get_app_description()->app_elf_sha256;
+  uint32_t image = elfSha[0] | elfSha[1] << 8 | elfSha[2] << 16 | (uint32_t)elfSha[3] << 24;
+  int recovered = ringBuffer.persist(&ringBufferState, image);
+  uint32_t recoverUs = micros() - recoverStart;
+  espStatus.setBufferRecovery(recovered, recoverUs);
+  Serial.printf("Ring buffer: %d records kept across the reset, checked in %u us\n", recovered, recoverUs);
+#else
+  // Staged samples are moved into the store off the sampling task, well before the staging area is full
+  ringBuffer.startFlushTask(MEASURE_INTERVAL * RING_BUFFER_STAGING_SIZE / 2);
+#endif
+  power.moveRtcTo(ringBuffer);
 
-  // Synchronize NTP time
-  ntp.setup();
+  // Initialize sensor
+  sensor.setup();
 
   // HTTP
+  jsonHelper.setDevice(HOST_NAME);
   http.setServerUrl(HTTP_SERVER_URL);
 
 #ifdef API_TOKEN
@@ -154,62 +482,148 @@ void setup() {
 #endif
 
   http.setFailureCallback([](int httpCode, const String &response) {
-    Serial.printf("HTTP request failed: %d %s\nSending failed, data remains in the ring buffer.\n", httpCode,
-                  response.c_str());
+    uploadFailed = true;
+    LOG_WARN("HTTP request failed: %d. Data remains in the ring buffer.", httpCode);
   });
 
   http.setSuccessCallback([](int httpCode, const String &response) {
-    Serial.printf("HTTP request successful: %d %s\n", httpCode, response.c_str());
     int removed = ringBuffer.removeChunk(sendBuffer, sendBufferSize);
-    Serial.print("Successfully removed transmitted records: ");
-    Serial.println(removed);
+    LOG_INFO("HTTP request successful: %d, removed %d records.", httpCode, removed);
   });
 
-  // MQTT
-  mqttHandler.setup(MQTT_SERVER_URL, HOST_NAME);
+#ifdef STREAM_UPLOAD
+  uploader.setServerUrl(HTTP_SERVER_URL);
+#ifdef API_TOKEN
+  uploader.setApiToken(API_TOKEN);
+#endif
+#ifdef BASIC_AUTH_USERNAME
+  uploader.setBasicAuth(BASIC_AUTH_USERNAME, BASIC_AUTH_PASSWORD);
+#endif
+  uploader.setDevice(HOST_NAME);
+  uploader.setClock([]() { return sampleClock.nowMs(); });
+  uploader.setResultCallback([](int httpCode, int records) {
+    if (httpCode < 200 || httpCode >= 300) {
+      uploadFailed = true;
+      LOG_WARN("Upload failed: %d. Data remains in the ring buffer.", httpCode);
+    } else {
+      LOG_INFO("Upload successful: %d, removed %d records.", httpCode, records);
+    }
+  });
+  uploader.begin();
+#endif
+
+#ifdef HTTP_STATUS_URL
+  statusHttp.setServerUrl(HTTP_STATUS_URL);
+#ifdef API_TOKEN
+  statusHttp.setApiToken(API_TOKEN);
+#endif
+#ifdef BASIC_AUTH_USERNAME
+  statusHttp.setBasicAuth(BASIC_AUTH_USERNAME, BASIC_AUTH_PASSWORD);
+#endif
+#endif
+
+#ifdef PULL_SERVER_PORT
+#ifdef API_TOKEN
+  pullServer.setApiToken(API_TOKEN);
+#endif
+#endif
+
+#ifdef OTA_PATCH_PORT
+#ifdef API_TOKEN
+  patchServer.setApiToken(API_TOKEN);
+#endif
+#endif
 
-  lastMeasureTime = millis();
+  // Network: WiFi, NTP, MQTT and OTA come up in the background, see EspConnectivityBackend
+  sampleClock.setStepCallback(restampSamples);
+  connectivityBackend.begin();
+  connectivity.setAutoReconnect(!power.isDutyCycled());
+  connectivity.begin(millis());
+
+  // The first sample is taken right away
+  sampleScheduler.begin(millis());
   lastSendTime = millis();
 
   sendStatus();
   lastStatusTime = millis();
-}
 
-void loop() {
-  wifiReconnect();
-
-  // OTA
-  ota.loop();
+  // The duty-cycled modes start with an upload
+  if (power.isDutyCycled()) {
+    power.startUpload(WIFI_SSID, WIFI_PASSWORD);
+  }
 
-  // Measurement
-  if (millis() - lastMeasureTime >= MEASURE_INTERVAL) {
-    lastMeasureTime = lastMeasureTime + MEASURE_INTERVAL;
+  // Loop timing and watchdog
+  supervisor.begin();
+}
 
-    Measurement m = {.value = sensor.getCurrentInMa(), .timestamp = getCurrentEpochUnixTimestamp()};
-    if (USE_HTTP_SENDER) {
-      ringBuffer.addMeasurement(m);
+void loop() {
+  supervisor.beginIteration();
+  connectivity.loop(millis());
+
+  // Measurement. Slots missed while the loop was held up are skipped, not caught up with wrong timestamps.
+  supervisor.enter(LOOP_SAMPLE);
+  sampleClock.poll();
+  if (sampleScheduler.isDue(millis())) {
+    Measurement m = {.value = sensor.getCurrentInUa(), .timestamp = sampleClock.nowMs()};
+    if (firstSampleAt == 0) {
+      firstSampleAt = millis();
     }
-
-    if (USE_MQTT_SENDER) {
-      String jsonPayload;
-      jsonHelper.toJson(m, jsonPayload);
-      mqttHandler.publishMeasurement(jsonPayload);
+#ifdef EVENT_DETECTION
+    // Full rate around events, summaries otherwise. Events are published right away.
+    if (eventDetector.add(m, storeMeasurement) != 0) {
+      const DetectorEvent &detected = eventDetector.getEvent();
+      char event[EVENT_JSON_SIZE];
+      detected.toJson(event);
+      // Numbers only: the log ring keeps %s as a pointer, the JSON buffer is gone by the time it is drained
+      LOG_INFO("Event: kinds 0x%x, %d uA, step %d uA, baseline %d uA", (unsigned)detected.kinds, (int)detected.value,
+               (int)detected.step, (int)detected.baseline);
+      if (USE_MQTT_SENDER) {
+        mqttHandler.publishEvent(event);
+      }
     }
-    Serial.printf("Measurement: %.2f mA, Time: %lld Used slots: %d/%d\n", m.value, m.timestamp, ringBuffer.getCount(),
-                  BUFFER_SIZE);
+#else
+    storeMeasurement(m);
+#endif
+    LOG_INFO("Measurement: %d uA, Time: %lld Used slots: %d/%d", (int)m.value, m.timestamp, ringBuffer.getCount(),
+              ringBuffer.getCapacity());
   }
 
-  if (USE_HTTP_SENDER) {
-    // Send data
-    if (millis() - lastSendTime >= SEND_INTERVAL) {
+#ifdef RIPPLE_ANALYSIS
+  supervisor.enter(LOOP_RIPPLE);
+  if (millis() - lastRippleTime >= RIPPLE_INTERVAL) {
+    lastRippleTime = lastRippleTime + RIPPLE_INTERVAL;
+    captureRipple();
+  }
+#endif
+
+  supervisor.enter(LOOP_UPLOAD);
+  if (ota.isRestartRequested()) {
+    restartAfterUpdate();
+  } else if (USE_HTTP_SENDER) {
+    if (power.isDutyCycled()) {
+      uploadBurst();
+    } else if (millis() - lastSendTime >= SEND_INTERVAL) {
+      // Send data
       lastSendTime = lastSendTime + SEND_INTERVAL;
-      sendChunk();
+      if (connectivity.isHttpReady()) {
+        sendChunk();
+      }
     }
   }
 
   // Output status
+  supervisor.enter(LOOP_STATUS);
   if (millis() - lastStatusTime >= STATUS_PRINT_INTERVAL) {
     lastStatusTime = lastStatusTime + STATUS_PRINT_INTERVAL;
     sendStatus();
   }
-}
\ No newline at end of file
+  supervisor.endIteration();
+
+  // Sleep until the next sample while the radio is off
+  if (POWER_MODE == POWER_MODE_LIGHT_SLEEP) {
+    power.lightSleepUntil(sampleScheduler.getNextDue());
+  } else if (POWER_MODE == POWER_MODE_DEEP_SLEEP && !power.isRadioOn()) {
+    power.moveToRtc(ringBuffer);
+    power.deepSleep(MEASURE_INTERVAL);
+  }
+}
@@ -6,9 +6,25 @@
 #define WIFI_SSID "myWifiSSID"
 #define WIFI_PASSWORD "myWifiPassword"
 #define WIFI_RECONNECT_INTERVAL 30000
+// After a loss the cached access point and address are tried first, for WIFI_FAST_TIMEOUT ms, then a full connect
+// with scan and DHCP. Further attempts back off from WIFI_RECONNECT_MIN_INTERVAL up to WIFI_RECONNECT_INTERVAL. The
+// cached address is reused while its lease is younger than WIFI_LEASE_MAX_AGE ms.
+// #define WIFI_FAST_TIMEOUT 3000
+// #define WIFI_RECONNECT_MIN_INTERVAL 2000
+// #define WIFI_LEASE_MAX_AGE (12 * 3600 * 1000LL)
 
 #define USE_HTTP_SENDER false
 #define HTTP_SERVER_URL "http://192.168.178.2:7777/api/v1/data"
+// Optional: post the status record (JSON) to the server, stored as metrics.
+// #define HTTP_STATUS_URL "http://192.168.178.2:7777/api/v1/status"
+// Optional: upload the whole backlog in one request with chunked transfer encoding instead of CHUNK_SIZE records
+// per request. STREAM_WINDOW_SIZE records are serialized at a time, at most STREAM_MAX_RECORDS per request.
+// #define STREAM_UPLOAD
+// #define STREAM_WINDOW_SIZE 32
+// #define STREAM_MAX_RECORDS 10000
+// Optional: columnar batches ({"version":2,..,"start":..,"interval":..,"values":[..]}), about a third of the size
+// of the default layout with an object per measurement (1). The server accepts both on the same endpoint.
+// #define JSON_BATCH_VERSION 2
 
 #define USE_MQTT_SENDER true
 #define MQTT_SERVER_URL "mqtt://192.168.178.2:1883"
@@ -20,28 +36,104 @@
 // #define BASIC_AUTH_USERNAME "MyUserName"
 // #define BASIC_AUTH_PASSWORD "myPassword"
 
+// Optional: serve the buffered history via GET /api/v1/history?from=<ms>&to=<ms>&format=json|bin
+// #define PULL_SERVER_PORT 80
+
 // Measure every second
 #define MEASURE_INTERVAL 1000
 
 // Up to 3600 measurements (approx. 1 hour at 1 measurement per second)
+// A power of two (e.g. 4096) saves the division on every index step.
+// 0: size automatically from the memory available at boot. On boards with PSRAM (e.g. env:esp32wrover)
+// the store is placed in PSRAM, which holds several hundred thousand measurements.
 #define BUFFER_SIZE 3600
+// Optional memory region of a static buffer (BUFFER_SIZE > 0), e.g. EXT_RAM_ATTR for PSRAM
+// (requires CONFIG_SPIRAM_ALLOW_BSS_SEG_EXTERNAL_MEMORY)
+// #define RING_BUFFER_STORAGE_ATTR EXT_RAM_ATTR
+// Optional: keep the unsent samples of a static buffer across a panic, a watchdog or a software reset. The buffer is
+// placed in internal RAM that is not cleared on a warm reset (__NOINIT_ATTR) and adopted at boot if its checksum
+// matches and it was written by the same firmware image (see RingBuffer::persist()); the restart after an OTA update
+// starts empty, it waits for the backlog to be uploaded (OTA_DRAIN_TIMEOUT).
+// #define RING_BUFFER_PERSISTENT
 
-// Temporary buffer for transmission
+// Temporary buffer for transmission. The JSON document is sized at compile time from it
+// (see JsonHelper::capacityFor).
 #define CHUNK_SIZE 64
-#define JSON_BUFFER_SIZE 8192
-// 0: 56 B 1.1 KB peak
-// 1: 104 B 1.1 KB peak
-// 2: 152 B 1.1 KB peak
-// 4: 248 B 1.2 KB peak
-// 8: 440 B 1.4 KB peak
-// 16: 824 B 1.7 KB peak
-// * 64: 3.1 KB / 6.6 KB peak
-// 128: 6.1 KB / 12.1 KB peak
 
 // Send interval: a transmission attempt is made every 5 seconds
 #define SEND_INTERVAL 5000
 
-// Interval for displaying free memory (here 60000 ms, configurable)
-#define MEMORY_PRINT_INTERVAL 60000
+// Optional power mode (default POWER_MODE_ALWAYS_ON)
+// POWER_MODE_ALWAYS_ON: WiFi stays associated, data is sent every SEND_INTERVAL
+// POWER_MODE_LIGHT_SLEEP: the CPU light-sleeps between samples, WiFi is only on for burst uploads
+// POWER_MODE_DEEP_SLEEP: deep sleep between samples, up to RTC_BUFFER_SIZE samples kept in RTC memory
+// #define POWER_MODE POWER_MODE_LIGHT_SLEEP
+// Duty-cycled modes: burst upload every UPLOAD_INTERVAL ms or once UPLOAD_FILL_THRESHOLD samples are buffered,
+// WiFi is switched off again after UPLOAD_TIMEOUT ms at the latest
+// #define UPLOAD_INTERVAL 900000
+// #define UPLOAD_FILL_THRESHOLD 200
+// #define UPLOAD_TIMEOUT 30000
+
+// Interval for the status record (heap, tasks, WiFi, buffer), here 60000 ms
+#define STATUS_PRINT_INTERVAL 60000
+
+// INA219 calibration: shunt resistor in mΩ and the largest current to measure in mA (at most 40 mV over the shunt).
+// Samples are kept as integer µA from the current register to the serializers.
+// #define INA219_SHUNT_MILLIOHM 100
+// #define INA219_MAX_CURRENT_MA 400
+
+// Load tests: replace the INA219 by a synthetic solar profile or a recorded CSV trace ("time_ms,value_ma" lines).
+// The speed multiplies the simulated time, e.g. 100 with MEASURE_INTERVAL 10 drives the pipeline at 100x real rate.
+// #define SYNTHETIC_SENSOR_SPEED 1.0f
+// #define SYNTHETIC_SENSOR_SEED 1
+// #define REPLAY_TRACE "0,120.5\n1000,121.0\n2000,118.2\n"
+// #define REPLAY_TRACE_MAX_SAMPLES 256
+// #define REPLAY_TRACE_SPEED 1.0f
+
+// Optional: event detection between the sensor and the buffer. Around steps, bursts (tracker hunting) and level
+// crossings EVENT_PRE_SAMPLES before and EVENT_POST_SAMPLES after are kept at full rate, otherwise one mean per
+// EVENT_SUMMARY_SAMPLES. Events are published right away on the MQTT topic <HOST_NAME>/event. Thresholds in µA.
+// #define EVENT_DETECTION
+// #define EVENT_PRE_SAMPLES 30
+// #define EVENT_POST_SAMPLES 60
+// #define EVENT_SUMMARY_SAMPLES 60
+// #define EVENT_STEP_UA 50000
+// #define EVENT_BURST_PERMILLE 80
+// #define EVENT_LEVEL_UA 20000
+// #define EVENT_HYSTERESIS_UA 5000
+
+// Optional: ripple analysis. Every RIPPLE_INTERVAL ms the INA219 is burst for RIPPLE_SAMPLES samples (a power of two)
+// every RIPPLE_SAMPLE_US µs and the spectrum is searched for the RIPPLE_PEAKS strongest frequencies. The record is
+// published on the MQTT topic <HOST_NAME>/ripple. The burst blocks the loop, 64 ms with the defaults.
+// #define RIPPLE_ANALYSIS
+// #define RIPPLE_INTERVAL 60000
+// #define RIPPLE_SAMPLES 512
+// #define RIPPLE_SAMPLE_US 125
+// #define RIPPLE_PEAKS 3
+
+// Main loop supervision: iterations over LOOP_STALL_BUDGET ms are logged as stalls and blamed on the slowest
+// subsystem. With LOOP_WATCHDOG_TIMEOUT (ms) the task watchdog resets a stalled loop; the backtrace and subsystem
+// are kept in RTC memory and reported after the reset.
+// #define LOOP_STALL_BUDGET 100
+// #define LOOP_WATCHDOG_TIMEOUT 10000
+
+// OTA updates are received by a task of their own on OTA_TASK_CORE, so sampling continues during an update. The task
+// pauses OTA_YIELD_MS after every OTA_YIELD_BYTES written to let the loop run between the flash writes.
+// #define OTA_TASK_CORE 0
+// #define OTA_YIELD_BYTES 4096
+// #define OTA_YIELD_MS 2
+// The restart into an update waits up to OTA_DRAIN_TIMEOUT (ms) for the backlog to be uploaded.
+// #define OTA_DRAIN_TIMEOUT 60000
+
+// Optional: accept firmware patches and compressed images (tools/ota_patch.cpp) via POST /api/v1/ota on this port.
+// They are applied into the inactive OTA partition as they stream in and verified by SHA-256 before the restart.
+// #define OTA_PATCH_PORT 8080
+
+// Log level: LOG_LEVEL_NONE, _ERROR, _WARN, _INFO (default) or _DEBUG. Lower levels are compiled out.
+// Log calls are queued in a ring of LOG_RING_SIZE events and written to Serial by a low priority task.
+// #define LOG_LEVEL LOG_LEVEL_DEBUG
+// #define LOG_RING_SIZE 64
+// Log lines up to this level are also published on the MQTT topic <HOST_NAME>/log (default: warnings and errors)
+// #define MQTT_LOG_LEVEL LOG_LEVEL_NONE
 
 #endif  // CONFIG_H
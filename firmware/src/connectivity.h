@@ -0,0 +1,230 @@
+#ifndef CONNECTIVITY_H
+#define CONNECTIVITY_H
+
+#include <Arduino.h>
+
+#include "log_ring.h"
+
+// Time in ms a fast reconnect (cached access point and address) may take before a full connect is started.
+#ifndef WIFI_FAST_TIMEOUT
+#define WIFI_FAST_TIMEOUT 3000
+#endif
+
+// Delay in ms before the second full connect attempt. It doubles with each further attempt up to the reconnect
+// interval.
+#ifndef WIFI_RECONNECT_MIN_INTERVAL
+#define WIFI_RECONNECT_MIN_INTERVAL 2000
+#endif
+
+// Access to the network stack used by Connectivity. The firmware implements it on top of WiFi, SNTP and MQTT;
+// host builds can substitute fakes to replay outages.
+class ConnectivityBackend {
+ public:
+  virtual ~ConnectivityBackend() {}
+
+  // Starts connecting to the access point. Must not block.
+  virtual void beginWifi() = 0;
+
+  // Drops the current association and starts connecting again with a full scan. Must not block.
+  virtual void reconnectWifi() = 0;
+
+  // Starts connecting to the access point of the last connection without a scan, with its address if still valid.
+  // Returns false if nothing is cached. Must not block.
+  virtual bool reconnectWifiFast() { return false; }
+
+  // Returns true once after a connection attempt failed, e.g. on a disconnect event while connecting.
+  virtual bool takeWifiFailure() { return false; }
+
+  // Called when a connection is up, to cache its access point and address for the next fast reconnect.
+  virtual void onWifiUp(bool fast) {}
+
+  // Returns true if the station is connected and has an IP address.
+  virtual bool isWifiConnected() = 0;
+
+  // Starts the network services (OTA, NTP, MQTT, ...) once WiFi is up for the first time. Must not block.
+  virtual void startServices() = 0;
+
+  // Returns true once the time has been synchronized.
+  virtual bool isTimeValid() = 0;
+
+  // Returns true if the MQTT client is connected.
+  virtual bool isMqttConnected() = 0;
+};
+
+// Connectivity brings up WiFi, NTP, MQTT and HTTP readiness as an event-driven state machine beside sampling.
+// Nothing blocks: loop() only evaluates the current state, so samples are taken from the first millisecond, also
+// when the logger boots during a WiFi outage. The time of each first transition after boot is kept for the status.
+//
+// A lost connection is retried right away: first fast with the cached access point and address, if that fails or
+// takes longer than WIFI_FAST_TIMEOUT with a full scan, then with a backoff from WIFI_RECONNECT_MIN_INTERVAL up to
+// the reconnect interval. The time from the loss to the new connection is kept as the reconnect latency.
+class Connectivity {
+ public:
+  enum WifiState { WIFI_IDLE, WIFI_CONNECTING, WIFI_CONNECTED };
+
+  Connectivity(ConnectivityBackend &backend, unsigned long reconnectInterval)
+      : backend(backend),
+        reconnectInterval(reconnectInterval),
+        autoReconnect(true),
+        wifiState(WIFI_IDLE),
+        servicesStarted(false),
+        timeValid(false),
+        mqttConnected(false),
+        nextAttempt(0),
+        attempts(0),
+        fastAttempt(false),
+        lostAt(0),
+        reconnects(0),
+        fastReconnects(0),
+        lastReconnectMs(0),
+        maxReconnectMs(0),
+        wifiUpAt(0),
+        timeValidAt(0),
+        mqttUpAt(0) {}
+
+  // Enables or disables reconnect attempts, e.g. if the radio is switched by the power manager.
+  void setAutoReconnect(bool enabled) { autoReconnect = enabled; }
+
+  // Starts connecting (if auto reconnect is enabled). Returns immediately.
+  void begin(unsigned long now) {
+    lostAt = now;
+    attempts = 0;
+    if (autoReconnect) {
+      attemptConnect(now, true);
+    }
+  }
+
+  // Advances the state machine. Must be called from the main loop.
+  void loop(unsigned long now) {
+    if (backend.isWifiConnected()) {
+      if (wifiState != WIFI_CONNECTED) {
+        wifiState = WIFI_CONNECTED;
+        if (wifiUpAt == 0) {
+          wifiUpAt = now;
+          LOG_INFO("Connectivity: WiFi up after %lu ms%s", now, fastAttempt ? " (fast)" : "");
+        } else {
+          lastReconnectMs = now - lostAt;
+          if (lastReconnectMs > maxReconnectMs) {
+            maxReconnectMs = lastReconnectMs;
+          }
+          if (fastAttempt) {
+            fastReconnects++;
+          }
+          LOG_INFO("Connectivity: WiFi back after %lu ms%s", lastReconnectMs, fastAttempt ? " (fast)" : "");
+        }
+        backend.onWifiUp(fastAttempt);
+        if (!servicesStarted) {
+          servicesStarted = true;
+          backend.startServices();
+        }
+      }
+    } else {
+      if (wifiState == WIFI_CONNECTED) {
+        // Connection lost: reconnect right away
+        LOG_WARN("Connectivity: WiFi lost");
+        wifiState = WIFI_CONNECTING;
+        lostAt = now;
+        attempts = 0;
+        nextAttempt = now;
+      }
+      // A failed fast attempt is followed by a full one at once, failed full attempts wait for the backoff
+      if (backend.takeWifiFailure() && fastAttempt) {
+        nextAttempt = now;
+      }
+      if (autoReconnect && (long)(now - nextAttempt) >= 0) {
+        attemptConnect(now, false);
+      }
+    }
+
+    bool time = backend.isTimeValid();
+    if (time && !timeValid && timeValidAt == 0) {
+      timeValidAt = now;
+      LOG_INFO("Connectivity: time valid after %lu ms", now);
+    }
+    timeValid = time;
+
+    bool mqtt = servicesStarted && backend.isMqttConnected();
+    if (mqtt && !mqttConnected && mqttUpAt == 0) {
+      mqttUpAt = now;
+      LOG_INFO("Connectivity: MQTT up after %lu ms", now);
+    }
+    mqttConnected = mqtt;
+  }
+
+  WifiState getWifiState() const { return wifiState; }
+  bool isWifiConnected() const { return wifiState == WIFI_CONNECTED; }
+  bool isTimeValid() const { return timeValid; }
+  bool isMqttConnected() const { return mqttConnected; }
+
+  // Uploads can be sent once WiFi is up and the time is synchronized: samples taken before the first sync carry the
+  // time since boot until they are restamped, the server would drop them.
+  bool isHttpReady() const { return wifiState == WIFI_CONNECTED && timeValid; }
+
+  // Returns the number of reconnect attempts.
+  uint32_t getReconnects() const { return reconnects; }
+
+  // Returns the number of reconnects that succeeded on the fast path.
+  uint32_t getFastReconnects() const { return fastReconnects; }
+
+  // Returns the time from the loss of the connection to the new connection, last and longest.
+  unsigned long getLastReconnectMs() const { return lastReconnectMs; }
+  unsigned long getMaxReconnectMs() const { return maxReconnectMs; }
+
+  // Returns the time after boot of the first WiFi connection, time sync and MQTT connection (0: not yet).
+  unsigned long getWifiUpAt() const { return wifiUpAt; }
+  unsigned long getTimeValidAt() const { return timeValidAt; }
+  unsigned long getMqttUpAt() const { return mqttUpAt; }
+
+ private:
+  ConnectivityBackend &backend;
+  unsigned long reconnectInterval;
+  bool autoReconnect;
+
+  WifiState wifiState;
+  bool servicesStarted;
+  bool timeValid;
+  bool mqttConnected;
+  unsigned long nextAttempt;
+  uint32_t attempts;  // Since the connection was lost
+  bool fastAttempt;   // The current attempt is on the fast path
+  unsigned long lostAt;
+  uint32_t reconnects;
+  uint32_t fastReconnects;
+  unsigned long lastReconnectMs;
+  unsigned long maxReconnectMs;
+
+  unsigned long wifiUpAt;
+  unsigned long timeValidAt;
+  unsigned long mqttUpAt;
+
+  // Starts the next attempt: the first one on the fast path if possible, the first full one right after it.
+  void attemptConnect(unsigned long now, bool initial) {
+    wifiState = WIFI_CONNECTING;
+    if (!initial) {
+      reconnects++;
+    }
+    if (attempts == 0 && backend.reconnectWifiFast()) {
+      LOG_WARN("WiFi not connected. Attempting fast reconnect...");
+      fastAttempt = true;
+      nextAttempt = now + WIFI_FAST_TIMEOUT;
+      attempts++;
+      return;
+    }
+    if (attempts == 0) {
+      attempts++;  // Nothing cached
+    }
+    fastAttempt = false;
+    if (initial) {
+      backend.beginWifi();
+    } else {
+      LOG_WARN("WiFi disconnected. Attempting reconnect...");
+      backend.reconnectWifi();
+    }
+    // 1: first full attempt, then doubling
+    unsigned long backoff = (unsigned long)WIFI_RECONNECT_MIN_INTERVAL << (attempts < 8 ? attempts - 1 : 7);
+    nextAttempt = now + (backoff < reconnectInterval ? backoff : reconnectInterval);
+    attempts++;
+  }
+};
+
+#endif  // CONNECTIVITY_H
@@ -0,0 +1,392 @@
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sha256.h"
+
+// Firmware patches: a target image described by copies out of the running image (source) and out of the target written
+// so far, plus literal bytes. A patch with an empty source is a compressed full image. Produced by tools/ota_patch.cpp.
+//
+// Layout, little endian:
+//   header   magic "SCLP", version, 3 reserved bytes, source size, target size, SHA-256 of source and target
+//   ops      LITERAL len bytes[len]
+//            ADD     len srcDelta {zeroRun count bytes[count]}...   target = source + bytes, zeroRun bytes unchanged
+//            COPY    len distance                                   from distance bytes back in the target
+//            END
+// Lengths and counts are unsigned LEB128 varints. srcDelta moves the source position, which continues after the
+// previous ADD, and is zigzag encoded. The zeroRun/count pairs of an ADD add up to its len. An ADD absorbs the moved
+// addresses of code that was shifted: the diff is zero except for the changed bytes, which are all that is sent.
+
+#define PATCH_MAGIC "SCLP"
+#define PATCH_VERSION 1
+#define PATCH_HEADER_SIZE 80
+
+// Target bytes are buffered and written in blocks of one flash sector.
+#define PATCH_BLOCK_SIZE 4096
+
+// Bytes read ahead from the source and from the written target.
+#define PATCH_READ_CACHE_SIZE 256
+
+enum PatchOp : uint8_t { PATCH_OP_END = 0, PATCH_OP_LITERAL = 1, PATCH_OP_ADD = 2, PATCH_OP_COPY = 3 };
+
+struct PatchHeader {
+  uint32_t sourceSize;  // 0: compressed full image
+  uint32_t targetSize;
+  uint8_t sourceHash[SHA256_SIZE];
+  uint8_t targetHash[SHA256_SIZE];
+};
+
+enum PatchError {
+  PATCH_OK,
+  PATCH_BAD_HEADER,
+  PATCH_SOURCE_MISMATCH,  // The patch was made for another image than the running one
+  PATCH_CORRUPT,
+  PATCH_FLASH_ERROR,
+  PATCH_INCOMPLETE,
+  PATCH_TARGET_MISMATCH
+};
+
+inline const char *patchErrorName(PatchError error) {
+  static const char *const kNames[] = {"ok",          "bad header",  "source mismatch", "corrupt",
+                                       "flash error", "incomplete",  "target mismatch"};
+  return kNames[error];
+}
+
+inline uint32_t zigzagEncode(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+
+inline int32_t zigzagDecode(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+// DeltaPatcher applies a patch while it streams in, in chunks of any size. Memory use is fixed: one block of output and
+// two small read caches, independent of the image size.
+//
+// Flash provides the images:
+//   bool begin(const PatchHeader &header)                           prepare the target, after the source was verified
+//   bool readSource(uint32_t offset, uint8_t *data, size_t len)
+//   bool readTarget(uint32_t offset, uint8_t *data, size_t len)     only blocks already written
+//   bool writeTarget(const uint8_t *data, size_t len)               sequential, PATCH_BLOCK_SIZE except the last
+//   bool end()                                                      after the target hash was verified
+//   void abort()
+template <typename Flash>
+class DeltaPatcher {
+ public:
+  explicit DeltaPatcher(Flash &flash) : flash(flash) { reset(); }
+
+  // Prepares for a new patch. A started update is aborted.
+  void reset() {
+    if (state != S_HEADER && state != S_FINISHED && error == PATCH_OK) {
+      flash.abort();
+    }
+    state = S_HEADER;
+    error = PATCH_OK;
+    headerUsed = 0;
+    received = 0;
+    written = 0;
+    flushed = 0;
+    sourcePos = 0;
+    sourceCacheBase = targetCacheBase = 0;
+    sourceCacheSize = targetCacheSize = 0;
+    hash.reset();
+  }
+
+  // Applies the next bytes of the patch. Once an error occurred, it is returned for all further calls.
+  PatchError feed(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len && error == PATCH_OK; i++) {
+      consume(data[i]);
+    }
+    received += len;
+    return error;
+  }
+
+  // Verifies and commits the target after the last byte of the patch.
+  PatchError finish() {
+    if (error != PATCH_OK) {
+      return error;
+    }
+    if (state != S_DONE) {
+      return fail(PATCH_INCOMPLETE);
+    }
+    if (!flush()) {
+      return error;
+    }
+    uint8_t digest[SHA256_SIZE];
+    hash.finish(digest);
+    if (memcmp(digest, header.targetHash, SHA256_SIZE) != 0) {
+      return fail(PATCH_TARGET_MISMATCH);
+    }
+    state = S_FINISHED;
+    if (!flash.end()) {
+      error = PATCH_FLASH_ERROR;
+    }
+    return error;
+  }
+
+  // Returns the header once it was received.
+  const PatchHeader *getHeader() const { return state != S_HEADER ? &header : nullptr; }
+
+  // Returns the bytes of the patch received and of the target produced.
+  uint32_t getReceived() const { return received; }
+  uint32_t getWritten() const { return written; }
+
+ private:
+  enum State : uint8_t {
+    S_HEADER,
+    S_OP,
+    S_LEN,
+    S_SRC_DELTA,
+    S_DISTANCE,
+    S_LITERAL,
+    S_ADD_ZERO,
+    S_ADD_COUNT,
+    S_ADD_DATA,
+    S_DONE,
+    S_FINISHED
+  };
+
+  Flash &flash;
+  State state = S_HEADER;
+  PatchError error = PATCH_OK;
+  PatchHeader header;
+  uint8_t headerBytes[PATCH_HEADER_SIZE];
+  size_t headerUsed;
+  uint32_t received;
+
+  uint8_t op;
+  uint32_t varint;
+  int shift;
+  uint32_t remaining;  // Bytes of the current op
+  uint32_t count;      // Bytes of the current ADD segment
+  uint32_t sourcePos;
+
+  uint32_t written;  // Target bytes produced
+  uint32_t flushed;  // Target bytes written to flash
+  uint8_t block[PATCH_BLOCK_SIZE];
+  uint8_t sourceCache[PATCH_READ_CACHE_SIZE];
+  uint32_t sourceCacheBase;
+  uint32_t sourceCacheSize;
+  uint8_t targetCache[PATCH_READ_CACHE_SIZE];
+  uint32_t targetCacheBase;
+  uint32_t targetCacheSize;
+  Sha256 hash;
+
+  PatchError fail(PatchError e) {
+    if (state != S_HEADER) {
+      flash.abort();
+    }
+    error = e;
+    return e;
+  }
+
+  void consume(uint8_t b) {
+    switch (state) {
+      case S_HEADER:
+        headerBytes[headerUsed++] = b;
+        if (headerUsed == PATCH_HEADER_SIZE) {
+          beginPatch();
+        }
+        return;
+      case S_LITERAL:
+        emit(b);
+        if (--remaining == 0) {
+          state = S_OP;
+        }
+        return;
+      case S_ADD_DATA:
+        emit(sourceByte(sourcePos++) + b);
+        remaining--;
+        if (--count == 0) {
+          state = remaining == 0 ? S_OP : S_ADD_ZERO;
+        }
+        return;
+      case S_OP:
+        op = b;
+        varint = 0;
+        shift = 0;
+        if (op == PATCH_OP_END) {
+          state = S_DONE;
+        } else if (op == PATCH_OP_LITERAL || op == PATCH_OP_ADD || op == PATCH_OP_COPY) {
+          state = S_LEN;
+        } else {
+          fail(PATCH_CORRUPT);
+        }
+        return;
+      case S_DONE:
+      case S_FINISHED:
+        fail(PATCH_CORRUPT);  // Data after the end
+        return;
+      default:
+        break;
+    }
+
+    // Varint fields
+    if (shift > 28) {
+      fail(PATCH_CORRUPT);
+      return;
+    }
+    varint |= (uint32_t)(b & 0x7f) << shift;
+    if (b & 0x80) {
+      shift += 7;
+      return;
+    }
+    uint32_t value = varint;
+    varint = 0;
+    shift = 0;
+    field(value);
+  }
+
+  // A varint field is complete.
+  void field(uint32_t value) {
+    switch (state) {
+      case S_LEN:
+        if (value > header.targetSize - written) {
+          fail(PATCH_CORRUPT);
+          return;
+        }
+        remaining = value;
+        if (op == PATCH_OP_LITERAL) {
+          state = remaining > 0 ? S_LITERAL : S_OP;
+        } else if (op == PATCH_OP_ADD) {
+          state = S_SRC_DELTA;
+        } else {
+          state = S_DISTANCE;
+        }
+        return;
+      case S_SRC_DELTA: {
+        int64_t pos = (int64_t)sourcePos + zigzagDecode(value);
+        if (pos < 0 || pos + remaining > header.sourceSize) {
+          fail(PATCH_CORRUPT);
+          return;
+        }
+        sourcePos = (uint32_t)pos;
+        state = S_ADD_ZERO;
+        return;
+      }
+      case S_ADD_ZERO:
+        if (value > remaining) {
+          fail(PATCH_CORRUPT);
+          return;
+        }
+        for (uint32_t i = 0; i < value && error == PATCH_OK; i++) {
+          emit(sourceByte(sourcePos++));
+        }
+        remaining -= value;
+        state = S_ADD_COUNT;
+        return;
+      case S_ADD_COUNT:
+        if (value > remaining) {
+          fail(PATCH_CORRUPT);
+          return;
+        }
+        count = value;
+        if (count > 0) {
+          state = S_ADD_DATA;
+        } else {
+          state = remaining == 0 ? S_OP : S_ADD_ZERO;
+        }
+        return;
+      case S_DISTANCE:
+        if (value == 0 || value > written) {
+          fail(PATCH_CORRUPT);
+          return;
+        }
+        // Byte by byte: the copy may overlap the bytes it produces
+        for (uint32_t i = 0; i < remaining && error == PATCH_OK; i++) {
+          emit(targetByte(written - value));
+        }
+        state = S_OP;
+        return;
+      default:
+        fail(PATCH_CORRUPT);
+        return;
+    }
+  }
+
+  void beginPatch() {
+    if (memcmp(headerBytes, PATCH_MAGIC, 4) != 0 || headerBytes[4] != PATCH_VERSION) {
+      fail(PATCH_BAD_HEADER);
+      return;
+    }
+    header.sourceSize = readLe32(headerBytes + 8);
+    header.targetSize = readLe32(headerBytes + 12);
+    memcpy(header.sourceHash, headerBytes + 16, SHA256_SIZE);
+    memcpy(header.targetHash, headerBytes + 16 + SHA256_SIZE, SHA256_SIZE);
+
+    // The source must be the image the patch was made for. The block is still free to read it.
+    Sha256 sourceHash;
+    for (uint32_t offset = 0; offset < header.sourceSize; offset += PATCH_BLOCK_SIZE) {
+      size_t n = header.sourceSize - offset < PATCH_BLOCK_SIZE ? header.sourceSize - offset : PATCH_BLOCK_SIZE;
+      if (!flash.readSource(offset, block, n)) {
+        fail(PATCH_FLASH_ERROR);
+        return;
+      }
+      sourceHash.update(block, n);
+    }
+    uint8_t digest[SHA256_SIZE];
+    sourceHash.finish(digest);
+    if (memcmp(digest, header.sourceHash, SHA256_SIZE) != 0) {
+      fail(PATCH_SOURCE_MISMATCH);
+      return;
+    }
+    if (!flash.begin(header)) {
+      fail(PATCH_FLASH_ERROR);
+      return;
+    }
+    state = S_OP;
+  }
+
+  static uint32_t readLe32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+  }
+
+  void emit(uint8_t b) {
+    block[written - flushed] = b;
+    written++;
+    if (written - flushed == PATCH_BLOCK_SIZE) {
+      flush();
+    }
+  }
+
+  bool flush() {
+    size_t n = written - flushed;
+    if (n == 0) {
+      return true;
+    }
+    hash.update(block, n);
+    if (!flash.writeTarget(block, n)) {
+      fail(PATCH_FLASH_ERROR);
+      return false;
+    }
+    flushed = written;
+    return true;
+  }
+
+  uint8_t sourceByte(uint32_t offset) {
+    if (offset - sourceCacheBase >= sourceCacheSize) {
+      sourceCacheBase = offset;
+      sourceCacheSize = header.sourceSize - offset < PATCH_READ_CACHE_SIZE ? header.sourceSize - offset
+                                                                            : PATCH_READ_CACHE_SIZE;
+      if (!flash.readSource(offset, sourceCache, sourceCacheSize)) {
+        fail(PATCH_FLASH_ERROR);
+      }
+    }
+    return sourceCache[offset - sourceCacheBase];
+  }
+
+  uint8_t targetByte(uint32_t offset) {
+    if (offset >= flushed) {
+      return block[offset - flushed];
+    }
+    if (offset - targetCacheBase >= targetCacheSize) {
+      targetCacheBase = offset;
+      targetCacheSize = flushed - offset < PATCH_READ_CACHE_SIZE ? flushed - offset : PATCH_READ_CACHE_SIZE;
+      if (!flash.readTarget(offset, targetCache, targetCacheSize)) {
+        fail(PATCH_FLASH_ERROR);
+      }
+    }
+    return targetCache[offset - targetCacheBase];
+  }
+};
+
+#endif  // DELTA_PATCH_H
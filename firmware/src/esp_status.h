@@ -2,46 +2,441 @@
 #define ESP_STATUS_H
 
 #include <Arduino.h>
+#include <WiFi.h>
 #include <esp_heap_caps.h>
+#include <stdarg.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "loop_supervisor.h"
 
+// Upper bound of tasks reported per status record. Additional tasks are left out of the record but counted in
+// taskTotal.
+#ifndef STATUS_MAX_TASKS
+#define STATUS_MAX_TASKS 24
+#endif
+
+// Upper bounds of the parts of the JSON representation, measured with all counters at their maximum: the fields
+// (the device name cut to 32 characters), a subsystem with stalls, the watchdog evidence without and per backtrace
+// frame, a task with a name of configMAX_TASK_NAME_LEN - 1 characters.
+#define STATUS_JSON_FIXED_SIZE 1400
+#define STATUS_JSON_SUBSYSTEM_SIZE 125
+#define STATUS_JSON_WATCHDOG_SIZE 80
+#define STATUS_JSON_FRAME_SIZE 11
+#define STATUS_JSON_TASK_SIZE 66
+
+// Longest JSON representation of a record: all subsystems stalled, a full backtrace and STATUS_MAX_TASKS tasks.
+#define STATUS_JSON_MAX_SIZE                                                                                  \
+  (STATUS_JSON_FIXED_SIZE + LOOP_SUBSYSTEM_COUNT * STATUS_JSON_SUBSYSTEM_SIZE + STATUS_JSON_WATCHDOG_SIZE + \
+   LOOP_BACKTRACE_DEPTH * STATUS_JSON_FRAME_SIZE + STATUS_MAX_TASKS * STATUS_JSON_TASK_SIZE)
+
+// Size of the static buffer the JSON representation is written into.
+#ifndef STATUS_JSON_BUFFER_SIZE
+#define STATUS_JSON_BUFFER_SIZE STATUS_JSON_MAX_SIZE
+#endif
+
+// A cut-off record would be invalid JSON, which the MQTT consumers and the server reject.
+static_assert(STATUS_JSON_BUFFER_SIZE >= STATUS_JSON_MAX_SIZE, "STATUS_JSON_BUFFER_SIZE below the longest record");
+static_assert(configMAX_TASK_NAME_LEN <= 16, "STATUS_JSON_TASK_SIZE assumes task names of up to 15 characters");
+
+// Per task statistics.
+struct TaskStat {
+  char name[configMAX_TASK_NAME_LEN];
+  uint32_t stackHighWaterMark;  // Bytes
+  uint8_t cpuPercent;           // Share of one core since the previous update, 0 if run time stats are disabled
+  int8_t core;                  // Pinned core or -1 if the task may run on any core
+};
+
+// Fixed layout status record.
+struct StatusRecord {
+  uint32_t uptime;            // s
+  uint32_t freeHeap;          // Bytes
+  uint32_t minFreeHeap;       // Bytes
+  uint32_t largestFreeBlock;  // Bytes
+  uint8_t fragmentation;      // %, 100 - largestFreeBlock / freeHeap
+  uint32_t freePsram;         // Bytes, 0 without PSRAM
+  int8_t rssi;                // dBm
+  float cpuTemp;              // °C
+  uint32_t wifiReconnects;
+  uint32_t wifiFastReconnects;  // Reconnects with the cached access point and address
+  uint32_t wifiReconnectMs;     // Loss to new connection, last reconnect
+  uint32_t wifiMaxReconnectMs;
+  uint32_t bufferCount;
+  uint32_t bufferCapacity;
+  uint32_t bufferRecovered;  // Records kept across the last reset, see RingBuffer::persist()
+  uint32_t bufferRecoverUs;  // Check of the kept store at boot
+  uint32_t radioOnMsPerHour;  // Duty-cycled power modes only
+  uint32_t wakesPerHour;      // Duty-cycled power modes only
+  uint32_t httpRequests;
+  uint32_t httpConnections;   // Requests that needed a new connection / TLS handshake
+  uint32_t httpSetupMs;       // Send to response headers, last request
+  uint32_t httpMaxSetupMs;
+  uint32_t httpMaxHeapDrop;   // Bytes
+  uint32_t timeToFirstSampleMs;  // After boot, 0: not yet
+  uint32_t timeToWifiMs;
+  uint32_t timeToTimeValidMs;
+  uint32_t timeToMqttMs;
+  uint32_t logDropped;        // Log events dropped because the log ring was full
+  uint32_t samplesMissed;     // Sample slots skipped because the loop was held up
+  uint32_t sampleMaxGapMs;    // Longest time between two samples
+  uint32_t events;            // Detected events, see event_detector.h
+  uint32_t eventSamples;      // Samples fed to the event detector
+  uint32_t eventRecords;      // Records kept of them: full rate around events and summaries
+  uint32_t rippleRmsUa;       // Last ripple capture, see ripple_analyzer.h
+  uint32_t ripplePeakToPeakUa;
+  uint32_t rippleMilliHz;     // Strongest frequency, 0 if none
+  uint32_t rippleAmplitudeUa;
+  uint32_t rippleAnalyzeUs;   // FFT and peak search on the device
+  uint32_t otaUpdates;
+  uint32_t otaFailures;
+  uint32_t otaLastMs;         // Transfer time of the last update
+  uint32_t otaLastBytes;      // Bytes received for the last update, a patch is smaller than the image
+  uint32_t otaLastImageBytes;
+  uint32_t otaLastBytesPerSec;
+  uint32_t loopStalls;        // Main loop iterations over LOOP_STALL_BUDGET
+  uint32_t loopMaxStallMs;
+  uint8_t loopWorstSubsystem;  // Blamed for the longest stall
+  SubsystemStalls loopSubsystems[LOOP_SUBSYSTEM_COUNT];
+  LoopEvidence watchdog;      // Stall that caused the watchdog reset before this boot, magic 0 if none
+  uint8_t coreLoad[portNUM_PROCESSORS];  // %, 0 if run time stats are disabled
+  uint8_t taskCount;
+  uint8_t taskTotal;  // Tasks running, more than taskCount if the record is truncated
+  TaskStat tasks[STATUS_MAX_TASKS];
+};
+
+// Collects the ESP status into a fixed StatusRecord. The heap is only touched when the task snapshot has to grow,
+// in practice once at the first update.
 class EspStatus {
  public:
-  void getStatus(String &output) {
-    output = "";
-    output += "Free Heap: ";
-    output += String(esp_get_free_heap_size());
-    output += " Bytes\n";
+  // Sets the number of WiFi reconnect attempts.
+  void setWifiReconnects(uint32_t reconnects) { record.wifiReconnects = reconnects; }
+
+  // Sets the fast reconnects and the reconnect latency.
+  void setReconnectLatency(uint32_t fastReconnects, uint32_t lastMs, uint32_t maxMs) {
+    record.wifiFastReconnects = fastReconnects;
+    record.wifiReconnectMs = lastMs;
+    record.wifiMaxReconnectMs = maxMs;
+  }
+
+  // Sets the time after boot of the first sample, WiFi connection, time sync and MQTT connection.
+  void setBootStats(uint32_t firstSampleMs, uint32_t wifiUpMs, uint32_t timeValidMs, uint32_t mqttUpMs) {
+    record.timeToFirstSampleMs = firstSampleMs;
+    record.timeToWifiMs = wifiUpMs;
+    record.timeToTimeValidMs = timeValidMs;
+    record.timeToMqttMs = mqttUpMs;
+  }
+
+  // Sets the fill level of the measurement buffer.
+  void setBufferFill(uint32_t count, uint32_t capacity) {
+    record.bufferCount = count;
+    record.bufferCapacity = capacity;
+  }
+
+  // Sets the records of the buffer kept across the last reset and the time to check them.
+  void setBufferRecovery(uint32_t records, uint32_t us) {
+    record.bufferRecovered = records;
+    record.bufferRecoverUs = us;
+  }
+
+  // Sets the power statistics of the last complete hour.
+  void setPowerStats(uint32_t radioOnMs, uint32_t wakes) {
+    record.radioOnMsPerHour = radioOnMs;
+    record.wakesPerHour = wakes;
+  }
 
-    output += "Min. free Heap: ";
-    output += String(esp_get_minimum_free_heap_size());
-    output += " Bytes\n";
+  // Sets the counters of the HTTP sender.
+  void setHttpStats(uint32_t requests, uint32_t connections, uint32_t setupMs, uint32_t maxSetupMs,
+                    uint32_t maxHeapDrop) {
+    record.httpRequests = requests;
+    record.httpConnections = connections;
+    record.httpSetupMs = setupMs;
+    record.httpMaxSetupMs = maxSetupMs;
+    record.httpMaxHeapDrop = maxHeapDrop;
+  }
+
+  // Sets the number of dropped log events.
+  void setLogStats(uint32_t dropped) { record.logDropped = dropped; }
+
+  // Sets the sample continuity.
+  void setSampleStats(uint32_t missed, uint32_t maxGapMs) {
+    record.samplesMissed = missed;
+    record.sampleMaxGapMs = maxGapMs;
+  }
+
+  // Sets the counters of the event detector: events, samples fed and records kept of them.
+  void setEventStats(uint32_t events, uint32_t samples, uint32_t records) {
+    record.events = events;
+    record.eventSamples = samples;
+    record.eventRecords = records;
+  }
+
+  // Sets the result of the last ripple capture.
+  void setRippleStats(uint32_t rmsUa, uint32_t peakToPeakUa, uint32_t milliHz, uint32_t amplitudeUa,
+                      uint32_t analyzeUs) {
+    record.rippleRmsUa = rmsUa;
+    record.ripplePeakToPeakUa = peakToPeakUa;
+    record.rippleMilliHz = milliHz;
+    record.rippleAmplitudeUa = amplitudeUa;
+    record.rippleAnalyzeUs = analyzeUs;
+  }
+
+  // Sets the counters of the OTA updates.
+  void setOtaStats(uint32_t updates, uint32_t failures, uint32_t lastMs, uint32_t lastBytes, uint32_t lastImageBytes,
+                   uint32_t lastBytesPerSec) {
+    record.otaUpdates = updates;
+    record.otaFailures = failures;
+    record.otaLastMs = lastMs;
+    record.otaLastBytes = lastBytes;
+    record.otaLastImageBytes = lastImageBytes;
+    record.otaLastBytesPerSec = lastBytesPerSec;
+  }
+
+  // Sets the main loop stalls and the evidence of a previous watchdog reset.
+  void setLoopStats(const LoopSupervisor &supervisor) {
+    record.loopStalls = supervisor.getStalls();
+    record.loopMaxStallMs = supervisor.getMaxStallMs();
+    record.loopWorstSubsystem = supervisor.getWorstSubsystem();
+    memcpy(record.loopSubsystems, supervisor.getSubsystemStalls(), sizeof(record.loopSubsystems));
+    const LoopEvidence *evidence = supervisor.getLastReset();
+    record.watchdog = evidence != nullptr ? *evidence : LoopEvidence{};
+  }
+
+  // Refreshes the status record.
+  void update() {
+    record.uptime = millis() / 1000;
+
+    record.freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    record.minFreeHeap = esp_get_minimum_free_heap_size();
+    record.largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    record.fragmentation =
+        record.freeHeap > 0 ? 100 - (uint8_t)((uint64_t)record.largestFreeBlock * 100 / record.freeHeap) : 0;
 
 #ifdef CONFIG_SPIRAM_SUPPORT
-    output += "Free PSRAM: ";
-    output += String(esp_psram_get_free_size());
-    output += " Bytes\n";
+    record.freePsram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+#else
+    record.freePsram = 0;
 #endif
 
-    output += "Uptime: ";
-    output += String(millis() / 1000);
-    output += " s\n";
-    
-    UBaseType_t stackHighWaterMark = uxTaskGetStackHighWaterMark(NULL);
-    output += "Task Stack High Water Mark: ";
-    output += String(stackHighWaterMark * sizeof(StackType_t));
-    output += " Bytes\n";
-    
-    output += "Wifi RSSI: ";
-    output += String(WiFi.RSSI());
-    output += "\n";
-
-    output += "CPU temp: ";
-    output += String(temperatureRead());
-    output += " °C\n";
+    record.rssi = WiFi.RSSI();
+    record.cpuTemp = temperatureRead();
+
+    updateTasks();
+  }
+
+  // Returns the status record.
+  const StatusRecord &getRecord() const { return record; }
+
+  // Writes the status record as compact JSON into a static buffer and returns it. The device name is cut to 32
+  // characters. The buffer stays valid until the next call.
+  const char *toJson(const char *device) {
+    JsonWriter w(jsonBuffer, sizeof(jsonBuffer));
+    w.append("{\"device\":\"%.32s\",\"uptime\":%u,\"freeHeap\":%u,\"minFreeHeap\":%u,\"largestFreeBlock\":%u,"
+             "\"fragmentation\":%u,\"freePsram\":%u,\"rssi\":%d,\"cpuTemp\":%.1f,\"wifiReconnects\":%u,"
+             "\"bufferCount\":%u,\"bufferCapacity\":%u,\"radioOnMsPerHour\":%u,\"wakesPerHour\":%u,"
+             "\"httpRequests\":%u,\"httpConnections\":%u,\"httpSetupMs\":%u,\"httpMaxSetupMs\":%u,"
+             "\"httpMaxHeapDrop\":%u,\"timeToFirstSampleMs\":%u,\"timeToWifiMs\":%u,\"timeToTimeValidMs\":%u,"
+             "\"timeToMqttMs\":%u,\"logDropped\":%u",
+             device, record.uptime, record.freeHeap, record.minFreeHeap, record.largestFreeBlock,
+             record.fragmentation, record.freePsram, record.rssi, record.cpuTemp, record.wifiReconnects,
+             record.bufferCount, record.bufferCapacity, record.radioOnMsPerHour, record.wakesPerHour,
+             record.httpRequests, record.httpConnections, record.httpSetupMs, record.httpMaxSetupMs,
+             record.httpMaxHeapDrop, record.timeToFirstSampleMs, record.timeToWifiMs, record.timeToTimeValidMs,
+             record.timeToMqttMs, record.logDropped);
+    w.append(",\"bufferRecovered\":%u,\"bufferRecoverUs\":%u", record.bufferRecovered, record.bufferRecoverUs);
+    w.append(",\"wifiFastReconnects\":%u,\"wifiReconnectMs\":%u,\"wifiMaxReconnectMs\":%u",
+             record.wifiFastReconnects, record.wifiReconnectMs, record.wifiMaxReconnectMs);
+    w.append(",\"events\":%u,\"eventSamples\":%u,\"eventRecords\":%u", record.events, record.eventSamples,
+             record.eventRecords);
+    w.append(",\"rippleRmsUa\":%u,\"ripplePeakToPeakUa\":%u,\"rippleMilliHz\":%u,\"rippleAmplitudeUa\":%u,"
+             "\"rippleAnalyzeUs\":%u",
+             record.rippleRmsUa, record.ripplePeakToPeakUa, record.rippleMilliHz, record.rippleAmplitudeUa,
+             record.rippleAnalyzeUs);
+    w.append(",\"samplesMissed\":%u,\"sampleMaxGapMs\":%u,\"otaUpdates\":%u,\"otaFailures\":%u,\"otaLastMs\":%u,"
+             "\"otaLastBytes\":%u,\"otaLastImageBytes\":%u,\"otaLastBytesPerSec\":%u",
+             record.samplesMissed, record.sampleMaxGapMs, record.otaUpdates, record.otaFailures, record.otaLastMs,
+             record.otaLastBytes, record.otaLastImageBytes, record.otaLastBytesPerSec);
+    w.append(",\"loopStalls\":%u,\"loopMaxStallMs\":%u,\"loopStallBlame\":\"%s\",\"loopSubsystems\":[",
+             record.loopStalls, record.loopMaxStallMs,
+             record.loopStalls > 0 ? LoopSupervisor::subsystemName(record.loopWorstSubsystem) : "");
+    bool first = true;
+    for (int i = 0; i < LOOP_SUBSYSTEM_COUNT; i++) {
+      const SubsystemStalls &s = record.loopSubsystems[i];
+      if (s.count == 0) {
+        continue;
+      }
+      w.append("%s{\"name\":\"%s\",\"stalls\":%u,\"maxMs\":%u,\"histogram\":[", first ? "" : ",",
+               LoopSupervisor::subsystemName(i), s.count, s.maxMs);
+      for (int b = 0; b < LOOP_STALL_BUCKETS; b++) {
+        w.append(b == 0 ? "%u" : ",%u", s.histogram[b]);
+      }
+      w.append("]}");
+      first = false;
+    }
+    w.append("]");
+    if (record.watchdog.magic != 0) {
+      w.append(",\"watchdog\":{\"subsystem\":\"%s\",\"stalledMs\":%u,\"backtrace\":\"",
+               LoopSupervisor::subsystemName(record.watchdog.subsystem), record.watchdog.stalledMs);
+      for (int i = 0; i < record.watchdog.depth; i++) {
+        w.append(i == 0 ? "0x%08x" : " 0x%08x", record.watchdog.backtrace[i]);
+      }
+      w.append("\"}");
+    }
+    w.append(",\"coreLoad\":[");
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+      w.append(i == 0 ? "%u" : ",%u", record.coreLoad[i]);
+    }
+    w.append("],\"taskTotal\":%u,\"tasks\":[", record.taskTotal);
+    for (int i = 0; i < record.taskCount; i++) {
+      const TaskStat &t = record.tasks[i];
+      w.append("%s{\"name\":\"%s\",\"stack\":%u,\"cpu\":%u,\"core\":%d}", i == 0 ? "" : ",", t.name,
+               t.stackHighWaterMark, t.cpuPercent, t.core);
+    }
+    w.append("]}");
+    return jsonBuffer;
+  }
+
+ private:
+  StatusRecord record = {};
+  char jsonBuffer[STATUS_JSON_BUFFER_SIZE];
+
+#if configUSE_TRACE_FACILITY
+  // Run time counter of a task at the previous update, to calculate the CPU share per interval.
+  struct PrevRunTime {
+    UBaseType_t taskNumber;
+    uint32_t runTime;
+  };
+
+  // Snapshot of all tasks. uxTaskGetSystemState() fills nothing if more tasks exist than it holds, so it is sized
+  // from uxTaskGetNumberOfTasks().
+  TaskStatus_t *taskStatus = nullptr;
+  PrevRunTime *prevRunTime = nullptr;
+  UBaseType_t snapshotSize = 0;
+  UBaseType_t prevCount = 0;
+  uint32_t prevTotalRunTime = 0;
+
+  // Grows the snapshot to the given number of tasks plus some spare for tasks started later. Returns false if out
+  // of memory.
+  bool reserveSnapshot(UBaseType_t tasks) {
+    if (tasks <= snapshotSize) {
+      return true;
+    }
+    UBaseType_t size = tasks + 4;
+    TaskStatus_t *status = static_cast<TaskStatus_t *>(malloc(size * sizeof(TaskStatus_t)));
+    PrevRunTime *prev = static_cast<PrevRunTime *>(malloc(size * sizeof(PrevRunTime)));
+    if (status == nullptr || prev == nullptr) {
+      free(status);
+      free(prev);
+      return false;
+    }
+    if (prevRunTime != nullptr) {
+      memcpy(prev, prevRunTime, prevCount * sizeof(PrevRunTime));
+    }
+    free(taskStatus);
+    free(prevRunTime);
+    taskStatus = status;
+    prevRunTime = prev;
+    snapshotSize = size;
+    return true;
+  }
+#endif
+
+  // Appends formatted text to a fixed buffer and truncates on overflow, which STATUS_JSON_MAX_SIZE rules out.
+  class JsonWriter {
+   public:
+    JsonWriter(char *buffer, size_t size) : buffer(buffer), size(size), pos(0) { buffer[0] = '\0'; }
+
+    void append(const char *format, ...) {
+      if (pos >= size - 1) {
+        return;
+      }
+      va_list args;
+      va_start(args, format);
+      int written = vsnprintf(buffer + pos, size - pos, format, args);
+      va_end(args);
+      if (written > 0) {
+        pos += written;
+        if (pos > size - 1) {
+          pos = size - 1;
+        }
+      }
+    }
+
+   private:
+    char *buffer;
+    size_t size;
+    size_t pos;
+  };
+
+  void updateTasks() {
+#if configUSE_TRACE_FACILITY
+    uint32_t totalRunTime = 0;
+    UBaseType_t count = 0;
+    // A task created between the two calls makes the snapshot too small, retry once with the new number.
+    for (int attempt = 0; attempt < 2 && count == 0; attempt++) {
+      UBaseType_t tasks = uxTaskGetNumberOfTasks();
+      if (!reserveSnapshot(tasks)) {
+        break;
+      }
+      count = uxTaskGetSystemState(taskStatus, snapshotSize, &totalRunTime);
+    }
+    uint32_t totalDelta = totalRunTime - prevTotalRunTime;
+
+    record.taskTotal = count > 0 ? count : uxTaskGetNumberOfTasks();
+    record.taskCount = count < STATUS_MAX_TASKS ? count : STATUS_MAX_TASKS;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+      record.coreLoad[core] = 0;
+    }
+    for (UBaseType_t i = 0; i < count; i++) {
+      const TaskStatus_t &s = taskStatus[i];
+      // Tasks beyond the record only count for the core load.
+      TaskStat scratch;
+      TaskStat &t = i < STATUS_MAX_TASKS ? record.tasks[i] : scratch;
+      strncpy(t.name, s.pcTaskName, sizeof(t.name) - 1);
+      t.name[sizeof(t.name) - 1] = '\0';
+      t.stackHighWaterMark = s.usStackHighWaterMark * sizeof(StackType_t);
+      BaseType_t affinity = xTaskGetAffinity(s.xHandle);
+      t.core = affinity == tskNO_AFFINITY ? -1 : (int8_t)affinity;
+      t.cpuPercent = 0;
+#if configGENERATE_RUN_TIME_STATS
+      if (totalDelta > 0) {
+        uint32_t runTimeDelta = s.ulRunTimeCounter;
+        for (UBaseType_t j = 0; j < prevCount; j++) {
+          if (prevRunTime[j].taskNumber == s.xTaskNumber) {
+            runTimeDelta = s.ulRunTimeCounter - prevRunTime[j].runTime;
+            break;
+          }
+        }
+        uint32_t percent = (uint64_t)runTimeDelta * 100 / totalDelta;
+        t.cpuPercent = percent > 100 ? 100 : percent;
+
+        // The core load is derived from the idle task of each core.
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+          if (s.xHandle == xTaskGetIdleTaskHandleForCPU(core)) {
+            record.coreLoad[core] = 100 - t.cpuPercent;
+          }
+        }
+      }
+#endif
+    }
+
+    for (UBaseType_t i = 0; i < count; i++) {
+      prevRunTime[i].taskNumber = taskStatus[i].xTaskNumber;
+      prevRunTime[i].runTime = taskStatus[i].ulRunTimeCounter;
+    }
+    prevCount = count;
+    prevTotalRunTime = totalRunTime;
+#else
+    // Without the trace facility only the calling task can be reported.
+    record.taskCount = 1;
+    record.taskTotal = uxTaskGetNumberOfTasks();
+    TaskStat &t = record.tasks[0];
+    strncpy(t.name, pcTaskGetName(NULL), sizeof(t.name) - 1);
+    t.name[sizeof(t.name) - 1] = '\0';
+    t.stackHighWaterMark = uxTaskGetStackHighWaterMark(NULL) * sizeof(StackType_t);
+    t.cpuPercent = 0;
+    t.core = -1;
+#endif
   }
 };
 
-#endif  // ESP_STATUS_H
\ No newline at end of file
+#endif  // ESP_STATUS_H
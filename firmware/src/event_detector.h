@@ -0,0 +1,324 @@
+#ifndef EVENT_DETECTOR_H
+#define EVENT_DETECTOR_H
+
+#include <Arduino.h>
+
+#include "fixed_point.h"
+#include "ringbuffer.h"
+
+// Samples kept before a trigger and stored with the event.
+#ifndef EVENT_PRE_SAMPLES
+#define EVENT_PRE_SAMPLES 30
+#endif
+
+// Samples stored at full rate after the last trigger.
+#ifndef EVENT_POST_SAMPLES
+#define EVENT_POST_SAMPLES 60
+#endif
+
+// Quiet samples averaged into one summary record.
+#ifndef EVENT_SUMMARY_SAMPLES
+#define EVENT_SUMMARY_SAMPLES 60
+#endif
+
+// Step: difference of a fast (1/2^EVENT_FAST_SHIFT) and a slow (1/2^EVENT_SLOW_SHIFT) moving average in µA.
+#ifndef EVENT_STEP_UA
+#define EVENT_STEP_UA 50000
+#endif
+
+#ifndef EVENT_FAST_SHIFT
+#define EVENT_FAST_SHIFT 2
+#endif
+
+#ifndef EVENT_SLOW_SHIFT
+#define EVENT_SLOW_SHIFT 5
+#endif
+
+// Burst: RMS of the sample to sample change over about 2^EVENT_BURST_SHIFT samples, in per mille of the slow average
+// but at least EVENT_BURST_UA. Tracker hunting scales with the current.
+#ifndef EVENT_BURST_PERMILLE
+#define EVENT_BURST_PERMILLE 80
+#endif
+
+#ifndef EVENT_BURST_UA
+#define EVENT_BURST_UA 20000
+#endif
+
+#ifndef EVENT_BURST_SHIFT
+#define EVENT_BURST_SHIFT 3
+#endif
+
+// Level crossing with hysteresis in µA, e.g. the start and the end of the production. 0: off.
+#ifndef EVENT_LEVEL_UA
+#define EVENT_LEVEL_UA 20000
+#endif
+
+#ifndef EVENT_HYSTERESIS_UA
+#define EVENT_HYSTERESIS_UA 5000
+#endif
+
+// Buffer size for DetectorEvent::toJson().
+#define EVENT_JSON_SIZE 160
+
+// Kinds of events, combined as bit mask.
+enum EventKind : uint8_t {
+  EVENT_STEP = 1,
+  EVENT_BURST = 2,
+  EVENT_RISE = 4,  // Level crossed upwards
+  EVENT_FALL = 8,  // Level crossed downwards
+};
+
+struct DetectorEvent {
+  uint8_t kinds;
+  int64_t timestamp;
+  int32_t value;     // µA
+  int32_t baseline;  // Slow average before the sample, µA
+  int32_t step;      // Fast minus slow average, µA
+  int32_t rms;       // RMS of the sample to sample change, µA
+
+  // Writes the event as JSON object. out must hold EVENT_JSON_SIZE bytes. Returns the length.
+  size_t toJson(char *out) const {
+    static const char *names[] = {"step", "burst", "rise", "fall"};
+    size_t n = 0;
+    n += sprintf(out + n, "{\"timestamp\":");
+    n += formatInt64(out + n, timestamp);
+    n += sprintf(out + n, ",\"kinds\":[");
+    bool first = true;
+    for (int i = 0; i < 4; i++) {
+      if (kinds & (1 << i)) {
+        n += sprintf(out + n, first ? "\"%s\"" : ",\"%s\"", names[i]);
+        first = false;
+      }
+    }
+    n += sprintf(out + n, "],\"value\":");
+    n += formatMilli(out + n, value);
+    n += sprintf(out + n, ",\"baseline\":");
+    n += formatMilli(out + n, baseline);
+    n += sprintf(out + n, ",\"step\":");
+    n += formatMilli(out + n, step);
+    n += sprintf(out + n, ",\"rms\":");
+    n += formatMilli(out + n, rms);
+    out[n++] = '}';
+    out[n] = '\0';
+    return n;
+  }
+};
+
+struct EventStats {
+  uint32_t samples;    // Samples fed
+  uint32_t events;
+  uint32_t stored;     // Samples passed on at full rate
+  uint32_t summaries;  // Summary records passed on
+};
+
+// EventDetector sits between the sensor and the buffer. It watches the samples for steps (shading, inverter trips),
+// bursts of sample to sample changes (MPPT hunting) and crossings of a level with hysteresis. Around an event the
+// samples are passed on at full rate, PreSamples before the trigger and EVENT_POST_SAMPLES after the last one; quiet
+// stretches are passed on as one record per EVENT_SUMMARY_SAMPLES, the mean at the middle of the span. The records
+// stay in timestamp order.
+//
+// The detectors are integer moving averages, the cost per sample is constant. A trigger additionally passes on the
+// pre-trigger window, at most PreSamples records.
+template <size_t PreSamples = EVENT_PRE_SAMPLES>
+class EventDetector {
+ public:
+  static_assert(PreSamples > 0, "EventDetector needs a pre-trigger window");
+
+  // Feeds a sample. The records to keep are passed to store(const Measurement &). Returns the kinds of the events
+  // triggered by the sample, 0 if none; the event is then available from getEvent().
+  template <typename Store>
+  uint8_t add(const Measurement &m, Store &&store) {
+    stats.samples++;
+    uint8_t kinds = detect(m.value);
+    if (kinds != 0) {
+      event = {.kinds = kinds,
+               .timestamp = m.timestamp,
+               .value = m.value,
+               .baseline = baseline,
+               .step = fastMean() - slowMean(),
+               .rms = (int32_t)isqrt((uint64_t)(varAcc >> EVENT_BURST_SHIFT))};
+      stats.events++;
+      flushSummary(store);
+      for (; preCount > 0; preCount--) {
+        store(pre[preHead]);
+        preHead = preHead + 1 == PreSamples ? 0 : preHead + 1;
+        stats.stored++;
+      }
+      postRemaining = EVENT_POST_SAMPLES;
+    }
+
+    if (postRemaining > 0) {
+      postRemaining--;
+      store(m);
+      stats.stored++;
+      return kinds;
+    }
+
+    // Quiet: the oldest sample of the pre-trigger window goes into the summary
+    if (preCount == PreSamples) {
+      summarize(pre[preHead], store);
+      preHead = preHead + 1 == PreSamples ? 0 : preHead + 1;
+      preCount--;
+    }
+    size_t tail = preHead + preCount;
+    pre[tail >= PreSamples ? tail - PreSamples : tail] = m;
+    preCount++;
+    return kinds;
+  }
+
+  // Passes on the samples held back: the pending summary and the pre-trigger window as summary.
+  template <typename Store>
+  void flush(Store &&store) {
+    for (; preCount > 0; preCount--) {
+      summarize(pre[preHead], store);
+      preHead = preHead + 1 == PreSamples ? 0 : preHead + 1;
+    }
+    flushSummary(store);
+  }
+
+  // Adds deltaMs to the timestamps held back that are below threshold, see RingBuffer::restamp().
+  void restamp(int64_t threshold, int64_t deltaMs) {
+    for (size_t i = 0; i < PreSamples; i++) {
+      if (pre[i].timestamp < threshold) {
+        pre[i].timestamp += deltaMs;
+      }
+    }
+    if (summaryCount > 0 && summaryFirst < threshold) {
+      summaryFirst += deltaMs;
+    }
+    if (summaryCount > 0 && summaryLast < threshold) {
+      summaryLast += deltaMs;
+    }
+  }
+
+  // Returns the last event.
+  const DetectorEvent &getEvent() const { return event; }
+
+  const EventStats &getStats() const { return stats; }
+
+ private:
+  Measurement pre[PreSamples] = {};
+  size_t preHead = 0;
+  size_t preCount = 0;
+  uint32_t postRemaining = 0;
+
+  // Moving averages, scaled by 2^shift
+  bool seeded = false;
+  int64_t fastAcc = 0;
+  int64_t slowAcc = 0;
+  int64_t varAcc = 0;
+  int32_t previous = 0;
+  int32_t baseline = 0;
+  bool stepArmed = true;
+  bool burstArmed = true;
+  bool aboveLevel = false;
+
+  int64_t summarySum = 0;
+  uint32_t summaryCount = 0;
+  int64_t summaryFirst = 0;
+  int64_t summaryLast = 0;
+
+  DetectorEvent event = {};
+  EventStats stats = {};
+
+  int32_t fastMean() const { return (int32_t)(fastAcc >> EVENT_FAST_SHIFT); }
+  int32_t slowMean() const { return (int32_t)(slowAcc >> EVENT_SLOW_SHIFT); }
+
+  uint8_t detect(int32_t value) {
+    if (!seeded) {
+      seeded = true;
+      fastAcc = (int64_t)value << EVENT_FAST_SHIFT;
+      slowAcc = (int64_t)value << EVENT_SLOW_SHIFT;
+      previous = value;
+      aboveLevel = EVENT_LEVEL_UA > 0 && value > EVENT_LEVEL_UA;
+    }
+    baseline = slowMean();
+    int64_t diff = (int64_t)value - previous;
+    previous = value;
+    fastAcc += value - (fastAcc >> EVENT_FAST_SHIFT);
+    slowAcc += value - (slowAcc >> EVENT_SLOW_SHIFT);
+    varAcc += diff * diff - (varAcc >> EVENT_BURST_SHIFT);
+
+    uint8_t kinds = 0;
+
+    // Steps and bursts trigger once and re-arm below half the threshold
+    int32_t step = fastMean() - slowMean();
+    if (step < 0) {
+      step = -step;
+    }
+    if (stepArmed && step >= EVENT_STEP_UA) {
+      kinds |= EVENT_STEP;
+      stepArmed = false;
+    } else if (step < EVENT_STEP_UA / 2) {
+      stepArmed = true;
+    }
+
+    int64_t variance = varAcc >> EVENT_BURST_SHIFT;
+    int64_t burst = (int64_t)(baseline < 0 ? -baseline : baseline) * EVENT_BURST_PERMILLE / 1000;
+    if (burst < EVENT_BURST_UA) {
+      burst = EVENT_BURST_UA;
+    }
+    if (burstArmed && variance >= burst * burst) {
+      kinds |= EVENT_BURST;
+      burstArmed = false;
+    } else if (variance < burst * burst / 4) {
+      burstArmed = true;
+    }
+
+    if (EVENT_LEVEL_UA > 0) {
+      if (!aboveLevel && value > EVENT_LEVEL_UA + EVENT_HYSTERESIS_UA) {
+        kinds |= EVENT_RISE;
+        aboveLevel = true;
+      } else if (aboveLevel && value < EVENT_LEVEL_UA - EVENT_HYSTERESIS_UA) {
+        kinds |= EVENT_FALL;
+        aboveLevel = false;
+      }
+    }
+    return kinds;
+  }
+
+  template <typename Store>
+  void summarize(const Measurement &m, Store &store) {
+    if (summaryCount == 0) {
+      summaryFirst = m.timestamp;
+    }
+    summarySum += m.value;
+    summaryLast = m.timestamp;
+    if (++summaryCount == EVENT_SUMMARY_SAMPLES) {
+      flushSummary(store);
+    }
+  }
+
+  template <typename Store>
+  void flushSummary(Store &store) {
+    if (summaryCount == 0) {
+      return;
+    }
+    Measurement summary = {.value = (int32_t)(summarySum / (int32_t)summaryCount),
+                           .timestamp = summaryFirst + (summaryLast - summaryFirst) / 2};
+    store(summary);
+    stats.summaries++;
+    summarySum = 0;
+    summaryCount = 0;
+  }
+
+  static uint32_t isqrt(uint64_t v) {
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+    while (bit > v) {
+      bit >>= 2;
+    }
+    while (bit != 0) {
+      if (v >= root + bit) {
+        v -= root + bit;
+        root = (root >> 1) + bit;
+      } else {
+        root >>= 1;
+      }
+      bit >>= 2;
+    }
+    return (uint32_t)root;
+  }
+};
+
+#endif  // EVENT_DETECTOR_H
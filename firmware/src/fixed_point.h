@@ -0,0 +1,90 @@
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Samples stay integers from the sensor register to the serializers: currents are kept in µA. The wire format is
+// unchanged, the value is sent in mA as a decimal with up to three places, so floats only appear at the server.
+
+// Buffer size for formatInt64(): sign, 19 digits and the terminating zero.
+#define INT64_STRING_SIZE 21
+
+// Buffer size for formatMilli(): sign, 7 integer digits, point, 3 places and the terminating zero.
+#define MILLI_STRING_SIZE 13
+
+// Buffer size for formatMeasurementJson().
+#define MEASUREMENT_JSON_SIZE 64
+
+// Layout of the batches for /api/v1/data. 1: an object per measurement, 2: columns, without a key per sample (see
+// JsonHelper::toJson()).
+#ifndef JSON_BATCH_VERSION
+#define JSON_BATCH_VERSION 1
+#endif
+
+// Writes value as a decimal number. Returns the length without the terminating zero.
+inline size_t formatInt64(char *out, int64_t value) {
+  char digits[20];
+  size_t n = 0;
+  uint64_t v = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+  // 64 bit divisions are library calls on the ESP32: only used for the upper digits
+  while (v > UINT32_MAX) {
+    digits[n++] = '0' + (char)(v % 10);
+    v /= 10;
+  }
+  uint32_t w = (uint32_t)v;
+  do {
+    digits[n++] = '0' + (char)(w % 10);
+    w /= 10;
+  } while (w != 0);
+
+  size_t len = 0;
+  if (value < 0) {
+    out[len++] = '-';
+  }
+  while (n > 0) {
+    out[len++] = digits[--n];
+  }
+  out[len] = '\0';
+  return len;
+}
+
+// Writes value / 1000 as a decimal with up to three places, trailing zeros are omitted (12340 -> "12.34").
+// Returns the length without the terminating zero.
+inline size_t formatMilli(char *out, int32_t value) {
+  size_t len = 0;
+  uint32_t v = value < 0 ? 0 - (uint32_t)value : (uint32_t)value;
+  if (value < 0) {
+    out[len++] = '-';
+  }
+  len += formatInt64(out + len, v / 1000);
+  uint32_t fraction = v % 1000;
+  if (fraction != 0) {
+    out[len++] = '.';
+    for (uint32_t scale = 100; fraction != 0; scale /= 10) {
+      out[len++] = '0' + (char)(fraction / scale);
+      fraction %= scale;
+    }
+    out[len] = '\0';
+  }
+  return len;
+}
+
+// Writes a measurement as the JSON object {"timestamp":<ms>,"value":<mA>}. out must hold MEASUREMENT_JSON_SIZE
+// bytes. Returns the length without the terminating zero.
+inline size_t formatMeasurementJson(char *out, int64_t timestamp, int32_t valueUa) {
+  static const char kTimestamp[] = "{\"timestamp\":";
+  static const char kValue[] = ",\"value\":";
+  size_t len = sizeof(kTimestamp) - 1;
+  memcpy(out, kTimestamp, len);
+  len += formatInt64(out + len, timestamp);
+  memcpy(out + len, kValue, sizeof(kValue) - 1);
+  len += sizeof(kValue) - 1;
+  len += formatMilli(out + len, valueUa);
+  out[len++] = '}';
+  out[len] = '\0';
+  return len;
+}
+
+#endif  // FIXED_POINT_H
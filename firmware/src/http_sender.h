@@ -5,20 +5,37 @@
 #include <AsyncHTTPRequest_Generic.h>
 #include <AsyncHTTPSRequest_Generic.h>
 #include <Base64.h>
+#include <esp_heap_caps.h>
+
+#include "log_ring.h"
+
+// Counters of the HttpSender, reported in the status record.
+struct HttpStats {
+    uint32_t requests;     // Requests sent
+    uint32_t connections;  // Requests that needed a new connection (TCP connect and TLS handshake with HTTPS)
+    uint32_t lastSetupMs;  // Time from send to the response headers of the last request
+    uint32_t maxSetupMs;
+    uint32_t maxHeapDrop;  // Largest drop of the free heap during a request, in bytes
+};
 
 // HttpSender encapsulates HTTP/HTTPS sending functionality.
 // It allows setting the server URL, API token, and Basic Auth credentials via setters.
+//
+// The connection is kept alive and reused across requests to the same server, so HTTPS pays the TLS handshake only
+// once per connection instead of once per batch. Whether a request reused the connection is told by the
+// X-Connection-Request response header of the server (1 for the first request on a connection).
 class HttpSender {
 public:
     // Type definition for response callbacks.
     // Parameters: HTTP code and response string.
     typedef void (*ResponseCallback)(int httpCode, const String &response);
 
-    HttpSender() : sendInProgress(false) {}
+    HttpSender() : sendInProgress(false), useHttps(false), stats() {}
 
-    // Setter for the server URL.
+    // Setter for the server URL. The protocol is determined here by checking if the URL starts with "https".
     void setServerUrl(const String &url) {
         serverUrl = url;
+        useHttps = serverUrl.startsWith("https");
     }
 
     // Setter for the API token.
@@ -26,10 +43,13 @@ public:
         apiToken = token;
     }
 
-    // Setter for Basic Authentication credentials.
+    // Setter for Basic Authentication credentials. The Authorization header is computed once here.
     void setBasicAuth(const String &username, const String &password) {
-        basicUsername = username;
-        basicPassword = password;
+        if (username.length() > 0 && password.length() > 0) {
+            authHeader = "Basic " + base64::encode(username + ":" + password);
+        } else {
+            authHeader = "";
+        }
     }
 
     // Sets the callback to be invoked on a successful response.
@@ -47,62 +67,32 @@ public:
         return sendInProgress;
     }
 
+    // Returns the connection and request counters.
+    const HttpStats &getStats() const {
+        return stats;
+    }
+
     // Sends the provided JSON payload via HTTP or HTTPS.
-    // The protocol is determined at runtime by checking if serverUrl starts with "https".
     void sendRequest(const String &jsonPayload) {
+        sendRequest(jsonPayload.c_str());
+    }
+
+    // Sends the provided JSON payload via HTTP or HTTPS without copying it into a String.
+    void sendRequest(const char *jsonPayload) {
         if (serverUrl.length() == 0) {
-            Serial.println("Server URL not set!");
+            LOG_ERROR("Server URL not set!");
             return;
         }
-        bool useHttps = serverUrl.startsWith("https");
         if (useHttps) {
             httpsRequest.onReadyStateChange([this](void *optParm, AsyncHTTPSRequest *request, int readyState) {
-                this->handleHttpsResponse(optParm, request, readyState);
+                this->handleResponse(request, readyState);
             });
-            if (httpsRequest.readyState() == readyStateUnsent || httpsRequest.readyState() == readyStateDone) {
-                bool openResult = httpsRequest.open("POST", serverUrl.c_str());
-                if (openResult) {
-                    httpsRequest.setReqHeader("Content-Type", "application/json");
-                    if (apiToken.length() > 0) {
-                        httpsRequest.setReqHeader("X-API-Token", apiToken.c_str());
-                    }
-                    if (basicUsername.length() > 0 && basicPassword.length() > 0) {
-                        String credentials = basicUsername + ":" + basicPassword;
-                        String base64Credentials = base64::encode(credentials);
-                        httpsRequest.setReqHeader("Authorization", ("Basic " + base64Credentials).c_str());
-                    }
-                    httpsRequest.send(jsonPayload);
-                    sendInProgress = true;
-                } else {
-                    Serial.println(F("Can't open HTTPS request"));
-                }
-            } else {
-                Serial.println(F("HTTPS request not ready"));
-            }
+            send(httpsRequest, jsonPayload, "HTTPS");
         } else {
             httpRequest.onReadyStateChange([this](void *optParm, AsyncHTTPRequest *request, int readyState) {
-                this->handleHttpResponse(optParm, request, readyState);
+                this->handleResponse(request, readyState);
             });
-            if (httpRequest.readyState() == readyStateUnsent || httpRequest.readyState() == readyStateDone) {
-                bool openResult = httpRequest.open("POST", serverUrl.c_str());
-                if (openResult) {
-                    httpRequest.setReqHeader("Content-Type", "application/json");
-                    if (apiToken.length() > 0) {
-                        httpRequest.setReqHeader("X-API-Token", apiToken.c_str());
-                    }
-                    if (basicUsername.length() > 0 && basicPassword.length() > 0) {
-                        String credentials = basicUsername + ":" + basicPassword;
-                        String base64Credentials = base64::encode(credentials);
-                        httpRequest.setReqHeader("Authorization", ("Basic " + base64Credentials).c_str());
-                    }
-                    httpRequest.send(jsonPayload);
-                    sendInProgress = true;
-                } else {
-                    Serial.println(F("Can't open HTTP request"));
-                }
-            } else {
-                Serial.println(F("HTTP request not ready"));
-            }
+            send(httpRequest, jsonPayload, "HTTP");
         }
     }
 
@@ -113,42 +103,75 @@ private:
 
     // Configurable members (set via setters).
     String serverUrl;
+    bool useHttps;
     String apiToken;
-    String basicUsername;
-    String basicPassword;
+    String authHeader;
 
     ResponseCallback successCallback = nullptr;
     ResponseCallback failureCallback = nullptr;
 
-    // Internal handler for HTTP responses.
-    void handleHttpResponse(void *optParm, AsyncHTTPRequest *request, int readyState) {
-        if (readyState == readyStateDone) {
-            int httpCode = request->responseHTTPcode();
-            Serial.print("HTTP request completed. Code: ");
-            Serial.println(httpCode);
-            Serial.print("HTTP response: ");
-            Serial.println(request->responseHTTPString());
-            if (httpCode >= 200 && httpCode < 300) {
-                if (successCallback) {
-                    successCallback(httpCode, request->responseHTTPString());
-                }
-            } else {
-                if (failureCallback) {
-                    failureCallback(httpCode, request->responseHTTPString());
-                }
-            }
-            sendInProgress = false;
+    // Instrumentation of the current request.
+    HttpStats stats;
+    unsigned long requestStart = 0;
+    uint32_t heapAtStart = 0;
+    uint32_t heapMin = 0;
+
+    template <typename Request>
+    void send(Request &request, const char *jsonPayload, const char *protocol) {
+        if (request.readyState() != readyStateUnsent && request.readyState() != readyStateDone) {
+            LOG_WARN("%s request not ready", protocol);
+            return;
+        }
+        if (!request.open("POST", serverUrl.c_str())) {
+            LOG_ERROR("Can't open %s request", protocol);
+            return;
+        }
+        request.setReqHeader("Content-Type", "application/json");
+        request.setReqHeader("Connection", "keep-alive");
+        if (apiToken.length() > 0) {
+            request.setReqHeader("X-API-Token", apiToken.c_str());
+        }
+        if (authHeader.length() > 0) {
+            request.setReqHeader("Authorization", authHeader.c_str());
         }
+
+        requestStart = millis();
+        heapAtStart = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        heapMin = heapAtStart;
+        stats.requests++;
+
+        request.send(jsonPayload);
+        sendInProgress = true;
     }
 
-    // Internal handler for HTTPS responses.
-    void handleHttpsResponse(void *optParm, AsyncHTTPSRequest *request, int readyState) {
+    // Internal handler for HTTP and HTTPS responses.
+    template <typename Request>
+    void handleResponse(Request *request, int readyState) {
+        uint32_t heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        if (heap < heapMin) {
+            heapMin = heap;
+        }
+
+        if (readyState == readyStateHdrsRecvd) {
+            stats.lastSetupMs = millis() - requestStart;
+            if (stats.lastSetupMs > stats.maxSetupMs) {
+                stats.maxSetupMs = stats.lastSetupMs;
+            }
+            // Without the header (other servers) every request is counted as a new connection.
+            char *connectionRequest = request->respHeaderValue("X-Connection-Request");
+            if (connectionRequest == nullptr || atoi(connectionRequest) <= 1) {
+                stats.connections++;
+            }
+            return;
+        }
+
         if (readyState == readyStateDone) {
+            if (heapAtStart - heapMin > stats.maxHeapDrop) {
+                stats.maxHeapDrop = heapAtStart - heapMin;
+            }
+
             int httpCode = request->responseHTTPcode();
-            Serial.print("HTTPS request completed. Code: ");
-            Serial.println(httpCode);
-            Serial.print("HTTPS response: ");
-            Serial.println(request->responseHTTPString());
+            LOG_DEBUG("HTTP request completed. Code: %d, setup %u ms", httpCode, stats.lastSetupMs);
             if (httpCode >= 200 && httpCode < 300) {
                 if (successCallback) {
                     successCallback(httpCode, request->responseHTTPString());
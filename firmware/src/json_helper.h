@@ -3,29 +3,74 @@
 
 #include <ArduinoJson.h>
 
+#include "fixed_point.h"
+#include "log_ring.h"
 #include "ringbuffer.h"
 
-template <size_t BufferSize>
+// Serializes up to MaxEntries measurements per document.
+template <size_t MaxEntries>
 class JsonHelper {
+  // The layouts, see capacityFor()
+  static constexpr size_t rowsCapacity(size_t n) {
+    return JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(n) + n * JSON_OBJECT_SIZE(2);
+  }
+
+  static constexpr size_t columnsCapacity(size_t n) { return JSON_OBJECT_SIZE(8) + 2 * JSON_ARRAY_SIZE(n); }
+
  public:
-  JsonHelper(size_t maxEntries) : maxEntries(maxEntries) {}
+  // Capacity of the JSON document for n measurements in either layout:
+  // {"device":..,"sentAt":..,"oldest":..,"newest":..,"measurements":[{"timestamp":..,"value":..}, ..]} or
+  // {"version":2,"device":..,"sentAt":..,"oldest":..,"newest":..,"start":..,"deltas":[..],"values":[..]}.
+  // The keys, the device name and the formatted values are not copied into the document.
+  static constexpr size_t capacityFor(size_t n) {
+    return rowsCapacity(n) > columnsCapacity(n) ? rowsCapacity(n) : columnsCapacity(n);
+  }
+
+  static constexpr size_t kBufferSize = capacityFor(MaxEntries);
+
+  // Sets the device name sent with each batch. The string is not copied.
+  void setDevice(const char* name) { device = name; }
+
+  // Sets the layout of the batches, see JSON_BATCH_VERSION.
+  void setVersion(int v) { version = v; }
 
   // Converts an Array of Measurement-Objecs into a JSON-String.
-  void toJson(const Measurement* measurementsBuffer, int count, String& jsonPayload) {
+  // The batch carries its send time and the oldest and newest sample timestamp for the end-to-end latency tracing
+  // of the server.
+  //
+  // Version 2 sends the columns of the batch: the timestamps as "start" and "interval", or "start" and "deltas", the
+  // difference of each timestamp to the previous one (the first to start), if the samples are not evenly spaced (gaps,
+  // records of the event detector), then the "values". About a third of the size of version 1.
+  void toJson(const Measurement* measurementsBuffer, int count, int64_t sentAt, String& jsonPayload) {
     doc.clear();  // Clear the JSON document
 
-    JsonArray measurements = doc.createNestedArray("measurements");
+    if (version >= 2) {
+      doc["version"] = 2;
+    }
+    if (device != nullptr) {
+      doc["device"] = device;
+    }
+    doc["sentAt"] = sentAt;
+    if (count > 0) {
+      doc["oldest"] = measurementsBuffer[0].timestamp;
+      doc["newest"] = measurementsBuffer[(count < (int)MaxEntries ? count : MaxEntries) - 1].timestamp;
+    }
 
     // Warning if less measurements are available than expected
-    if (count < maxEntries) {
-      Serial.println("Warnung: Weniger Messwerte vorhanden als erwartet!");
+    if (count < (int)MaxEntries) {
+      LOG_DEBUG("Warnung: Weniger Messwerte vorhanden als erwartet!");
     }
 
-    int limit = (count < maxEntries) ? count : maxEntries;
-    for (int i = 0; i < limit; i++) {
-      JsonObject obj = measurements.createNestedObject();
-      obj["timestamp"] = measurementsBuffer[i].timestamp;
-      obj["value"] = measurementsBuffer[i].value;
+    int limit = (count < (int)MaxEntries) ? count : MaxEntries;
+    if (version >= 2) {
+      addColumns(measurementsBuffer, limit);
+    } else {
+      JsonArray measurements = doc.createNestedArray("measurements");
+      for (int i = 0; i < limit; i++) {
+        JsonObject obj = measurements.createNestedObject();
+        obj["timestamp"] = measurementsBuffer[i].timestamp;
+        obj["value"] = formatValue(i, measurementsBuffer[i].value);
+      }
     }
 
     serializeJson(doc, jsonPayload);
@@ -36,14 +81,45 @@ class JsonHelper {
 
     JsonObject obj = doc.createNestedObject();
     obj["timestamp"] = measurement.timestamp;
-    obj["value"] = measurement.value;
+    obj["value"] = formatValue(0, measurement.value);
 
     serializeJson(doc, jsonPayload);
   }
 
  private:
-  StaticJsonDocument<BufferSize> doc;
-  size_t maxEntries;
+  StaticJsonDocument<kBufferSize> doc;
+  const char* device = nullptr;
+  int version = JSON_BATCH_VERSION;
+  // The values in mA, formatted from the integer µA and linked into the document as raw JSON
+  char values[MaxEntries > 0 ? MaxEntries : 1][MILLI_STRING_SIZE];
+
+  void addColumns(const Measurement* m, int count) {
+    if (count > 0) {
+      doc["start"] = m[0].timestamp;
+      int64_t interval = count > 1 ? m[1].timestamp - m[0].timestamp : 0;
+      int regular = 2;
+      while (regular < count && m[regular].timestamp - m[regular - 1].timestamp == interval) {
+        regular++;
+      }
+      if (regular >= count) {
+        doc["interval"] = interval;
+      } else {
+        JsonArray deltas = doc.createNestedArray("deltas");
+        for (int i = 0; i < count; i++) {
+          deltas.add(i == 0 ? 0 : m[i].timestamp - m[i - 1].timestamp);
+        }
+      }
+    }
+    JsonArray values = doc.createNestedArray("values");
+    for (int i = 0; i < count; i++) {
+      values.add(formatValue(i, m[i].value));
+    }
+  }
+
+  SerializedValue<const char*> formatValue(int slot, int32_t valueUa) {
+    size_t len = formatMilli(values[slot], valueUa);
+    return serialized((const char*)values[slot], len);
+  }
 };
 
 #endif  // JSON_HELPER_H
@@ -0,0 +1,278 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <Arduino.h>
+
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Log levels
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Calls above this level are compiled out.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Number of events in the ring, must be a power of two.
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 64
+#endif
+
+// Maximum number of arguments per event.
+#define LOG_MAX_ARGS 6
+
+// Length of a formatted line.
+#define LOG_LINE_LENGTH 192
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+
+// A packed printf argument.
+union LogArg {
+  int64_t i;
+  double d;
+  const void *p;
+};
+
+inline LogArg toLogArg(int v) { LogArg a; a.i = v; return a; }
+inline LogArg toLogArg(unsigned int v) { LogArg a; a.i = v; return a; }
+inline LogArg toLogArg(long v) { LogArg a; a.i = v; return a; }
+inline LogArg toLogArg(unsigned long v) { LogArg a; a.i = v; return a; }
+inline LogArg toLogArg(long long v) { LogArg a; a.i = v; return a; }
+inline LogArg toLogArg(unsigned long long v) { LogArg a; a.i = (int64_t)v; return a; }
+inline LogArg toLogArg(double v) { LogArg a; a.d = v; return a; }
+inline LogArg toLogArg(const char *v) { LogArg a; a.p = v; return a; }
+inline LogArg toLogArg(const void *v) { LogArg a; a.p = v; return a; }
+
+// A log call as stored in the ring: the format string literal (its address is the format id) plus the arguments.
+struct LogEvent {
+  uint32_t timestamp;  // ms
+  const char *format;
+  uint8_t level;
+  uint8_t argCount;
+  LogArg args[LOG_MAX_ARGS];
+};
+
+// LogRing decouples log calls from the UART: a call only packs its arguments into a lock-free multi-producer ring
+// (a few hundred ns), a low priority task formats and drains the events to Serial and an optional sink (e.g. MQTT).
+// If the ring is full the event is dropped and counted.
+//
+// Arguments are stored, not copied: %s must only be used with string literals or buffers that outlive the drain.
+class LogRing {
+ public:
+  // Additional output for formatted lines, e.g. MQTT. Called from the drain task.
+  typedef void (*Sink)(uint8_t level, const char *line);
+
+  LogRing() : enqueuePos(0), dequeuePos(0), dropped(0), sink(nullptr), task(nullptr) {
+    for (uint32_t i = 0; i < LOG_RING_SIZE; i++) {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Starts the drain task.
+  void begin(UBaseType_t priority = 1) {
+    if (xTaskCreatePinnedToCore(LogRing::taskMain, "log", 3072, this, priority, &task, 0) != pdPASS) {
+      Serial.println("Error: Failed to create log task.");
+    }
+  }
+
+  // Sets an additional sink for formatted lines at or below the given level.
+  void setSink(Sink s, uint8_t level) {
+    sinkLevel = level;
+    sink = s;
+  }
+
+  // Returns the number of events dropped because the ring was full.
+  uint32_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+  template <typename... Args>
+  void log(uint8_t level, const char *format, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many log arguments");
+    LogArg packed[] = {toLogArg(args)..., LogArg()};
+    push(level, format, packed, sizeof...(Args));
+  }
+
+  // Takes the oldest event. Returns false if the ring is empty. Single consumer only.
+  bool pop(LogEvent &event) {
+    Slot &slot = slots[dequeuePos & (LOG_RING_SIZE - 1)];
+    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if ((int32_t)(seq - (dequeuePos + 1)) < 0) {
+      return false;
+    }
+    event = slot.event;
+    slot.seq.store(dequeuePos + LOG_RING_SIZE, std::memory_order_release);
+    dequeuePos++;
+    return true;
+  }
+
+  // Formats an event as "[ms] L message". Returns the length.
+  static size_t format(const LogEvent &event, char *out, size_t size) {
+    static const char levels[] = "-EWID";
+    int len = snprintf(out, size, "[%u] %c ", event.timestamp, levels[event.level < 5 ? event.level : 0]);
+    size_t pos = len > 0 ? len : 0;
+    int arg = 0;
+    char spec[16];
+
+    for (const char *f = event.format; *f != '\0' && pos < size - 1; f++) {
+      if (*f != '%') {
+        out[pos++] = *f;
+        continue;
+      }
+      if (f[1] == '%') {
+        out[pos++] = '%';
+        f++;
+        continue;
+      }
+
+      // Copy the conversion specification, e.g. "%-8.2f" or "%lld".
+      size_t specLen = 0;
+      int longs = 0;
+      spec[specLen++] = *f++;
+      while (*f != '\0' && strchr("-+ #0123456789.hlzjt", *f) != nullptr && specLen < sizeof(spec) - 2) {
+        if (*f == 'l') {
+          longs++;
+        }
+        spec[specLen++] = *f++;
+      }
+      if (*f == '\0') {
+        break;
+      }
+      char conversion = *f;
+      spec[specLen++] = conversion;
+      spec[specLen] = '\0';
+
+      LogArg a;
+      a.i = 0;
+      if (arg < event.argCount) {
+        a = event.args[arg++];
+      }
+      switch (conversion) {
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+          len = snprintf(out + pos, size - pos, spec, a.d);
+          break;
+        case 's':
+          len = snprintf(out + pos, size - pos, spec, a.p != nullptr ? (const char *)a.p : "(null)");
+          break;
+        case 'p':
+          len = snprintf(out + pos, size - pos, spec, a.p);
+          break;
+        default:
+          if (longs >= 2) {
+            len = snprintf(out + pos, size - pos, spec, (long long)a.i);
+          } else if (longs == 1) {
+            len = snprintf(out + pos, size - pos, spec, (long)a.i);
+          } else {
+            len = snprintf(out + pos, size - pos, spec, (int)a.i);
+          }
+          break;
+      }
+      if (len > 0) {
+        pos += len;
+      }
+    }
+    if (pos >= size) {
+      pos = size - 1;
+    }
+    out[pos] = '\0';
+    return pos;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<uint32_t> seq;
+    LogEvent event;
+  };
+
+  Slot slots[LOG_RING_SIZE];
+  std::atomic<uint32_t> enqueuePos;
+  uint32_t dequeuePos;
+  std::atomic<uint32_t> dropped;
+  Sink sink;
+  uint8_t sinkLevel = LOG_LEVEL_NONE;
+  TaskHandle_t task;
+
+  void push(uint8_t level, const char *format, const LogArg *args, uint8_t argCount) {
+    uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+      slot = &slots[pos & (LOG_RING_SIZE - 1)];
+      uint32_t seq = slot->seq.load(std::memory_order_acquire);
+      int32_t diff = (int32_t)(seq - pos);
+      if (diff == 0) {
+        if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      } else {
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    slot->event.timestamp = millis();
+    slot->event.format = format;
+    slot->event.level = level;
+    slot->event.argCount = argCount;
+    for (uint8_t i = 0; i < argCount; i++) {
+      slot->event.args[i] = args[i];
+    }
+    slot->seq.store(pos + 1, std::memory_order_release);
+  }
+
+  static void taskMain(void *param) {
+    LogRing *self = static_cast<LogRing *>(param);
+    LogEvent event;
+    char line[LOG_LINE_LENGTH];
+    for (;;) {
+      if (!self->pop(event)) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        continue;
+      }
+      size_t len = format(event, line, sizeof(line) - 1);
+      line[len++] = '\n';
+      Serial.write((const uint8_t *)line, len);
+      if (self->sink != nullptr && event.level <= self->sinkLevel) {
+        line[len - 1] = '\0';
+        self->sink(event.level, line);
+      }
+    }
+  }
+};
+
+// The global log ring.
+inline LogRing &logRing() {
+  static LogRing ring;
+  return ring;
+}
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logRing().log(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logRing().log(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logRing().log(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logRing().log(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...)
+#endif
+
+#endif  // LOG_RING_H
@@ -0,0 +1,8 @@
+#include "loop_supervisor.h"
+
+// Defined once: a definition in the header would give each translation unit its own copy in RTC memory.
+RTC_NOINIT_ATTR LoopEvidence loopEvidence;
+
+#ifdef LOOP_WATCHDOG_TIMEOUT
+LoopSupervisor *LoopSupervisor::instance = nullptr;
+#endif
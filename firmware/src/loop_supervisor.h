@@ -0,0 +1,228 @@
+#ifndef LOOP_SUPERVISOR_H
+#define LOOP_SUPERVISOR_H
+
+#include <Arduino.h>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+
+#include "esp_debug_helpers.h"
+#include "log_ring.h"
+
+// Time budget of one main loop iteration in ms. Longer iterations are counted as stalls.
+#ifndef LOOP_STALL_BUDGET
+#define LOOP_STALL_BUDGET 100
+#endif
+
+// Histogram buckets of the stall durations: bucket i counts stalls of budget * 2^i up to budget * 2^(i+1), the
+// last bucket everything longer.
+#define LOOP_STALL_BUCKETS 8
+
+// Hardware timer used to capture the backtrace before the watchdog resets (LOOP_WATCHDOG_TIMEOUT only).
+#ifndef LOOP_WATCHDOG_TIMER
+#define LOOP_WATCHDOG_TIMER 0
+#endif
+
+// Program counters kept of the stalled loop.
+#define LOOP_BACKTRACE_DEPTH 16
+
+// Subsystems called by the main loop.
+enum LoopSubsystem : uint8_t {
+  LOOP_CONNECTIVITY,
+  LOOP_SAMPLE,
+  LOOP_MQTT,
+  LOOP_UPLOAD,
+  LOOP_STATUS,
+  LOOP_RIPPLE,
+  LOOP_SUBSYSTEM_COUNT
+};
+
+// Stalls blamed on one subsystem.
+struct SubsystemStalls {
+  uint32_t count;
+  uint32_t maxMs;
+  uint16_t histogram[LOOP_STALL_BUCKETS];
+};
+
+// Evidence of a stall that ran into the watchdog, kept in RTC memory across the reset.
+struct LoopEvidence {
+  uint32_t magic;
+  uint8_t subsystem;
+  uint32_t stalledMs;  // Iteration time when the backtrace was taken
+  uint8_t depth;
+  uint32_t backtrace[LOOP_BACKTRACE_DEPTH];
+};
+
+// Defined in loop_supervisor.cpp.
+extern LoopEvidence loopEvidence;
+
+// LoopSupervisor times the subsystem calls of the main loop. Each iteration is split into sections with enter();
+// an iteration over LOOP_STALL_BUDGET is a stall and blamed on its longest section, which is logged and counted in
+// a histogram per subsystem. The sleep at the end of the loop is not part of an iteration.
+//
+// With LOOP_WATCHDOG_TIMEOUT (ms) the loop task is also guarded by the task watchdog, which resets the ESP32 if an
+// iteration does not finish in time. Shortly before, a hardware timer interrupt on the core of the loop captures the
+// backtrace of the stalled loop and the current subsystem into RTC memory. After the reset they are logged and
+// reported in the status record, the addresses can be resolved with addr2line.
+class LoopSupervisor {
+ public:
+  LoopSupervisor() : stats() {}
+
+  // Reports the evidence of a previous watchdog reset and arms the watchdog. Must be called from the loop task.
+  void begin() {
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (loopEvidence.magic == kMagic && loopEvidence.subsystem < LOOP_SUBSYSTEM_COUNT &&
+        loopEvidence.depth <= LOOP_BACKTRACE_DEPTH &&
+        (reason == ESP_RST_TASK_WDT || reason == ESP_RST_INT_WDT || reason == ESP_RST_WDT ||
+         reason == ESP_RST_PANIC)) {
+      lastReset = loopEvidence;
+      hasLastReset = true;
+      LOG_ERROR("Watchdog reset: loop stalled in %s for %u ms", subsystemName(lastReset.subsystem),
+                lastReset.stalledMs);
+      for (int i = 0; i < lastReset.depth; i++) {
+        LOG_ERROR("  backtrace 0x%08x", lastReset.backtrace[i]);
+      }
+    }
+    loopEvidence.magic = 0;
+
+#ifdef LOOP_WATCHDOG_TIMEOUT
+    instance = this;
+    loopTask = xTaskGetCurrentTaskHandle();
+    esp_task_wdt_init((LOOP_WATCHDOG_TIMEOUT + 999) / 1000, true);
+    esp_task_wdt_add(loopTask);
+    // Capture one second before the watchdog fires, at least at half the timeout
+    uint64_t captureUs = LOOP_WATCHDOG_TIMEOUT > 2000 ? (LOOP_WATCHDOG_TIMEOUT - 1000) * 1000ULL
+                                                      : LOOP_WATCHDOG_TIMEOUT * 500ULL;
+    captureTimer = timerBegin(LOOP_WATCHDOG_TIMER, 80, true);  // 1 µs
+    timerAttachInterrupt(captureTimer, LoopSupervisor::captureIsr, true);
+    timerAlarmWrite(captureTimer, captureUs, false);
+    timerAlarmEnable(captureTimer);
+#endif
+  }
+
+  // Starts an iteration and feeds the watchdog.
+  void beginIteration() {
+    iterationStartUs = sectionStartUs = esp_timer_get_time();
+    current = LOOP_CONNECTIVITY;
+    for (int i = 0; i < LOOP_SUBSYSTEM_COUNT; i++) {
+      sectionUs[i] = 0;
+    }
+#ifdef LOOP_WATCHDOG_TIMEOUT
+    esp_task_wdt_reset();
+    timerWrite(captureTimer, 0);
+    if (captured) {
+      // The loop recovered after the capture: drop the evidence, a later reset is not this stall, and rearm
+      loopEvidence.magic = 0;
+      captured = false;
+      timerAlarmEnable(captureTimer);
+    }
+#endif
+  }
+
+  // Ends the current section and starts the section of the given subsystem. Returns the subsystem of the ended
+  // section, for a nested call to enter() again when it returns.
+  LoopSubsystem enter(LoopSubsystem subsystem) {
+    int64_t now = esp_timer_get_time();
+    LoopSubsystem previous = (LoopSubsystem)current;
+    sectionUs[current] += now - sectionStartUs;
+    sectionStartUs = now;
+    current = subsystem;
+    return previous;
+  }
+
+  // Ends the iteration and evaluates it.
+  void endIteration() {
+    int64_t now = esp_timer_get_time();
+    sectionUs[current] += now - sectionStartUs;
+    uint32_t durationMs = (now - iterationStartUs) / 1000;
+    if (durationMs <= LOOP_STALL_BUDGET) {
+      return;
+    }
+
+    int blamed = 0;
+    for (int i = 1; i < LOOP_SUBSYSTEM_COUNT; i++) {
+      if (sectionUs[i] > sectionUs[blamed]) {
+        blamed = i;
+      }
+    }
+    int bucket = 0;
+    while (bucket < LOOP_STALL_BUCKETS - 1 && durationMs >= (uint32_t)LOOP_STALL_BUDGET << (bucket + 1)) {
+      bucket++;
+    }
+    SubsystemStalls &s = stats[blamed];
+    s.count++;
+    s.histogram[bucket]++;
+    if (durationMs > s.maxMs) {
+      s.maxMs = durationMs;
+    }
+    totalStalls++;
+    if (durationMs > maxStallMs) {
+      maxStallMs = durationMs;
+      worst = blamed;
+    }
+    LOG_WARN("Loop stall: %u ms, %s took %u ms", durationMs, subsystemName(blamed),
+             (uint32_t)(sectionUs[blamed] / 1000));
+  }
+
+  static const char *subsystemName(int subsystem) {
+    static const char *const kNames[LOOP_SUBSYSTEM_COUNT] = {"connectivity", "sample", "mqtt", "upload",
+                                                             "status", "ripple"};
+    return subsystem >= 0 && subsystem < LOOP_SUBSYSTEM_COUNT ? kNames[subsystem] : "?";
+  }
+
+  uint32_t getStalls() const { return totalStalls; }
+
+  uint32_t getMaxStallMs() const { return maxStallMs; }
+
+  // Returns the subsystem blamed for the longest stall.
+  int getWorstSubsystem() const { return worst; }
+
+  // Returns the stalls blamed on each subsystem (LOOP_SUBSYSTEM_COUNT entries).
+  const SubsystemStalls *getSubsystemStalls() const { return stats; }
+
+  // Returns the evidence of the watchdog reset before this boot, nullptr if there was none.
+  const LoopEvidence *getLastReset() const { return hasLastReset ? &lastReset : nullptr; }
+
+ private:
+  static const uint32_t kMagic = 0x4c4f4f50;  // "LOOP"
+
+  int64_t iterationStartUs = 0;
+  int64_t sectionStartUs = 0;
+  volatile uint8_t current = LOOP_CONNECTIVITY;
+  int64_t sectionUs[LOOP_SUBSYSTEM_COUNT] = {};
+
+  SubsystemStalls stats[LOOP_SUBSYSTEM_COUNT];
+  uint32_t totalStalls = 0;
+  uint32_t maxStallMs = 0;
+  int worst = 0;
+
+  LoopEvidence lastReset = {};
+  bool hasLastReset = false;
+
+#ifdef LOOP_WATCHDOG_TIMEOUT
+  static LoopSupervisor *instance;
+  TaskHandle_t loopTask = nullptr;
+  hw_timer_t *captureTimer = nullptr;
+  volatile bool captured = false;
+
+  // Runs on the core of the loop task, so the backtrace walks from the interrupt into the stalled loop.
+  static void IRAM_ATTR captureIsr() {
+    LoopSupervisor *self = instance;
+    loopEvidence.subsystem = self->current;
+    loopEvidence.stalledMs = (esp_timer_get_time() - self->iterationStartUs) / 1000;
+    esp_backtrace_frame_t frame = {};
+    esp_backtrace_get_start(&frame.pc, &frame.sp, &frame.next_pc);
+    uint8_t depth = 0;
+    do {
+      // Return addresses of windowed calls carry the window size in the top bits and point after the call
+      uint32_t pc = frame.pc & 0x80000000 ? (frame.pc & 0x3fffffff) | 0x40000000 : frame.pc;
+      loopEvidence.backtrace[depth++] = pc - 3;
+    } while (depth < LOOP_BACKTRACE_DEPTH && esp_backtrace_get_next_frame(&frame));
+    loopEvidence.depth = depth;
+    loopEvidence.magic = kMagic;
+    self->captured = true;
+  }
+#endif
+};
+
+#endif  // LOOP_SUPERVISOR_H
@@ -4,10 +4,22 @@
 #include <Arduino.h>
 #include <PsychicMqttClient.h>  // using bambo1543/MqttClientBinary
 
+#include "log_ring.h"
+
+// Log lines up to this level are published on the log topic, see publishLog(). LOG_LEVEL_NONE: none.
+#ifndef MQTT_LOG_LEVEL
+#define MQTT_LOG_LEVEL LOG_LEVEL_WARN
+#endif
+
 class MqttHandler {
  public:
-  // Constructor: sets default topics for status and measurement.
-  MqttHandler() : _statusTopic("status"), _measurementTopic("measurement") {}
+  // Constructor: sets default topics for status, measurement, events, ripple records and log lines.
+  MqttHandler()
+      : _statusTopic("status"),
+        _measurementTopic("measurement"),
+        _eventTopic("event"),
+        _rippleTopic("ripple"),
+        _logTopic("log") {}
 
   /**
    * Setup the MQTT client.
@@ -24,11 +36,8 @@ class MqttHandler {
     mqttClient.onDisconnect(MqttHandler::onMqttDisconnect);
     mqttClient.onPublish(MqttHandler::onMqttPublish);
 
-    // Initiate connection
+    // Initiate connection. The client connects (and reconnects) in the background.
     mqttClient.connect();
-    while (!mqttClient.connected()) {
-      delay(500);
-    }
   }
 
   // Set the topic for status messages.
@@ -37,18 +46,27 @@ class MqttHandler {
   // Set the topic for measurement messages.
   void setMeasurementTopic(const String &topic) { _measurementTopic = topic; }
 
+  // Set the topic for detected events.
+  void setEventTopic(const String &topic) { _eventTopic = topic; }
+
+  // Set the topic for ripple records.
+  void setRippleTopic(const String &topic) { _rippleTopic = topic; }
+
+  // Set the topic for log lines.
+  void setLogTopic(const String &topic) { _logTopic = topic; }
+
   /**
    * Publish a status string in a non-blocking way.
    * @param status The status message to be sent.
    */
-  void publishStatus(const String &status) {
+  void publishStatus(const char *status) {
     if (!mqttClient.connected()) {
-      Serial.println("MQTT not connected. Status message not sent.");
+      LOG_WARN("MQTT not connected. Status message not sent.");
       return;
     }
     String topic = _deviceTopicPrefix + "/" + _statusTopic;
     // Publish with QoS 0 and no retain (non-blocking)
-    mqttClient.publish(topic.c_str(), 0, false, status.c_str());
+    mqttClient.publish(topic.c_str(), 0, false, status);
   }
 
   /**
@@ -57,7 +75,7 @@ class MqttHandler {
    */
   void publishMeasurement(const String &measurement) {
     if (!mqttClient.connected()) {
-      Serial.println("MQTT not connected. Measurement not sent.");
+      LOG_DEBUG("MQTT not connected. Measurement not sent.");
       return;
     }
     String topic = _deviceTopicPrefix + "/" + _measurementTopic;
@@ -65,6 +83,45 @@ class MqttHandler {
     mqttClient.publish(topic.c_str(), 0, false, measurement.c_str());
   }
 
+  /**
+   * Publish a detected event right away, see event_detector.h.
+   * @param event The event as JSON object.
+   */
+  void publishEvent(const char *event) {
+    if (!mqttClient.connected()) {
+      LOG_DEBUG("MQTT not connected. Event not sent.");
+      return;
+    }
+    String topic = _deviceTopicPrefix + "/" + _eventTopic;
+    mqttClient.publish(topic.c_str(), 0, false, event);
+  }
+
+  /**
+   * Publish a ripple record, see ripple_analyzer.h.
+   * @param ripple The record as JSON object.
+   */
+  void publishRipple(const char *ripple) {
+    if (!mqttClient.connected()) {
+      LOG_DEBUG("MQTT not connected. Ripple record not sent.");
+      return;
+    }
+    String topic = _deviceTopicPrefix + "/" + _rippleTopic;
+    mqttClient.publish(topic.c_str(), 0, false, ripple);
+  }
+
+  /**
+   * Publish a formatted log line, see LogRing::setSink(). Called from the log task; must not log itself, so
+   * lines are dropped silently while the client is not connected.
+   * @param line The log line.
+   */
+  void publishLog(const char *line) {
+    if (!mqttClient.connected()) {
+      return;
+    }
+    String topic = _deviceTopicPrefix + "/" + _logTopic;
+    mqttClient.publish(topic.c_str(), 0, false, line);
+  }
+
   /**
    * Returns true if the MQTT client is connected.
    */
@@ -75,23 +132,24 @@ class MqttHandler {
   String _deviceTopicPrefix;
   String _statusTopic;
   String _measurementTopic;
+  String _eventTopic;
+  String _rippleTopic;
+  String _logTopic;
 
   PsychicMqttClient mqttClient;
 
   // Callback for publish acknowledgment.
   static void onMqttPublish(uint16_t packetId) {
-    Serial.println("Publish acknowledged.");
-    Serial.printf("Packet ID: %d\r\n", packetId);
+    LOG_DEBUG("Publish acknowledged. Packet ID: %d", packetId);
   }
 
   // Callback for successful MQTT connection.
   static void onMqttConnect(bool sessionPresent) {
-    Serial.println("Connected to MQTT.");
-    Serial.printf("Session present: %d\r\n", sessionPresent);
+    LOG_INFO("Connected to MQTT. Session present: %d", sessionPresent);
   }
 
   // Callback for MQTT disconnection.
-  static void onMqttDisconnect(bool sessionPresent) { Serial.println("Disconnected from MQTT."); }
+  static void onMqttDisconnect(bool sessionPresent) { LOG_WARN("Disconnected from MQTT."); }
 };
 
 #endif  // MQTT_HANDLER_H
@@ -6,38 +6,40 @@
 #include <sys/time.h>
 #include <esp_sntp.h>
 
+#include "log_ring.h"
+#include "sample_clock.h"
+
 class NTPHandler {
 public:
-    // Initializes NTP time synchronization.
-    void setup() {
+    // Initializes NTP time synchronization. Every sync is forwarded to the given sample clock.
+    // Does not wait for the first sync; SNTP keeps polling in the background until it succeeds.
+    void setup(SampleClock &clock) {
+        sampleClock() = &clock;
+
         // Set the time synchronization callback.
         sntp_set_time_sync_notification_cb(timeSyncCallback);
+
+        // Slew instead of step the system time on corrections.
+        sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
         
         // Configure the time using NTP servers.
         configTime(0, 0, "pool.ntp.org", "time.nist.gov");
         Serial.println("Synchronizing NTP time...");
-        
-        // Wait for time to be set.
-        struct tm timeinfo;
-        int retry = 0;
-        while (!getLocalTime(&timeinfo) && retry < 10) {
-            delay(1000);
-            Serial.print(".");
-            retry++;
-        }
-        if (retry == 10) {
-            Serial.println("\nError: No NTP time received.");
-        } else {
-            Serial.println("\nNTP time synchronized.");
-        }
     }
 
 private:
-    // Callback function for time synchronization.
+    // The clock fed by the callback. A function local static, so the header can be included by several files.
+    static SampleClock *&sampleClock() {
+        static SampleClock *clock = nullptr;
+        return clock;
+    }
+
+    // Callback function for time synchronization. Runs in the lwIP task.
     static void timeSyncCallback(struct timeval *tv) {
-        Serial.println("\n----Time Sync----- Time should have been verified and updated if needed");
-        Serial.println(tv->tv_sec);
-        Serial.println(ctime(&tv->tv_sec));
+        LOG_INFO("Time sync: %ld", (long)tv->tv_sec);
+        if (sampleClock() != nullptr) {
+            sampleClock()->onTimeSync(tv);
+        }
     }
 };
 
@@ -4,33 +4,105 @@
 #include <ArduinoOTA.h>
 #include <Arduino.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Core of the OTA task. The Arduino loop runs on core 1, WiFi and lwIP on core 0.
+#ifndef OTA_TASK_CORE
+#define OTA_TASK_CORE 0
+#endif
+
+#ifndef OTA_TASK_PRIORITY
+#define OTA_TASK_PRIORITY 1
+#endif
+
+#define OTA_TASK_STACK_SIZE 8192
+
+// Interval in ms in which the OTA task polls for an update.
+#ifndef OTA_POLL_INTERVAL
+#define OTA_POLL_INTERVAL 100
+#endif
+
+// While an image is received, the OTA task pauses OTA_YIELD_MS after every OTA_YIELD_BYTES written. Flash writes
+// disable the cache of both cores, so the pauses let the loop catch up between the sectors.
+#ifndef OTA_YIELD_BYTES
+#define OTA_YIELD_BYTES 4096
+#endif
+
+#ifndef OTA_YIELD_MS
+#define OTA_YIELD_MS 2
+#endif
+
+// Time in ms the restart after an update waits for the backlog to be uploaded.
+#ifndef OTA_DRAIN_TIMEOUT
+#define OTA_DRAIN_TIMEOUT 60000
+#endif
+
+// Counters of the OTA updates. Kept across the restart into the new firmware.
+struct OtaStats {
+    uint32_t updates;       // Successfully received images
+    uint32_t failures;
+    uint32_t lastBytes;     // Bytes received for the last update (image or patch)
+    uint32_t lastImageBytes;  // Size of the image written
+    uint32_t lastMs;        // Transfer time of the last update
+    uint32_t lastBytesPerSec;
+};
+
+struct OtaStatsRecord {
+    uint32_t magic;
+    OtaStats stats;
+};
+
+static RTC_NOINIT_ATTR OtaStatsRecord otaStatsRecord;
+
 class OTAHandler {
 public:
-    // Initializes OTA functionality with the given hostname.
-    void setup(const char* hostname) {
+    OTAHandler() {
+        if (otaStatsRecord.magic == kMagic) {
+            stats = otaStatsRecord.stats;
+        }
+    }
+
+    // Initializes OTA functionality with the given hostname. By default the updates are received by a task of
+    // their own, so the loop keeps sampling while an image is flashed. Without ownTask loop() must be called; it
+    // then blocks for the whole transfer.
+    void setup(const char* hostname, bool ownTask = true) {
         // Set the OTA hostname.
         ArduinoOTA.setHostname(hostname);
-        
+
         // Optionally, set an OTA password for authentication.
         // ArduinoOTA.setPassword("your_password");
 
         // Callback when OTA update starts.
-        ArduinoOTA.onStart([]() {
+        ArduinoOTA.onStart([this]() {
             Serial.println("OTA Update starting.");
+            yieldedAt = 0;
+            received = 0;
+            beginUpdate();
         });
 
-        // Callback when OTA update ends.
-        ArduinoOTA.onEnd([]() {
-            Serial.println("OTA Update finished.");
+        // Callback when OTA update ends. The restart is left to the owner, see requestRestart().
+        ArduinoOTA.setRebootOnSuccess(false);
+        ArduinoOTA.onEnd([this]() {
+            endUpdate(true, received, received);
+            requestRestart();
         });
 
-        // Callback to report OTA progress.
-        ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-            Serial.printf("OTA Progress: %u%%\r", (progress * 100) / total);
+        // Callback to report OTA progress. Called after each received packet was written.
+        ArduinoOTA.onProgress([this](unsigned int progress, unsigned int total) {
+            received = progress;
+            if (progress - yieldedAt >= OTA_YIELD_BYTES) {
+                yieldedAt = progress;
+                Serial.printf("OTA Progress: %u%%\r", (progress * 100) / total);
+                if (taskHandle != nullptr) {
+                    vTaskDelay(pdMS_TO_TICKS(OTA_YIELD_MS));
+                }
+            }
         });
 
         // Callback for OTA errors.
-        ArduinoOTA.onError([](ota_error_t error) {
+        ArduinoOTA.onError([this](ota_error_t error) {
+            endUpdate(false, received, 0);
             Serial.printf("OTA Error [%u]: ", error);
             if (error == OTA_AUTH_ERROR) Serial.println("Authentication failed");
             else if (error == OTA_BEGIN_ERROR) Serial.println("Begin failed");
@@ -41,12 +113,88 @@ public:
 
         // Start the OTA service.
         ArduinoOTA.begin();
+        started = true;
+        if (ownTask) {
+            xTaskCreatePinnedToCore(OTAHandler::taskMain, "ota", OTA_TASK_STACK_SIZE, this, OTA_TASK_PRIORITY,
+                                    &taskHandle, OTA_TASK_CORE);
+        }
         Serial.println("OTA is ready");
     }
 
-    // Must be called in the main loop to handle OTA updates.
+    // Handles OTA updates from the calling task if setup() was called without ownTask. Does nothing otherwise.
     void loop() {
-        ArduinoOTA.handle();
+        if (started && taskHandle == nullptr) {
+            ArduinoOTA.handle();
+        }
+    }
+
+    // Marks the start of an update, also for updates that arrive by other means (see patch_server.h).
+    void beginUpdate() {
+        startMs = millis();
+        updating = true;
+    }
+
+    // Records the end of an update: bytes received and the size of the image written.
+    void endUpdate(bool ok, uint32_t bytes, uint32_t imageBytes) {
+        uint32_t duration = millis() - startMs;
+        if (ok) {
+            stats.updates++;
+            stats.lastBytes = bytes;
+            stats.lastImageBytes = imageBytes;
+            stats.lastMs = duration;
+            stats.lastBytesPerSec = duration > 0 ? (uint64_t)bytes * 1000 / duration : 0;
+            Serial.printf("OTA Update finished: %u bytes in %u ms, image %u bytes.\n", bytes, duration, imageBytes);
+        } else {
+            stats.failures++;
+        }
+        updating = false;
+        otaStatsRecord.stats = stats;
+        otaStatsRecord.magic = kMagic;
+    }
+
+    // Asks for the restart into the new image once it is bootable. The owner does it when isRestartDue() says so:
+    // the new image starts with an empty ring buffer, so the backlog is uploaded first.
+    void requestRestart() {
+        restartRequestedAt = millis();
+        restartRequested = true;
+    }
+
+    bool isRestartRequested() const {
+        return restartRequested;
+    }
+
+    // Returns true if a restart was requested and the backlog is drained or OTA_DRAIN_TIMEOUT has passed.
+    bool isRestartDue(bool drained) const {
+        return restartRequested && (drained || millis() - restartRequestedAt >= OTA_DRAIN_TIMEOUT);
+    }
+
+    // Returns true while an image is received.
+    bool isUpdating() const {
+        return updating;
+    }
+
+    const OtaStats& getStats() const {
+        return stats;
+    }
+
+private:
+    static const uint32_t kMagic = 0x4f544153;  // "OTAS"
+
+    bool started = false;
+    TaskHandle_t taskHandle = nullptr;
+    volatile bool updating = false;
+    volatile bool restartRequested = false;
+    uint32_t restartRequestedAt = 0;
+    uint32_t startMs = 0;
+    uint32_t yieldedAt = 0;
+    uint32_t received = 0;
+    OtaStats stats = {};
+
+    static void taskMain(void* param) {
+        for (;;) {
+            ArduinoOTA.handle();
+            vTaskDelay(pdMS_TO_TICKS(OTA_POLL_INTERVAL));
+        }
     }
 };
 
@@ -0,0 +1,176 @@
+#ifndef PATCH_SERVER_H
+#define PATCH_SERVER_H
+
+#include <Arduino.h>
+#include <WebServer.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+
+#include "delta_patch.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "log_ring.h"
+#include "ota.h"
+
+// The running app partition as the source of a patch, the next OTA partition as the target.
+class EspPartitionFlash {
+ public:
+  // Looks up the partitions. Must be called before a patch is applied.
+  bool open() {
+    source = esp_ota_get_running_partition();
+    target = esp_ota_get_next_update_partition(nullptr);
+    return source != nullptr && target != nullptr;
+  }
+
+  bool begin(const PatchHeader &header) {
+    if (header.targetSize > target->size) {
+      return false;
+    }
+    // The sectors are erased as the image is written, not all up front
+    active = esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &handle) == ESP_OK;
+    return active;
+  }
+
+  bool readSource(uint32_t offset, uint8_t *data, size_t len) {
+    return offset + len <= source->size && esp_partition_read(source, offset, data, len) == ESP_OK;
+  }
+
+  bool readTarget(uint32_t offset, uint8_t *data, size_t len) {
+    return esp_partition_read(target, offset, data, len) == ESP_OK;
+  }
+
+  bool writeTarget(const uint8_t *data, size_t len) {
+    bool ok = esp_ota_write(handle, data, len) == ESP_OK;
+    // Flash writes disable the cache of both cores: let the loop catch up between the sectors
+    vTaskDelay(pdMS_TO_TICKS(OTA_YIELD_MS));
+    return ok;
+  }
+
+  // Validates the image and boots it on the next restart.
+  bool end() {
+    active = false;
+    return esp_ota_end(handle) == ESP_OK && esp_ota_set_boot_partition(target) == ESP_OK;
+  }
+
+  void abort() {
+    if (active) {
+      esp_ota_abort(handle);
+      active = false;
+    }
+  }
+
+ private:
+  const esp_partition_t *source = nullptr;
+  const esp_partition_t *target = nullptr;
+  esp_ota_handle_t handle = 0;
+  bool active = false;
+};
+
+// PatchServer receives firmware patches and compressed images made by tools/ota_patch.cpp:
+//
+//   curl -H "X-API-Token: 1234567890" -F "patch=@fix.patch" http://SolarCurrentLogger:8080/api/v1/ota
+//
+// The upload is applied while it streams in, straight into the inactive OTA partition; neither the patch nor the
+// image is held in memory. The running image is verified against the hash in the patch before anything is written
+// and the result against the target hash before it is made bootable, then the logger restarts into it once the
+// backlog is uploaded (see OTAHandler::requestRestart()). A patch for another firmware than the running one is
+// rejected with 409. Like the pull server, it runs in its own task.
+class PatchServer {
+ public:
+  PatchServer(OTAHandler &ota, uint16_t port) : ota(ota), server(port), patcher(flash) {}
+
+  // Sets the API token expected in the X-API-Token header. Without a token every upload is accepted.
+  void setApiToken(const String &token) { apiToken = token; }
+
+  // Starts the HTTP server in its own task.
+  void setup() {
+    static const char *headers[] = {"X-API-Token"};
+    server.collectHeaders(headers, 1);
+    server.on(
+        "/api/v1/ota", HTTP_POST, [this]() { this->handleDone(); }, [this]() { this->handleUpload(); });
+    server.onNotFound([this]() { server.send(404, "text/plain", "Not found"); });
+    server.begin();
+
+    if (xTaskCreatePinnedToCore(PatchServer::taskMain, "patch", 4096, this, 1, &task, OTA_TASK_CORE) != pdPASS) {
+      Serial.println("Error: Failed to create patch server task.");
+      return;
+    }
+    Serial.println("Patch server is ready");
+  }
+
+ private:
+  OTAHandler &ota;
+  WebServer server;
+  TaskHandle_t task = nullptr;
+  String apiToken;
+  EspPartitionFlash flash;
+  DeltaPatcher<EspPartitionFlash> patcher;
+  bool authorized = false;
+  PatchError result = PATCH_OK;
+
+  static void taskMain(void *param) {
+    PatchServer *self = static_cast<PatchServer *>(param);
+    for (;;) {
+      self->server.handleClient();
+      vTaskDelay(pdMS_TO_TICKS(5));
+    }
+  }
+
+  // Called for each chunk of the upload.
+  void handleUpload() {
+    HTTPUpload &upload = server.upload();
+    switch (upload.status) {
+      case UPLOAD_FILE_START:
+        authorized = apiToken.length() == 0 || server.header("X-API-Token") == apiToken;
+        if (!authorized) {
+          return;
+        }
+        LOG_INFO("Patch upload started.");
+        patcher.reset();
+        ota.beginUpdate();
+        result = flash.open() ? PATCH_OK : PATCH_FLASH_ERROR;
+        break;
+      case UPLOAD_FILE_WRITE:
+        if (authorized && result == PATCH_OK) {
+          result = patcher.feed(upload.buf, upload.currentSize);
+        }
+        break;
+      case UPLOAD_FILE_END:
+        if (authorized && result == PATCH_OK) {
+          result = patcher.finish();
+        }
+        break;
+      case UPLOAD_FILE_ABORTED:
+        if (authorized) {
+          patcher.reset();
+          result = PATCH_INCOMPLETE;
+        }
+        break;
+    }
+  }
+
+  // Called once the request has been received.
+  void handleDone() {
+    if (!authorized) {
+      server.send(403, "application/json", "{\"error\":\"Invalid API token\"}");
+      return;
+    }
+    ota.endUpdate(result == PATCH_OK, patcher.getReceived(), patcher.getWritten());
+    char response[96];
+    if (result != PATCH_OK) {
+      LOG_WARN("Patch failed: %s after %u bytes.", patchErrorName(result), patcher.getReceived());
+      snprintf(response, sizeof(response), "{\"error\":\"%s\"}", patchErrorName(result));
+      server.send(result == PATCH_SOURCE_MISMATCH ? 409 : (result == PATCH_FLASH_ERROR ? 500 : 400),
+                  "application/json", response);
+      return;
+    }
+    snprintf(response, sizeof(response), "{\"received\":%u,\"written\":%u,\"ms\":%u}", patcher.getReceived(),
+             patcher.getWritten(), ota.getStats().lastMs);
+    server.send(200, "application/json", response);
+    LOG_INFO("Patch applied: %u bytes received, %u bytes written. Restarting after the upload of the backlog.",
+             patcher.getReceived(), patcher.getWritten());
+    ota.requestRestart();
+  }
+};
+
+#endif  // PATCH_SERVER_H
@@ -0,0 +1,248 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_sleep.h>
+#include <sys/time.h>
+
+#include "log_ring.h"
+#include "ringbuffer.h"
+
+// Power modes
+#define POWER_MODE_ALWAYS_ON 0    // WiFi associated all the time, samples sent every SEND_INTERVAL
+#define POWER_MODE_LIGHT_SLEEP 1  // CPU light-sleeps between samples, WiFi only on for burst uploads
+#define POWER_MODE_DEEP_SLEEP 2   // Deep sleep between samples, samples kept in RTC slow memory
+
+#ifndef POWER_MODE
+#define POWER_MODE POWER_MODE_ALWAYS_ON
+#endif
+
+// Burst uploads of the duty-cycled modes: every UPLOAD_INTERVAL ms or once UPLOAD_FILL_THRESHOLD samples are
+// buffered, WiFi is switched off again after UPLOAD_TIMEOUT ms at the latest.
+#ifndef UPLOAD_INTERVAL
+#define UPLOAD_INTERVAL 900000
+#endif
+
+#ifndef UPLOAD_FILL_THRESHOLD
+#define UPLOAD_FILL_THRESHOLD 200
+#endif
+
+#ifndef UPLOAD_TIMEOUT
+#define UPLOAD_TIMEOUT 30000
+#endif
+
+// Samples kept in RTC slow memory across deep sleep (16 bytes each, RTC slow memory has 8 KB).
+#ifndef RTC_BUFFER_SIZE
+#define RTC_BUFFER_SIZE 256
+#endif
+
+// Shortest deep sleep in ms. A sample slot closer than this is skipped.
+#ifndef DEEP_SLEEP_MIN_MS
+#define DEEP_SLEEP_MIN_MS 20
+#endif
+
+// State surviving deep sleep.
+struct RtcPowerState {
+  uint32_t magic;
+  Measurement samples[RTC_BUFFER_SIZE];
+  int sampleCount;
+  int64_t lastUploadMs;
+  int64_t sampleDueMs;  // Wall clock of the current sample slot, the deep sleep schedule
+  // Instrumentation, per hour
+  int64_t hourStartMs;
+  uint32_t radioOnMs;
+  uint32_t wakes;
+  uint32_t lastHourRadioOnMs;
+  uint32_t lastHourWakes;
+};
+
+static RTC_DATA_ATTR RtcPowerState rtcPowerState;
+
+// PowerManager switches the radio on for burst uploads only and puts the CPU to sleep between samples.
+// It also counts radio-on time and wakes per hour.
+class PowerManager {
+ public:
+  static const uint32_t kMagic = 0x50574D31;  // "PWM1"
+
+  PowerManager(int mode, unsigned long uploadInterval, int uploadFillThreshold, unsigned long uploadTimeout)
+      : mode(mode),
+        uploadInterval(uploadInterval),
+        uploadFillThreshold(uploadFillThreshold),
+        uploadTimeout(uploadTimeout),
+        radioOn(false),
+        radioOnSince(0) {}
+
+  // Initializes the RTC state after a power-on reset. Must be called first in setup().
+  void begin() {
+    if (rtcPowerState.magic != kMagic || esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UNDEFINED) {
+      memset(&rtcPowerState, 0, sizeof(rtcPowerState));
+      rtcPowerState.magic = kMagic;
+      rtcPowerState.lastUploadMs = nowMs();
+      rtcPowerState.sampleDueMs = nowMs();
+      rtcPowerState.hourStartMs = nowMs();
+    }
+  }
+
+  // Returns true if the radio is only switched on for burst uploads.
+  bool isDutyCycled() const { return mode != POWER_MODE_ALWAYS_ON; }
+
+  // Returns true if the device woke up from deep sleep by the timer, i.e. for taking a sample only.
+  bool isSampleWake() const {
+    return mode == POWER_MODE_DEEP_SLEEP && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER;
+  }
+
+  // Keeps a sample in RTC slow memory. If it is full, the oldest sample is dropped.
+  void storeInRtc(const Measurement &m) {
+    if (rtcPowerState.sampleCount == RTC_BUFFER_SIZE) {
+      memmove(&rtcPowerState.samples[0], &rtcPowerState.samples[1], (RTC_BUFFER_SIZE - 1) * sizeof(Measurement));
+      rtcPowerState.sampleCount--;
+    }
+    rtcPowerState.samples[rtcPowerState.sampleCount++] = m;
+  }
+
+  // Adds deltaMs to the timestamp of the samples in RTC slow memory stamped before the given timestamp.
+  void restampRtc(int64_t before, int64_t deltaMs) {
+    for (int i = 0; i < rtcPowerState.sampleCount; i++) {
+      if (rtcPowerState.samples[i].timestamp < before) {
+        rtcPowerState.samples[i].timestamp += deltaMs;
+      }
+    }
+  }
+
+  // Returns the number of samples kept in RTC slow memory.
+  int getRtcCount() const { return rtcPowerState.sampleCount; }
+
+  // Moves the samples kept in RTC slow memory into the ring buffer.
+  template <typename Buffer>
+  void moveRtcTo(Buffer &ringBuffer) {
+    for (int i = 0; i < rtcPowerState.sampleCount; i++) {
+      ringBuffer.addMeasurement(rtcPowerState.samples[i]);
+    }
+    rtcPowerState.sampleCount = 0;
+  }
+
+  // Moves the unsent samples of the ring buffer into RTC slow memory (the newest RTC_BUFFER_SIZE).
+  template <typename Buffer>
+  void moveToRtc(Buffer &ringBuffer) {
+    Measurement window[16];
+    int excess = ringBuffer.getCount() - RTC_BUFFER_SIZE;
+    while (excess > 0) {
+      int count = ringBuffer.getChunk(window, excess < 16 ? excess : 16);
+      excess -= ringBuffer.removeChunk(window, count);
+    }
+    rtcPowerState.sampleCount = ringBuffer.getChunk(rtcPowerState.samples, RTC_BUFFER_SIZE);
+  }
+
+  // Returns true if a burst upload is due, either by interval or by fill level.
+  bool isUploadDue(int bufferCount) const {
+    return nowMs() - rtcPowerState.lastUploadMs >= (int64_t)uploadInterval || bufferCount >= uploadFillThreshold;
+  }
+
+  // Switches WiFi on for a burst upload. An existing connection is used as it is.
+  void startUpload(const char *ssid, const char *password) {
+    if (radioOn) {
+      return;
+    }
+    LOG_INFO("Power: radio on for upload.");
+    radioOn = true;
+    radioOnSince = millis();
+    if (WiFi.status() != WL_CONNECTED) {
+      WiFi.mode(WIFI_STA);
+      WiFi.begin(ssid, password);
+    }
+  }
+
+  // Returns true while WiFi is switched on for an upload.
+  bool isRadioOn() const { return radioOn; }
+
+  // Returns true if the upload did not finish within the upload timeout.
+  bool isUploadTimedOut() const { return radioOn && millis() - radioOnSince >= uploadTimeout; }
+
+  // Switches WiFi off after a burst upload. A successful upload restarts the upload interval.
+  void finishUpload(bool success) {
+    if (!radioOn) {
+      return;
+    }
+    if (success) {
+      rtcPowerState.lastUploadMs = nowMs();
+    }
+    WiFi.disconnect(true);
+    WiFi.mode(WIFI_OFF);
+    radioOn = false;
+    rtcPowerState.radioOnMs += millis() - radioOnSince;
+    rollHour();
+    LOG_INFO("Power: radio off, upload %s.", success ? "finished" : "failed");
+  }
+
+  // Light-sleeps until the given millis() value. Does nothing while the radio is on.
+  void lightSleepUntil(unsigned long wakeAt) {
+    long remaining = (long)(wakeAt - millis());
+    if (radioOn || remaining <= 0) {
+      return;
+    }
+    Serial.flush();
+    esp_sleep_enable_timer_wakeup((uint64_t)remaining * 1000ULL);
+    esp_light_sleep_start();
+    countWake();
+  }
+
+  // Deep-sleeps until the next sample slot. Does not return.
+  //
+  // The slots are kept on the RTC wall clock, which runs on across deep sleep (millis() restarts at every wake).
+  // Slots closer than DEEP_SLEEP_MIN_MS are skipped, e.g. after an upload. A clock step by the time sync forward
+  // skips to the next slot as well, a step backward restarts the schedule.
+  void deepSleep(unsigned long interval) {
+    countWake();
+    int64_t now = nowMs();
+    int64_t next = rtcPowerState.sampleDueMs + (int64_t)interval;
+    if (next - now > (int64_t)interval) {
+      next = now + interval;
+    } else if (next - now < DEEP_SLEEP_MIN_MS) {
+      next += (now + DEEP_SLEEP_MIN_MS - next + (int64_t)interval - 1) / (int64_t)interval * (int64_t)interval;
+    }
+    rtcPowerState.sampleDueMs = next;
+    Serial.flush();
+    esp_deep_sleep((uint64_t)(next - now) * 1000ULL);
+  }
+
+  // Returns the radio-on time of the last complete hour in ms.
+  uint32_t getRadioOnMsPerHour() const { return rtcPowerState.lastHourRadioOnMs; }
+
+  // Returns the number of wakes of the last complete hour.
+  uint32_t getWakesPerHour() const { return rtcPowerState.lastHourWakes; }
+
+ private:
+  int mode;
+  unsigned long uploadInterval;
+  int uploadFillThreshold;
+  unsigned long uploadTimeout;
+  bool radioOn;
+  unsigned long radioOnSince;
+
+  // Wall clock in ms, kept across deep sleep by the RTC.
+  static int64_t nowMs() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (int64_t)tv.tv_sec * 1000LL + (int64_t)tv.tv_usec / 1000LL;
+  }
+
+  void countWake() {
+    rtcPowerState.wakes++;
+    rollHour();
+  }
+
+  // Publishes the counters of the current hour once it is complete.
+  void rollHour() {
+    int64_t now = nowMs();
+    if (now - rtcPowerState.hourStartMs >= 3600000LL || now < rtcPowerState.hourStartMs) {
+      rtcPowerState.lastHourRadioOnMs = rtcPowerState.radioOnMs;
+      rtcPowerState.lastHourWakes = rtcPowerState.wakes;
+      rtcPowerState.radioOnMs = 0;
+      rtcPowerState.wakes = 0;
+      rtcPowerState.hourStartMs = now;
+    }
+  }
+};
+
+#endif  // POWER_MANAGER_H
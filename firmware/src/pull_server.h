@@ -0,0 +1,135 @@
+#ifndef PULL_SERVER_H
+#define PULL_SERVER_H
+
+#include <Arduino.h>
+#include <WebServer.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "fixed_point.h"
+#include "ringbuffer.h"
+
+// Number of measurements copied out of the ring buffer per chunk.
+#define PULL_WINDOW_SIZE 32
+
+// Compact binary layout of a measurement: little endian, 12 bytes per record.
+struct __attribute__((packed)) BinaryMeasurement {
+  int64_t timestamp;  // ms since epoch
+  float value;        // mA
+};
+
+// PullServer serves the buffered history over HTTP, e.g. for a laptop on site while the upstream server is down.
+//
+//   GET /api/v1/history?from=<ms>&to=<ms>&format=json|bin
+//
+// The response is streamed with chunked transfer encoding directly from the ring buffer, PULL_WINDOW_SIZE records at a
+// time, so memory use is constant regardless of the range. The ring buffer mutex is only held while a window is
+// copied, and the server runs in its own low priority task, so the sampling path is never blocked by a slow client.
+template <typename Buffer>
+class PullServer {
+ public:
+  PullServer(Buffer &ringBuffer, uint16_t port = 80) : ringBuffer(ringBuffer), server(port) {}
+
+  // Sets the API token expected in the X-API-Token header. Without a token every request is accepted.
+  void setApiToken(const String &token) { apiToken = token; }
+
+  // Starts the HTTP server in its own task.
+  void setup() {
+    static const char *headers[] = {"X-API-Token"};
+    server.collectHeaders(headers, 1);
+    server.on("/api/v1/history", HTTP_GET, [this]() { this->handleHistory(); });
+    server.onNotFound([this]() { server.send(404, "text/plain", "Not found"); });
+    server.begin();
+
+    if (xTaskCreatePinnedToCore(PullServer::taskMain, "pull", 4096, this, 1, &task, 0) != pdPASS) {
+      Serial.println("Error: Failed to create pull server task.");
+      return;
+    }
+    Serial.println("Pull server is ready");
+  }
+
+ private:
+  Buffer &ringBuffer;
+  WebServer server;
+  TaskHandle_t task = nullptr;
+  String apiToken;
+
+  Measurement window[PULL_WINDOW_SIZE];
+  // A JSON record and its separator per measurement.
+  char chunk[PULL_WINDOW_SIZE * MEASUREMENT_JSON_SIZE];
+
+  static void taskMain(void *param) {
+    PullServer *self = static_cast<PullServer *>(param);
+    for (;;) {
+      self->server.handleClient();
+      vTaskDelay(pdMS_TO_TICKS(5));
+    }
+  }
+
+  void handleHistory() {
+    if (apiToken.length() > 0 && server.header("X-API-Token") != apiToken) {
+      server.send(403, "application/json", "{\"error\":\"Invalid API token\"}");
+      return;
+    }
+
+    int64_t from = server.hasArg("from") ? strtoll(server.arg("from").c_str(), nullptr, 10) : INT64_MIN;
+    int64_t to = server.hasArg("to") ? strtoll(server.arg("to").c_str(), nullptr, 10) : INT64_MAX;
+    bool binary = server.arg("format") == "bin";
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, binary ? "application/octet-stream" : "application/json", "");
+    if (!binary) {
+      server.sendContent("{\"measurements\":[");
+    }
+
+    // The start is searched by timestamp, the following windows continue by sequence number: records sharing a
+    // timestamp across a window boundary are all sent, and removals meanwhile don't shift the position.
+    uint32_t sequence;
+    int count = ringBuffer.getRange(from, to, window, PULL_WINDOW_SIZE, &sequence);
+    bool first = true;
+    while (count > 0) {
+      size_t len = binary ? toBinary(window, count) : toJson(window, count, first);
+      server.sendContent(chunk, len);
+      first = false;
+      if (count < PULL_WINDOW_SIZE || window[count - 1].timestamp >= to) {
+        break;
+      }
+
+      // Records overwritten meanwhile are skipped, getWindow() moves the sequence to the oldest remaining one.
+      sequence += count;
+      count = ringBuffer.getWindow(sequence, window, PULL_WINDOW_SIZE);
+      while (count > 0 && window[count - 1].timestamp > to) {
+        count--;
+      }
+    }
+
+    if (!binary) {
+      server.sendContent("]}");
+    }
+    // Terminating zero length chunk
+    server.sendContent("");
+  }
+
+  // The binary layout keeps the value in mA as float, as before the integer pipeline.
+  size_t toBinary(const Measurement *measurements, int count) {
+    BinaryMeasurement *out = reinterpret_cast<BinaryMeasurement *>(chunk);
+    for (int i = 0; i < count; i++) {
+      out[i].timestamp = measurements[i].timestamp;
+      out[i].value = measurements[i].value / 1000.0f;
+    }
+    return count * sizeof(BinaryMeasurement);
+  }
+
+  size_t toJson(const Measurement *measurements, int count, bool first) {
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+      if (!first || i > 0) {
+        chunk[len++] = ',';
+      }
+      len += formatMeasurementJson(chunk + len, measurements[i].timestamp, measurements[i].value);
+    }
+    return len;
+  }
+};
+
+#endif  // PULL_SERVER_H
@@ -0,0 +1,100 @@
+#ifndef REPLAY_SENSOR_H
+#define REPLAY_SENSOR_H
+
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sensor.h"
+
+// A trace sample. Also the binary trace format: 8 bytes per sample, little endian.
+struct __attribute__((packed)) TraceSample {
+  uint32_t offsetMs;  // Since the first sample
+  float value;        // mA
+};
+
+// ReplaySensor plays back a recorded trace with its original timing: each reading returns the last sample whose
+// offset is not after the elapsed time (times speed). The trace is not copied and must outlive the sensor.
+class ReplaySensor : public Sensor {
+ public:
+  ReplaySensor(const TraceSample *samples, size_t count, float speed = 1.0f, bool loop = true)
+      : samples(samples), count(count), speed(speed), loop(loop), timeSource(sensorMillis), start(0), index(0) {}
+
+  // Parses a CSV trace with lines "time_ms,value_ma". The time may be an offset or an epoch timestamp, the first
+  // sample is mapped to offset 0. Empty lines, comments (#) and a header line are skipped.
+  // Returns the number of samples written to out.
+  static size_t parseCsv(const char *csv, TraceSample *out, size_t maxCount) {
+    size_t n = 0;
+    long long first = 0;
+    const char *p = csv;
+    while (*p != '\0' && n < maxCount) {
+      const char *end = strchr(p, '\n');
+      if (end == nullptr) {
+        end = p + strlen(p);
+      }
+      char *next;
+      long long time = strtoll(p, &next, 10);
+      if (next != p && *next == ',') {
+        if (n == 0) {
+          first = time;
+        }
+        out[n].offsetMs = (uint32_t)(time - first);
+        out[n].value = strtof(next + 1, nullptr);
+        n++;
+      }
+      p = *end == '\0' ? end : end + 1;
+    }
+    return n;
+  }
+
+  // Copies a binary trace into out. Returns the number of samples.
+  static size_t parseBinary(const uint8_t *data, size_t length, TraceSample *out, size_t maxCount) {
+    size_t n = length / sizeof(TraceSample);
+    if (n > maxCount) {
+      n = maxCount;
+    }
+    memcpy(out, data, n * sizeof(TraceSample));
+    return n;
+  }
+
+  // Sets the time base. Must be called before setup().
+  void setTimeSource(SensorTimeSource source) { timeSource = source; }
+
+  void setup() override {
+    start = timeSource();
+    index = 0;
+  }
+
+  int32_t getCurrentInUa() override {
+    if (count == 0) {
+      return 0;
+    }
+    uint64_t elapsed = (uint64_t)((timeSource() - start) * speed);
+    uint64_t duration = samples[count - 1].offsetMs;
+    if (loop && duration > 0 && elapsed > duration) {
+      elapsed %= duration;
+    }
+    if (elapsed < samples[index].offsetMs) {
+      // Wrapped around.
+      index = 0;
+    }
+    while (index + 1 < count && samples[index + 1].offsetMs <= elapsed) {
+      index++;
+    }
+    return (int32_t)lroundf(samples[index].value * 1000.0f);
+  }
+
+  // Returns true once a trace played without loop has reached its last sample.
+  bool isFinished() const { return !loop && index + 1 >= count; }
+
+ private:
+  const TraceSample *samples;
+  size_t count;
+  float speed;
+  bool loop;
+  SensorTimeSource timeSource;
+  uint64_t start;
+  size_t index;
+};
+
+#endif  // REPLAY_SENSOR_H
@@ -2,102 +2,492 @@
 #define RINGBUFFER_H
 
 #include <Arduino.h>
-#include <math.h> // for fabs
+#include <esp_heap_caps.h>
+#include <limits.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Number of records kept in internal RAM before they are moved into the (possibly external) store.
+#ifndef RING_BUFFER_STAGING_SIZE
+#define RING_BUFFER_STAGING_SIZE 16
+#endif
+
+// Share (in percent) of the free memory used for the store if the capacity is sized automatically.
+#ifndef RING_BUFFER_AUTO_SHARE
+#define RING_BUFFER_AUTO_SHARE 75
+#endif
+
+// Free internal RAM left untouched by automatic sizing (WiFi, TLS, JSON, ...).
+#ifndef RING_BUFFER_INTERNAL_RESERVE
+#define RING_BUFFER_INTERNAL_RESERVE (96 * 1024)
+#endif
 
 // Structure to hold a single measurement.
 struct Measurement {
-    float value;
+    int32_t value;      // µA, see fixed_point.h
     int64_t timestamp;
 };
 
+inline bool operator==(const Measurement &a, const Measurement &b) {
+    return a.timestamp == b.timestamp && a.value == b.value;
+}
+
+// Checksum term of a record of a persisted store, see RingBuffer::persist(). The terms of all slots are added up, so
+// a write changes the sum by the difference of two terms. Records with padding need an overload like Measurement.
+template <typename Record>
+inline uint32_t recordChecksum(const Record &r) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&r);
+    uint32_t sum = 0;
+    for (size_t i = 0; i < sizeof(Record); i++) {
+        sum = sum * 31 + bytes[i];
+    }
+    return sum;
+}
+
+inline uint32_t recordChecksum(const Measurement &m) {
+    return (uint32_t)m.value * 0x9E3779B1u + (uint32_t)m.timestamp * 0x85EBCA77u +
+           (uint32_t)((uint64_t)m.timestamp >> 32) * 0xC2B2AE3Du;
+}
+
+// Header of a store kept across warm resets, see RingBuffer::persist().
+struct RingBufferState {
+    uint32_t magic;
+    uint32_t image;     // Firmware image that wrote the store, see RingBuffer::persist()
+    uint32_t capacity;
+    uint32_t recordSize;
+    int32_t headIndex;
+    int32_t count;
+    uint32_t headSequence;
+    uint32_t storeSum;  // Sum of recordChecksum() over all slots of the store, used or not
+    uint32_t checksum;  // Of the members above
+};
+
+// Ring buffer of Records ordered by their timestamp member.
+//
+// Capacity > 0: the store is a statically placed array of exactly Capacity records handed to the constructor, so it
+// can be put into a chosen memory region. Power of two capacities use mask arithmetic for the index steps.
+// Capacity == 0: the store is allocated by begin() (PSRAM preferred) and sized from the memory available at boot.
+//
+// A static store in memory that is not cleared on a warm reset can be kept across it, see persist().
+template <size_t Capacity, typename Record = Measurement>
 class RingBuffer {
 public:
-    // Constructor: Initializes the ring buffer with the given capacity and creates the mutex.
-    RingBuffer(int capacity)
-      : capacity(capacity), headIndex(0), countMeasurements(0) {
-        buffer = new Measurement[capacity];
-        ringBufferMutex = xSemaphoreCreateMutex();
-        if (ringBufferMutex == NULL) {
-            Serial.println("Error: Failed to create ring buffer mutex.");
-        }
+    static_assert(Capacity <= INT_MAX / 2, "RingBuffer capacity too large");
+
+    static constexpr bool kStatic = Capacity > 0;
+    static constexpr bool kPowerOfTwo = kStatic && (Capacity & (Capacity - 1)) == 0;
+
+    // Constructor for a static store of Capacity records.
+    explicit RingBuffer(Record *storage)
+      : buffer(storage), capacity(Capacity), headIndex(0), countMeasurements(0), headSequence(0), state(nullptr),
+        stagingCount(0), inPsram(false) {
+        static_assert(kStatic, "A static store requires Capacity > 0");
+        createMutex();
     }
-    
-    // Destructor: Deletes the allocated buffer and the mutex.
+
+    // Constructor for a store allocated by begin().
+    RingBuffer()
+      : buffer(nullptr), capacity(0), headIndex(0), countMeasurements(0), headSequence(0), state(nullptr),
+        stagingCount(0), inPsram(false) {
+        static_assert(!kStatic, "A static store must be passed to the constructor");
+        createMutex();
+    }
+
+    // Destructor: Frees an allocated store and deletes the mutex.
     ~RingBuffer() {
-        if (buffer != nullptr) {
-            delete[] buffer;
+        if (!kStatic && buffer != nullptr) {
+            heap_caps_free(buffer);
         }
         if (ringBufferMutex != NULL) {
             vSemaphoreDelete(ringBufferMutex);
         }
     }
-    
-    // Adds a new measurement to the ring buffer.
+
+    // Allocates the store if it is not static. PSRAM is preferred if available, otherwise internal RAM is used.
+    // Must be called once in setup(), after PSRAM has been initialized by the framework.
+    // If the store cannot be allocated, its size is halved until the allocation succeeds.
+    bool begin() {
+        if (kStatic) {
+            Serial.printf("Ring buffer: %d records (static)\n", capacity);
+            return true;
+        }
+
+        uint32_t caps = MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL;
+        size_t available = heap_caps_get_largest_free_block(caps);
+        available = available > RING_BUFFER_INTERNAL_RESERVE ? available - RING_BUFFER_INTERNAL_RESERVE : 0;
+#ifdef CONFIG_SPIRAM_SUPPORT
+        if (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) > 0) {
+            caps = MALLOC_CAP_SPIRAM;
+            available = heap_caps_get_largest_free_block(caps);
+            inPsram = true;
+        }
+#endif
+        size_t autoCapacity = (available / 100 * RING_BUFFER_AUTO_SHARE) / sizeof(Record);
+        capacity = autoCapacity > INT_MAX / 2 ? INT_MAX / 2 : autoCapacity;
+
+        while (capacity > 0) {
+            buffer = static_cast<Record *>(heap_caps_malloc(capacity * sizeof(Record), caps));
+            if (buffer != nullptr) {
+                break;
+            }
+            capacity /= 2;
+        }
+        if (buffer == nullptr) {
+            Serial.println("Error: Failed to allocate ring buffer.");
+            return false;
+        }
+        Serial.printf("Ring buffer: %d records in %s\n", capacity, inPsram ? "PSRAM" : "internal RAM");
+        return true;
+    }
+
+    // Keeps the indices of the store and a checksum over it in state, which is placed in memory that survives a warm
+    // reset together with the store (e.g. both __NOINIT_ATTR). If state is intact and describes this store, its
+    // records are adopted in place; the check is one pass over the store, without copies or flash access. Otherwise
+    // the buffer starts empty. Must be called before the first record is added. Returns the number of records adopted.
+    //
+    // image identifies the running firmware (e.g. a hash of the application). The linker places the store and state
+    // anew in every build, so after an update the old ones are elsewhere or overlap other data: only a store written
+    // by the same image is adopted, the restart after an OTA update starts empty.
+    //
+    // From then on every change of the store updates state, records are written through instead of staged. A reset
+    // in the few instructions between a write and the update of state loses the backlog, it does not adopt a torn one.
+    int persist(RingBufferState *persistent, uint32_t image) {
+        static_assert(kStatic, "Only a static store can be persisted");
+        xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
+        uint32_t sum = 0;
+        for (size_t i = 0; i < Capacity; i++) {
+            sum += recordChecksum(buffer[i]);
+        }
+        const RingBufferState &s = *persistent;
+        bool intact = s.magic == kStateMagic && s.image == image && s.capacity == Capacity && s.recordSize == sizeof(Record) &&
+                      s.checksum == stateChecksum(s) && s.storeSum == sum && s.headIndex >= 0 &&
+                      s.headIndex < (int)Capacity && s.count >= 0 && s.count <= (int)Capacity;
+        headIndex = intact ? s.headIndex : 0;
+        countMeasurements = intact ? s.count : 0;
+        headSequence = intact ? s.headSequence : 0;
+        stagingCount = 0;
+        // The slots outside the records keep their content: the sum stays valid
+        state = persistent;
+        state->image = image;
+        state->storeSum = sum;
+        commit();
+        xSemaphoreGive(ringBufferMutex);
+        return countMeasurements;
+    }
+
+    // Starts a low priority task that moves the staged records into the store every periodMs, so the sampling task
+    // only appends to the staging area. The period must be shorter than the time to fill the staging area. Without
+    // the task the readers move them when they access the store.
+    void startFlushTask(uint32_t periodMs, UBaseType_t priority = 1) {
+        flushPeriodMs = periodMs;
+        if (xTaskCreatePinnedToCore(RingBuffer::flushTaskMain, "buffer", 2048, this, priority, nullptr, 0) != pdPASS) {
+            Serial.println("Error: Failed to create ring buffer flush task.");
+        }
+    }
+
+    // Moves the staged records into the store.
+    void flush() {
+        xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
+        flushStaging();
+        xSemaphoreGive(ringBufferMutex);
+    }
+
+    // Adds a new record to the ring buffer.
+    // The record is staged in internal RAM and moved into the store by the flush task or a reader, so the sampling
+    // path does not touch the store. Only if the staging area is full, i.e. nobody flushed in time, it is moved here.
     // If the buffer is full, the oldest entry is overwritten.
-    void addMeasurement(const Measurement &m) {
+    //
+    // A persisted store is written through instead: a staged record would be lost on a reset. Such a store is a
+    // static array in internal RAM (a static store in PSRAM is cleared at boot), so that costs no PSRAM access.
+    void addMeasurement(const Record &m) {
         xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
-        if (countMeasurements < capacity) {
-            int tail = (headIndex + countMeasurements) % capacity;
-            buffer[tail] = m;
-            countMeasurements++;
-        } else {
-            // Buffer full: Overwrite the oldest entry.
-            buffer[headIndex] = m;
-            headIndex = (headIndex + 1) % capacity;
+        if (stagingCount == RING_BUFFER_STAGING_SIZE) {
+            stagingOverflows++;
+            flushStaging();
+        }
+        staging[stagingCount++] = m;
+        if (state != nullptr) {
+            flushStaging();
         }
         xSemaphoreGive(ringBufferMutex);
     }
-    
-    // Copies up to maxCount measurements from the buffer into dest.
-    // Returns the actual number of measurements copied.
-    int getChunk(Measurement *dest, int maxCount) {
+
+    // Returns how often the sampling task had to move the staged records itself because the staging area was full.
+    uint32_t getStagingOverflows() const {
+        return stagingOverflows;
+    }
+
+    // Copies up to maxCount records from the buffer into dest.
+    // Returns the actual number of records copied.
+    int getChunk(Record *dest, int maxCount) {
         int count = 0;
         xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
+        flushStaging();
         count = (countMeasurements < maxCount) ? countMeasurements : maxCount;
         for (int i = 0; i < count; i++) {
-            int idx = (headIndex + i) % capacity;
-            dest[i] = buffer[idx];
+            dest[i] = buffer[wrap(headIndex + i)];
         }
         xSemaphoreGive(ringBufferMutex);
         return count;
     }
-    
-    // Removes measurements from the buffer that match the ones in dest.
-    // It compares the timestamp and the value (with a tolerance of 0.001).
+
+    // Removes records from the buffer that match (operator==) the ones in dest.
     // Returns the number of removed entries.
-    int removeChunk(const Measurement *dest, int sentCount) {
+    int removeChunk(const Record *dest, int sentCount) {
         int removed = 0;
         xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
+        flushStaging();
         for (int i = 0; i < sentCount && i < countMeasurements; i++) {
-            int idx = (headIndex + i) % capacity;
-            if (buffer[idx].timestamp == dest[i].timestamp &&
-                fabs(buffer[idx].value - dest[i].value) < 0.001) {
+            if (buffer[wrap(headIndex + i)] == dest[i]) {
                 removed++;
             } else {
                 break;
             }
         }
-        headIndex = (headIndex + removed) % capacity;
+        headIndex = wrap(headIndex + removed);
+        countMeasurements -= removed;
+        headSequence += removed;
+        commit();
+        xSemaphoreGive(ringBufferMutex);
+        return removed;
+    }
+
+    // Every record has a sequence number, counting up from 0 for the first record ever added. Streaming readers
+    // keep their position as a sequence number, which stays valid while records are removed or overwritten.
+
+    // Returns the sequence number of the oldest record.
+    uint32_t getHeadSequence() {
+        xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
+        flushStaging();
+        uint32_t sequence = headSequence;
+        xSemaphoreGive(ringBufferMutex);
+        return sequence;
+    }
+
+    // Copies up to maxCount records starting at the given sequence number into dest. If records at the position
+    // have been overwritten meanwhile, sequence is moved forward to the oldest remaining one.
+    // Returns the actual number of records copied.
+    int getWindow(uint32_t &sequence, Record *dest, int maxCount) {
+        int count = 0;
+        xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
+        flushStaging();
+        int offset = (int32_t)(sequence - headSequence);
+        if (offset < 0) {
+            offset = 0;
+            sequence = headSequence;
+        }
+        for (int i = offset; i < countMeasurements && count < maxCount; i++) {
+            dest[count++] = buffer[wrap(headIndex + i)];
+        }
+        xSemaphoreGive(ringBufferMutex);
+        return count;
+    }
+
+    // Removes all records with a sequence number before the given one, e.g. after they were acknowledged.
+    // Returns the number of removed records.
+    int removeUntil(uint32_t sequence) {
+        xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
+        flushStaging();
+        int removed = (int32_t)(sequence - headSequence);
+        if (removed < 0) {
+            removed = 0;
+        }
+        if (removed > countMeasurements) {
+            removed = countMeasurements;
+        }
+        headIndex = wrap(headIndex + removed);
         countMeasurements -= removed;
+        headSequence += removed;
+        commit();
         xSemaphoreGive(ringBufferMutex);
         return removed;
     }
-    
-    // Returns the current number of measurements stored in the buffer.
+
+    // Copies up to maxCount records with fromTimestamp <= timestamp <= toTimestamp into dest,
+    // starting with the oldest match. The start is located by binary search, as the buffer is
+    // ordered by timestamp. If firstSequence is given, it is set to the sequence number of the
+    // oldest match, to continue with getWindow(). Returns the actual number of records copied.
+    int getRange(int64_t fromTimestamp, int64_t toTimestamp, Record *dest, int maxCount,
+                 uint32_t *firstSequence = nullptr) {
+        int count = 0;
+        xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
+        flushStaging();
+        int start = lowerBound(fromTimestamp);
+        if (firstSequence != nullptr) {
+            *firstSequence = headSequence + start;
+        }
+        for (int i = start; i < countMeasurements && count < maxCount; i++) {
+            const Record &m = buffer[wrap(headIndex + i)];
+            if (m.timestamp > toTimestamp) {
+                break;
+            }
+            dest[count++] = m;
+        }
+        xSemaphoreGive(ringBufferMutex);
+        return count;
+    }
+
+    // Adds deltaMs to the timestamp of all records stamped before the given timestamp, e.g. samples taken before
+    // the clock was synchronized. Returns the number of re-stamped records.
+    int restamp(int64_t before, int64_t deltaMs) {
+        int restamped = 0;
+        xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
+        flushStaging();
+        for (int i = 0; i < countMeasurements; i++) {
+            const Record &m = buffer[wrap(headIndex + i)];
+            if (m.timestamp >= before) {
+                // Ordered by timestamp: all following records are newer.
+                break;
+            }
+            Record restampedRecord = m;
+            restampedRecord.timestamp += deltaMs;
+            write(wrap(headIndex + i), restampedRecord);
+            restamped++;
+        }
+        commit();
+        xSemaphoreGive(ringBufferMutex);
+        return restamped;
+    }
+
+    // Returns the current number of records stored in the buffer.
     int getCount() {
         int count;
         xSemaphoreTake(ringBufferMutex, portMAX_DELAY);
-        count = countMeasurements;
+        count = countMeasurements + stagingCount;
+        if (count > capacity) {
+            count = capacity;
+        }
         xSemaphoreGive(ringBufferMutex);
         return count;
     }
-    
+
+    // Returns the capacity of the store (known after begin() if not static).
+    int getCapacity() const {
+        return kStatic ? (int)Capacity : capacity;
+    }
+
+    // Returns true if the store is located in PSRAM.
+    bool isInPsram() const {
+        return inPsram;
+    }
+
 private:
-    Measurement* buffer;
+    Record* buffer;
     int capacity;
     int headIndex;
     int countMeasurements;
+    uint32_t headSequence;  // Sequence number of the record at headIndex
+    RingBufferState *state;  // nullptr unless persisted
     SemaphoreHandle_t ringBufferMutex;
+
+    static const uint32_t kStateMagic = 0x52424632;  // "RBF2"
+
+    // Internal RAM staging area for the write path.
+    Record staging[RING_BUFFER_STAGING_SIZE];
+    int stagingCount;
+    uint32_t stagingOverflows = 0;
+    uint32_t flushPeriodMs = 0;
+    bool inPsram;
+
+    void createMutex() {
+        ringBufferMutex = xSemaphoreCreateMutex();
+        if (ringBufferMutex == NULL) {
+            Serial.println("Error: Failed to create ring buffer mutex.");
+        }
+    }
+
+    static void flushTaskMain(void *param) {
+        RingBuffer *self = static_cast<RingBuffer *>(param);
+        for (;;) {
+            vTaskDelay(pdMS_TO_TICKS(self->flushPeriodMs));
+            self->flush();
+        }
+    }
+
+    // Maps a position in [0, 2 * capacity) onto the store without a division.
+    int wrap(int index) const {
+        if (kPowerOfTwo) {
+            return index & (int)(Capacity - 1);
+        }
+        int c = kStatic ? (int)Capacity : capacity;
+        return index >= c ? index - c : index;
+    }
+
+    // Moves the staged records into the store. Must be called with the mutex held.
+    void flushStaging() {
+        if (buffer == nullptr) {
+            stagingCount = 0;
+            return;
+        }
+        if (stagingCount == 0) {
+            return;
+        }
+        for (int i = 0; i < stagingCount; i++) {
+            if (countMeasurements < capacity) {
+                write(wrap(headIndex + countMeasurements), staging[i]);
+                countMeasurements++;
+            } else {
+                // Buffer full: Overwrite the oldest entry.
+                write(headIndex, staging[i]);
+                headIndex = wrap(headIndex + 1);
+                headSequence++;
+            }
+        }
+        stagingCount = 0;
+        commit();
+    }
+
+    // Writes a record into a slot of the store, keeping the checksum of a persisted store.
+    void write(int slot, const Record &r) {
+        if (state != nullptr) {
+            state->storeSum += recordChecksum(r) - recordChecksum(buffer[slot]);
+        }
+        buffer[slot] = r;
+    }
+
+    // Updates the persisted state after a change of the store. Must be called with the mutex held.
+    void commit() {
+        if (state == nullptr) {
+            return;
+        }
+        state->magic = kStateMagic;
+        state->capacity = Capacity;
+        state->recordSize = sizeof(Record);
+        state->headIndex = headIndex;
+        state->count = countMeasurements;
+        state->headSequence = headSequence;
+        state->checksum = stateChecksum(*state);
+    }
+
+    // FNV-1a over the members of a state before the checksum.
+    static uint32_t stateChecksum(const RingBufferState &s) {
+        const uint32_t words[] = {s.magic, s.image, s.capacity, s.recordSize, (uint32_t)s.headIndex, (uint32_t)s.count,
+                                  s.headSequence, s.storeSum};
+        uint32_t hash = 2166136261u;
+        for (uint32_t w : words) {
+            for (int i = 0; i < 4; i++) {
+                hash = (hash ^ (w >> (8 * i) & 0xFF)) * 16777619u;
+            }
+        }
+        return hash;
+    }
+
+    // Returns the position (relative to headIndex) of the first record with a
+    // timestamp >= the given one. Must be called with the mutex held.
+    int lowerBound(int64_t timestamp) const {
+        int low = 0;
+        int high = countMeasurements;
+        while (low < high) {
+            int mid = low + (high - low) / 2;
+            if (buffer[wrap(headIndex + mid)].timestamp < timestamp) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
 };
 
 #endif // RINGBUFFER_H
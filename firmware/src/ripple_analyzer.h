@@ -0,0 +1,266 @@
+#ifndef RIPPLE_ANALYZER_H
+#define RIPPLE_ANALYZER_H
+
+#include <Arduino.h>
+#include <math.h>
+
+#include "fixed_point.h"
+
+// Samples per capture, a power of two. 512 at 125 µs take 64 ms and resolve 15.6 Hz per bin.
+#ifndef RIPPLE_SAMPLES
+#define RIPPLE_SAMPLES 512
+#endif
+
+// Sample period of a capture in µs. The INA219 converts in 84 µs at 9 bit, a 400 kHz I2C read takes about 70 µs.
+#ifndef RIPPLE_SAMPLE_US
+#define RIPPLE_SAMPLE_US 125
+#endif
+
+// Interval of the captures in ms.
+#ifndef RIPPLE_INTERVAL
+#define RIPPLE_INTERVAL 60000
+#endif
+
+// Strongest spectral peaks reported per capture.
+#ifndef RIPPLE_PEAKS
+#define RIPPLE_PEAKS 3
+#endif
+
+// Peaks below RIPPLE_MIN_UA or below 1/RIPPLE_PEAK_RATIO of the strongest (window side lobes) are not reported.
+#ifndef RIPPLE_MIN_UA
+#define RIPPLE_MIN_UA 500
+#endif
+
+#ifndef RIPPLE_PEAK_RATIO
+#define RIPPLE_PEAK_RATIO 20
+#endif
+
+// Buffer size for RippleRecord::toJson().
+#define RIPPLE_JSON_SIZE (176 + RIPPLE_PEAKS * 28)
+
+struct RipplePeak {
+  int32_t milliHz;
+  int32_t amplitudeUa;  // Of the sine
+};
+
+// Result of one capture.
+struct RippleRecord {
+  int64_t timestamp;
+  uint32_t sampleRateHz;
+  int32_t dcUa;           // Mean
+  int32_t rmsUa;          // Of the ripple, the mean removed
+  int32_t peakToPeakUa;
+  uint8_t peakCount;
+  RipplePeak peaks[RIPPLE_PEAKS];  // Strongest first
+  uint32_t captureUs;
+  uint32_t analyzeUs;
+
+  // Writes the record as compact JSON object, peaks as [Hz, mA] pairs. out must hold RIPPLE_JSON_SIZE bytes.
+  // Returns the length.
+  size_t toJson(char *out) const {
+    size_t n = 0;
+    n += sprintf(out + n, "{\"timestamp\":");
+    n += formatInt64(out + n, timestamp);
+    n += sprintf(out + n, ",\"rate\":%u,\"dc\":", sampleRateHz);
+    n += formatMilli(out + n, dcUa);
+    n += sprintf(out + n, ",\"rms\":");
+    n += formatMilli(out + n, rmsUa);
+    n += sprintf(out + n, ",\"p2p\":");
+    n += formatMilli(out + n, peakToPeakUa);
+    n += sprintf(out + n, ",\"peaks\":[");
+    for (int i = 0; i < peakCount; i++) {
+      n += sprintf(out + n, i == 0 ? "[" : ",[");
+      n += formatMilli(out + n, peaks[i].milliHz);
+      out[n++] = ',';
+      n += formatMilli(out + n, peaks[i].amplitudeUa);
+      out[n++] = ']';
+    }
+    n += sprintf(out + n, "],\"captureUs\":%u,\"analyzeUs\":%u}", captureUs, analyzeUs);
+    return n;
+  }
+};
+
+// RippleAnalyzer finds the ripple on the current in a burst of N samples: mean, RMS and peak to peak of the ripple and
+// the strongest frequencies of a Hann windowed spectrum, interpolated between the bins.
+//
+// The spectrum is a real FFT: the N samples are packed into N/2 complex values, transformed by an iterative radix-2
+// FFT and split into the N/2 + 1 bins of the real signal. Real and imaginary parts are kept in separate arrays, so
+// the butterflies are plain float loops the compiler can vectorize. The twiddle factors are computed once; they also
+// give the window.
+template <size_t N = RIPPLE_SAMPLES>
+class RippleAnalyzer {
+ public:
+  static_assert(N >= 16 && (N & (N - 1)) == 0, "RippleAnalyzer needs a power of two of at least 16 samples");
+
+  static constexpr size_t kBins = N / 2 + 1;
+
+  RippleAnalyzer() {
+    for (size_t k = 0; k < kHalf; k++) {
+      cosTable[k] = cosf(2.0f * (float)M_PI * k / N);
+      sinTable[k] = sinf(2.0f * (float)M_PI * k / N);
+    }
+  }
+
+  // Buffer for the N samples of a capture, µA.
+  int32_t *getSamples() { return samples; }
+
+  // Analyzes the samples, taken spanUs apart from the first to the last.
+  void analyze(uint32_t spanUs, RippleRecord &record) {
+    int64_t sum = 0;
+    int32_t minimum = samples[0];
+    int32_t maximum = samples[0];
+    for (size_t i = 0; i < N; i++) {
+      sum += samples[i];
+      minimum = samples[i] < minimum ? samples[i] : minimum;
+      maximum = samples[i] > maximum ? samples[i] : maximum;
+    }
+    int32_t mean = (int32_t)(sum / (int64_t)N);
+    float squares = 0.0f;
+    for (size_t i = 0; i < kHalf; i++) {
+      float even = (float)(samples[2 * i] - mean);
+      float odd = (float)(samples[2 * i + 1] - mean);
+      squares += even * even + odd * odd;
+      zr[i] = even * window(2 * i);
+      zi[i] = odd * window(2 * i + 1);
+    }
+    transformPacked();
+
+    float rate = spanUs > 0 ? (N - 1) * 1e6f / spanUs : 0.0f;
+    record.sampleRateHz = (uint32_t)lroundf(rate);
+    record.dcUa = mean;
+    record.rmsUa = (int32_t)lroundf(sqrtf(squares / N));
+    record.peakToPeakUa = maximum - minimum;
+    findPeaks(rate, record);
+  }
+
+  // Real FFT of N values without window. Bin k (0..N/2) is available from getRe(k) and getIm(k).
+  void transform(const float *x) {
+    for (size_t i = 0; i < kHalf; i++) {
+      zr[i] = x[2 * i];
+      zi[i] = x[2 * i + 1];
+    }
+    transformPacked();
+  }
+
+  float getRe(size_t k) const { return xr[k]; }
+  float getIm(size_t k) const { return xi[k]; }
+
+ private:
+  static constexpr size_t kHalf = N / 2;
+
+  int32_t samples[N];
+  float zr[kHalf];
+  float zi[kHalf];
+  float xr[kBins];
+  float xi[kBins];
+  float cosTable[kHalf];  // cos(2πk/N)
+  float sinTable[kHalf];
+
+  // Hann window: 0.5 - 0.5 cos(2πn/N), cos(2πn/N) = -cos(2π(n - N/2)/N) for the second half
+  float window(size_t n) const { return n < kHalf ? 0.5f - 0.5f * cosTable[n] : 0.5f + 0.5f * cosTable[n - kHalf]; }
+
+  // FFT of the N/2 complex values in zr/zi, split into the N/2 + 1 bins of the real signal in xr/xi.
+  void transformPacked() {
+    // Bit reversed order
+    for (size_t i = 1, j = 0; i < kHalf; i++) {
+      size_t bit = kHalf >> 1;
+      for (; j & bit; bit >>= 1) {
+        j ^= bit;
+      }
+      j |= bit;
+      if (i < j) {
+        float t = zr[i];
+        zr[i] = zr[j];
+        zr[j] = t;
+        t = zi[i];
+        zi[i] = zi[j];
+        zi[j] = t;
+      }
+    }
+
+    // Radix-2 butterflies, e^(-2πi j/len) = table entry j * N/len
+    for (size_t len = 2; len <= kHalf; len <<= 1) {
+      size_t half = len >> 1;
+      size_t step = N / len;
+      for (size_t i = 0; i < kHalf; i += len) {
+        float *ar = zr + i;
+        float *ai = zi + i;
+        float *br = zr + i + half;
+        float *bi = zi + i + half;
+        for (size_t j = 0; j < half; j++) {
+          float wr = cosTable[j * step];
+          float wi = -sinTable[j * step];
+          float tr = br[j] * wr - bi[j] * wi;
+          float ti = br[j] * wi + bi[j] * wr;
+          br[j] = ar[j] - tr;
+          bi[j] = ai[j] - ti;
+          ar[j] += tr;
+          ai[j] += ti;
+        }
+      }
+    }
+
+    // Split: X[k] = E[k] + e^(-2πi k/N) O[k], with E and O the spectra of the even and odd samples
+    for (size_t k = 0; k <= kHalf; k++) {
+      size_t a = k == kHalf ? 0 : k;
+      size_t b = k == 0 ? 0 : kHalf - k;
+      float er = 0.5f * (zr[a] + zr[b]);
+      float ei = 0.5f * (zi[a] - zi[b]);
+      float odr = 0.5f * (zi[a] + zi[b]);
+      float odi = -0.5f * (zr[a] - zr[b]);
+      float c = k == kHalf ? -1.0f : cosTable[k];
+      float s = k == kHalf ? 0.0f : sinTable[k];
+      xr[k] = er + c * odr + s * odi;
+      xi[k] = ei + c * odi - s * odr;
+    }
+  }
+
+  float magnitude(size_t k) const { return sqrtf(xr[k] * xr[k] + xi[k] * xi[k]); }
+
+  // Local maxima of the spectrum, the strongest first. The offset of the frequency from the bin follows from the
+  // neighbouring bins, exact for a sine under the Hann window; the amplitude is corrected by the main lobe of the
+  // window at that offset, sinc(d) / (1 - d²). The first bins hold the window leakage of the removed mean.
+  void findPeaks(float rate, RippleRecord &record) {
+    // A sine of amplitude A gives N/4 A in its bin with the Hann window
+    const float scale = 4.0f / N;
+    record.peakCount = 0;
+    float below = magnitude(1);
+    float here = magnitude(2);
+    for (size_t k = 2; k + 1 < kBins; k++) {
+      float above = magnitude(k + 1);
+      if (here > below && here >= above) {
+        float delta = 2.0f * (above - below) / (below + 2.0f * here + above);
+        float lobe = 1.0f;
+        if (fabsf(delta) > 1e-4f) {
+          lobe = sinf((float)M_PI * delta) / ((float)M_PI * delta) / (1.0f - delta * delta);
+        }
+        float amplitude = here * scale / lobe;
+        insertPeak(record, {.milliHz = (int32_t)lroundf((k + delta) * rate * 1000.0f / N),
+                            .amplitudeUa = (int32_t)lroundf(amplitude)});
+      }
+      below = here;
+      here = above;
+    }
+
+    // Drop the weak peaks
+    int32_t floor = record.peakCount > 0 ? record.peaks[0].amplitudeUa / RIPPLE_PEAK_RATIO : 0;
+    floor = floor > RIPPLE_MIN_UA ? floor : RIPPLE_MIN_UA;
+    while (record.peakCount > 0 && record.peaks[record.peakCount - 1].amplitudeUa < floor) {
+      record.peakCount--;
+    }
+  }
+
+  static void insertPeak(RippleRecord &record, const RipplePeak &peak) {
+    int i = record.peakCount < RIPPLE_PEAKS ? record.peakCount++ : RIPPLE_PEAKS;
+    for (; i > 0 && record.peaks[i - 1].amplitudeUa < peak.amplitudeUa; i--) {
+      if (i < RIPPLE_PEAKS) {
+        record.peaks[i] = record.peaks[i - 1];
+      }
+    }
+    if (i < RIPPLE_PEAKS) {
+      record.peaks[i] = peak;
+    }
+  }
+};
+
+#endif  // RIPPLE_ANALYZER_H
@@ -0,0 +1,145 @@
+#ifndef SAMPLE_CLOCK_H
+#define SAMPLE_CLOCK_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+
+// Corrections up to this size are slewed, larger ones are stepped.
+#ifndef CLOCK_STEP_THRESHOLD_MS
+#define CLOCK_STEP_THRESHOLD_MS 1000
+#endif
+
+// Maximum slew rate in ppm (µs per s) while a correction is applied.
+#ifndef CLOCK_SLEW_PPM
+#define CLOCK_SLEW_PPM 500
+#endif
+
+// Limit of the drift estimate in ppb.
+#define CLOCK_MAX_DRIFT_PPB 500000LL
+
+// Timestamps before 2020-01-01 are treated as not synchronized.
+#define CLOCK_VALID_EPOCH_MS 1577836800000LL
+
+// Survives deep sleep.
+static RTC_DATA_ATTR bool sampleClockValid = false;
+
+// SampleClock stamps samples with the monotonic esp_timer counter plus a maintained epoch offset and drift estimate.
+//
+// Until the first NTP sync the offset maps the counter onto the system time since power-on, so timestamps stay
+// monotonic (also across deep sleep) but are 1970-based. The first sync steps the offset and reports the correction
+// to the step callback, which re-stamps the buffered samples in bulk. Later syncs are slewed at CLOCK_SLEW_PPM and
+// refine the drift estimate, so the stored timestamps never jump.
+//
+// The syncs arrive in the SNTP (lwIP) task, the step callback runs in the task that stamps and stores the samples,
+// from poll(): a sample stamped before a step is stored before its records are re-stamped, never after.
+class SampleClock {
+ public:
+  // Callback on a stepped correction. deltaMs is to be added to timestamps taken before the correction.
+  typedef void (*StepCallback)(int64_t deltaMs);
+
+  SampleClock()
+      : offsetNs(0), pendingNs(0), driftPpb(0), lastMonoUs(0), lastSyncMonoUs(0), stepMs(0), syncs(0), steps(0) {}
+
+  // Anchors the counter to the system time. Must be called at the beginning of setup().
+  void begin() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    int64_t mono = esp_timer_get_time();
+    int64_t systemUs = (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+    offsetNs = (systemUs - mono) * 1000LL;
+    lastMonoUs = mono;
+    lastSyncMonoUs = mono;
+  }
+
+  // Sets the callback invoked on a stepped correction, see poll().
+  void setStepCallback(StepCallback cb) { stepCallback = cb; }
+
+  // Invokes the step callback for the steps since the last call. Must be called by the task that stamps and stores
+  // the samples, between storing one sample and stamping the next.
+  void poll() {
+    portENTER_CRITICAL(&mux);
+    int64_t deltaMs = stepMs;
+    stepMs = 0;
+    portEXIT_CRITICAL(&mux);
+    if (deltaMs != 0 && stepCallback) {
+      stepCallback(deltaMs);
+    }
+  }
+
+  // Returns true once the clock has been synchronized.
+  bool isValid() const { return sampleClockValid; }
+
+  // Returns the current epoch timestamp in ms.
+  int64_t nowMs() { return nowUs() / 1000LL; }
+
+  // Returns the current epoch timestamp in µs. Applies drift and pending slew.
+  int64_t nowUs() {
+    int64_t mono = esp_timer_get_time();
+    portENTER_CRITICAL(&mux);
+    int64_t elapsed = mono - lastMonoUs;
+    lastMonoUs = mono;
+    offsetNs += elapsed * driftPpb / 1000000LL;
+    if (pendingNs != 0) {
+      int64_t maxStep = elapsed * CLOCK_SLEW_PPM / 1000LL;
+      int64_t step = pendingNs > maxStep ? maxStep : (pendingNs < -maxStep ? -maxStep : pendingNs);
+      offsetNs += step;
+      pendingNs -= step;
+    }
+    int64_t now = mono + offsetNs / 1000LL;
+    portEXIT_CRITICAL(&mux);
+    return now;
+  }
+
+  // Feeds an NTP time. Called from the SNTP sync notification. A step is handed to poll().
+  void onTimeSync(const timeval *tv) {
+    int64_t mono = esp_timer_get_time();
+    int64_t measuredNs = ((int64_t)tv->tv_sec * 1000000LL + tv->tv_usec - mono) * 1000LL;
+
+    nowUs();  // bring offset and slew up to date
+    portENTER_CRITICAL(&mux);
+    int64_t errorNs = measuredNs - (offsetNs + pendingNs);
+    if (!sampleClockValid || llabs(errorNs) > CLOCK_STEP_THRESHOLD_MS * 1000000LL) {
+      stepMs += (measuredNs - offsetNs) / 1000000LL;
+      offsetNs = measuredNs;
+      pendingNs = 0;
+      steps++;
+    } else {
+      pendingNs += errorNs;
+      // The residual error over the sync interval refines the drift estimate (ppb = ns per s).
+      int64_t intervalUs = mono - lastSyncMonoUs;
+      if (intervalUs > 60000000LL) {
+        driftPpb += errorNs * 1000000LL / intervalUs / 2;
+        if (driftPpb > CLOCK_MAX_DRIFT_PPB) driftPpb = CLOCK_MAX_DRIFT_PPB;
+        if (driftPpb < -CLOCK_MAX_DRIFT_PPB) driftPpb = -CLOCK_MAX_DRIFT_PPB;
+      }
+    }
+    sampleClockValid = true;
+    lastSyncMonoUs = mono;
+    syncs++;
+    portEXIT_CRITICAL(&mux);
+  }
+
+  // Returns the drift estimate in ppb.
+  int32_t getDriftPpb() const { return driftPpb; }
+
+  // Returns the number of syncs and of stepped corrections.
+  uint32_t getSyncs() const { return syncs; }
+  uint32_t getSteps() const { return steps; }
+
+ private:
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  int64_t offsetNs;   // epoch - counter
+  int64_t pendingNs;  // correction still to be slewed
+  int64_t driftPpb;
+  int64_t lastMonoUs;
+  int64_t lastSyncMonoUs;
+  int64_t stepMs;  // Steps not yet passed to the callback
+  uint32_t syncs;
+  uint32_t steps;
+  StepCallback stepCallback = nullptr;
+};
+
+#endif  // SAMPLE_CLOCK_H
@@ -0,0 +1,68 @@
+#ifndef SAMPLE_SCHEDULER_H
+#define SAMPLE_SCHEDULER_H
+
+#include <stdint.h>
+
+// SampleScheduler keeps the samples on a fixed grid of the sample interval. If the loop was held up for more than one
+// interval (flash writes of an OTA update, a blocking call), the missed slots are skipped and counted instead of
+// being taken back-to-back afterwards with timestamps that do not match their slots.
+//
+// The gaps between the samples actually taken are tracked, so the sample continuity can be reported.
+class SampleScheduler {
+ public:
+  explicit SampleScheduler(uint32_t intervalMs) : intervalMs(intervalMs) {}
+
+  // Schedules the first sample at now.
+  void begin(uint32_t now) { nextDue = now; }
+
+  // Returns true if a sample is due at now and advances the schedule to the next slot.
+  bool isDue(uint32_t now) {
+    if ((int32_t)(now - nextDue) < 0) {
+      return false;
+    }
+    uint32_t late = now - nextDue;
+    if (late >= intervalMs) {
+      uint32_t skipped = late / intervalMs;
+      missed += skipped;
+      nextDue += skipped * intervalMs;
+    }
+    nextDue += intervalMs;
+
+    if (hasTaken) {
+      uint32_t gap = now - lastTaken;
+      if (gap > maxGapMs) {
+        maxGapMs = gap;
+      }
+    }
+    lastTaken = now;
+    hasTaken = true;
+    taken++;
+    return true;
+  }
+
+  // Returns the time the next sample is due.
+  uint32_t getNextDue() const { return nextDue; }
+
+  // Returns the number of samples taken and of slots skipped.
+  uint32_t getTaken() const { return taken; }
+  uint32_t getMissed() const { return missed; }
+
+  // Returns the longest time between two samples taken.
+  uint32_t getMaxGapMs() const { return maxGapMs; }
+
+  // Clears the statistics, e.g. after the setup phase. The gap to the last sample still counts.
+  void resetStats() {
+    taken = missed = maxGapMs = 0;
+  }
+
+ private:
+  const uint32_t intervalMs;
+  uint32_t nextDue = 0;
+  uint32_t lastTaken = 0;
+  bool hasTaken = false;
+  uint32_t taken = 0;
+  uint32_t missed = 0;
+  uint32_t maxGapMs = 0;
+};
+
+#endif  // SAMPLE_SCHEDULER_H
@@ -2,9 +2,22 @@
 #define SENSOR_H
 
 #include <Arduino.h>
+
+#ifdef ARDUINO_ARCH_ESP32
 #include <Wire.h>
 
 #include "INA219.h"
+#endif
+
+// Shunt resistor of the INA219 board in mΩ.
+#ifndef INA219_SHUNT_MILLIOHM
+#define INA219_SHUNT_MILLIOHM 100
+#endif
+
+// Largest current to measure in mA. The default is the range of the shunt voltage at gain 1 (40 mV) over 100 mΩ.
+#ifndef INA219_MAX_CURRENT_MA
+#define INA219_MAX_CURRENT_MA 400
+#endif
 
 // Abstract base class for sensors.
 class Sensor {
@@ -15,10 +28,21 @@ class Sensor {
   // Initializes the sensor.
   virtual void setup() = 0;
 
-  // Returns the current in mA measured by the sensor.
-  virtual float getCurrentInMa() = 0;
+  // Returns the current in µA measured by the sensor.
+  virtual int32_t getCurrentInUa() = 0;
+
+  // Samples the current in µA into out as fast as the sensor allows, at most one sample every periodUs. Returns the
+  // time from the first to the last sample in µs, 0 if the sensor has no burst mode. See ripple_analyzer.h.
+  virtual uint32_t captureBurst(int32_t *out, size_t n, uint32_t periodUs) { return 0; }
 };
 
+// Time base of the simulated sensors in ms. millis() by default; host drivers substitute a virtual clock to run the
+// pipeline faster than real time.
+typedef uint64_t (*SensorTimeSource)();
+
+inline uint64_t sensorMillis() { return millis(); }
+
+#ifdef ARDUINO_ARCH_ESP32
 // INA219 sensor implementation inheriting from Sensor.
 class INA219Sensor : public Sensor {
  public:
@@ -40,16 +64,54 @@ class INA219Sensor : public Sensor {
     ina.setGain(1);
     ina.setModeShuntContinuous();
     ina.setShuntSamples(7);  // 128 samples
+
+    // The INA219 computes the current itself from the calibration register. The current LSB is chosen as a whole
+    // number of µA, so a reading is converted with one integer multiplication. It must cover the maximum current
+    // with 15 bits and keep the calibration value within 16 bits.
+    const long maxLsbUa = (INA219_MAX_CURRENT_MA * 1000L + 32767) / 32768;
+    const long minLsbUa = (40960000L + 65534L * INA219_SHUNT_MILLIOHM - 1) / (65534L * INA219_SHUNT_MILLIOHM);
+    currentLsbUa = maxLsbUa > minLsbUa ? maxLsbUa : minLsbUa;
+    if (!ina.setMaxCurrentShunt(currentLsbUa * 32768 / 1e6f, INA219_SHUNT_MILLIOHM / 1000.0f)) {
+      Serial.println("INA219 calibration failed!");
+    }
   }
 
-  // Returns the current in mA measured by the INA219 sensor.
-  float getCurrentInMa() override {
-    // The shunt value is divided by 10 to convert it to mA.
-    return ((float)ina.getShuntValue()) / 10.0;
+  // Returns the current in µA computed by the INA219 sensor.
+  int32_t getCurrentInUa() override { return (int16_t)ina.getRegister(INA219_CURRENT) * currentLsbUa; }
+
+  // Bursts at the fastest conversion (9 bit, 84 µs, no averaging) over 400 kHz I2C. The register pointer stays on
+  // the current register, so a sample is a plain 2 byte read. The averaging and the bus clock are restored after.
+  uint32_t captureBurst(int32_t *out, size_t n, uint32_t periodUs) override {
+    if (n == 0) {
+      return 0;
+    }
+    uint32_t clock = Wire.getClock();
+    Wire.setClock(400000);
+    ina.setShuntResolution(9);
+    ina.getRegister(INA219_CURRENT);
+    delayMicroseconds(100);
+
+    uint32_t first = micros();
+    uint32_t last = first;
+    for (size_t i = 0; i < n; i++) {
+      while ((uint32_t)(micros() - first) < i * periodUs) {
+      }
+      last = micros();
+      Wire.requestFrom(ina.getAddress(), (uint8_t)2);
+      uint8_t high = Wire.read();
+      uint8_t low = Wire.read();
+      out[i] = (int16_t)(high << 8 | low) * currentLsbUa;
+    }
+
+    ina.setShuntSamples(7);
+    Wire.setClock(clock);
+    return n > 1 ? last - first : periodUs;
   }
 
  private:
   INA219 ina;
+  int32_t currentLsbUa = 0;
 };
+#endif  // ARDUINO_ARCH_ESP32
 
 #endif  // SENSOR_H
@@ -0,0 +1,446 @@
+#ifndef STREAM_UPLOADER_H
+#define STREAM_UPLOADER_H
+
+#include <Arduino.h>
+#include <Base64.h>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+#include <esp_heap_caps.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "fixed_point.h"
+#include "http_sender.h"
+#include "log_ring.h"
+
+// Number of measurements copied out of the ring buffer and written per HTTP chunk.
+#ifndef STREAM_WINDOW_SIZE
+#define STREAM_WINDOW_SIZE 32
+#endif
+
+// Upper bound of measurements per upload, limits the time a request stays open.
+#ifndef STREAM_MAX_RECORDS
+#define STREAM_MAX_RECORDS 10000
+#endif
+
+// Timeout for connect and response in ms.
+#define STREAM_TIMEOUT 15000
+
+// Characters of the device name sent with a batch, longer names are cut.
+#define STREAM_DEVICE_LENGTH 32
+
+// StreamUploader uploads the backlog of the ring buffer in a single request with chunked transfer encoding.
+//
+// The JSON batch is produced on the fly, STREAM_WINDOW_SIZE records at a time, into a fixed window that is written
+// straight into the socket, so a request can carry thousands of samples with constant memory. The position in the
+// ring buffer is kept as a sequence number; on a 2xx response exactly the streamed range is removed, also if
+// samples were added or overwritten meanwhile. The upload runs in its own low priority task with a blocking client
+// (kept alive between uploads), so the sampling path is never blocked by the network.
+//
+// In the columnar layout (JSON_BATCH_VERSION 2, see JsonHelper::toJson()) the timing precedes the values, so the range
+// is read once more ahead of the request to find it; the overhead is a copy per record. Records overwritten between
+// the passes are sent as a delta of 0 and a null value, which the server skips.
+template <typename Buffer>
+class StreamUploader {
+ public:
+  typedef void (*ResultCallback)(int httpCode, int records);
+  typedef int64_t (*Clock)();
+
+  StreamUploader(Buffer &ringBuffer) : ringBuffer(ringBuffer), client(nullptr), stats() {}
+
+  // Sets the server URL (http:// or https://).
+  void setServerUrl(const String &url) {
+    useHttps = url.startsWith("https");
+    int hostStart = url.indexOf("://") + 3;
+    int pathStart = url.indexOf('/', hostStart);
+    String hostPort = pathStart < 0 ? url.substring(hostStart) : url.substring(hostStart, pathStart);
+    path = pathStart < 0 ? "/" : url.substring(pathStart);
+    int colon = hostPort.indexOf(':');
+    host = colon < 0 ? hostPort : hostPort.substring(0, colon);
+    port = colon < 0 ? (useHttps ? 443 : 80) : hostPort.substring(colon + 1).toInt();
+  }
+
+  void setApiToken(const String &token) { apiToken = token; }
+
+  void setBasicAuth(const String &username, const String &password) {
+    authHeader = username.length() > 0 ? "Basic " + base64::encode(username + ":" + password) : "";
+  }
+
+  // Sets the device name sent with each batch. It is copied as a JSON string, escaped.
+  void setDevice(const char *name) {
+    size_t len = 0;
+    for (size_t i = 0; name[i] != '\0' && i < STREAM_DEVICE_LENGTH; i++) {
+      unsigned char c = name[i];
+      if (c == '"' || c == '\\') {
+        deviceJson[len++] = '\\';
+        deviceJson[len++] = c;
+      } else if (c < 0x20) {
+        len += snprintf(deviceJson + len, sizeof(deviceJson) - len, "\\u%04x", c);
+      } else {
+        deviceJson[len++] = c;
+      }
+    }
+    deviceJson[len] = '\0';
+  }
+
+  // Sets the clock for the send time of a batch.
+  void setClock(Clock c) { clock = c; }
+
+  // Sets the layout of the batches, see JSON_BATCH_VERSION.
+  void setVersion(int v) { version = v; }
+
+  // Sets the callback invoked from the upload task when an upload has finished (httpCode <= 0: network error).
+  void setResultCallback(ResultCallback cb) { resultCallback = cb; }
+
+  // Starts the upload task.
+  void begin() {
+    if (xTaskCreatePinnedToCore(StreamUploader::taskMain, "upload", 8192, this, 1, &task, 0) != pdPASS) {
+      Serial.println("Error: Failed to create upload task.");
+    }
+  }
+
+  // Starts an upload of the current backlog unless one is in progress.
+  void requestUpload() {
+    if (task == nullptr || busy) {
+      return;
+    }
+    busy = true;
+    xTaskNotifyGive(task);
+  }
+
+  // Returns true while an upload is in progress.
+  bool isSending() const { return busy; }
+
+  // Returns the connection and request counters.
+  const HttpStats &getStats() const { return stats; }
+
+ private:
+  Buffer &ringBuffer;
+  TaskHandle_t task = nullptr;
+  volatile bool busy = false;
+
+  bool useHttps = false;
+  String host;
+  uint16_t port = 80;
+  String path;
+  String apiToken;
+  String authHeader;
+  char deviceJson[STREAM_DEVICE_LENGTH * 6 + 1] = "";  // \u00XX per character at most
+  int version = JSON_BATCH_VERSION;
+  Clock clock = nullptr;
+  ResultCallback resultCallback = nullptr;
+
+  WiFiClient *client;
+  HttpStats stats;
+
+  Measurement window[STREAM_WINDOW_SIZE];
+  // A JSON record and its separator per measurement, and the batch header in the first window.
+  char chunk[STREAM_WINDOW_SIZE * MEASUREMENT_JSON_SIZE + sizeof(deviceJson) + 160];
+  size_t chunkLength = 0;
+
+  // Timing of a version 2 batch
+  struct Timing {
+    int64_t start;
+    int64_t newest;
+    int64_t interval;
+    bool regular;  // All records interval apart
+  };
+
+  static void taskMain(void *param) {
+    StreamUploader *self = static_cast<StreamUploader *>(param);
+    for (;;) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      self->upload();
+      self->busy = false;
+    }
+  }
+
+  bool connect() {
+    if (client == nullptr) {
+      if (useHttps) {
+        WiFiClientSecure *secure = new WiFiClientSecure();
+        secure->setInsecure();
+        client = secure;
+      } else {
+        client = new WiFiClient();
+      }
+      client->setTimeout(STREAM_TIMEOUT / 1000);
+    }
+    if (client->connected()) {
+      return true;
+    }
+    stats.connections++;
+    return client->connect(host.c_str(), port, STREAM_TIMEOUT);
+  }
+
+  // Writes data as one HTTP chunk.
+  bool writeChunk(const char *data, size_t len) {
+    char size[12];
+    int n = snprintf(size, sizeof(size), "%X\r\n", (unsigned)len);
+    return client->write((const uint8_t *)size, n) == (size_t)n && client->write((const uint8_t *)data, len) == len &&
+           client->write((const uint8_t *)"\r\n", 2) == 2;
+  }
+
+  void upload() {
+    uint32_t sequence = ringBuffer.getHeadSequence();
+    int total = ringBuffer.getCount();
+    if (total == 0) {
+      return;
+    }
+    if (total > STREAM_MAX_RECORDS) {
+      total = STREAM_MAX_RECORDS;
+    }
+    // The records are read before the request is started: if they have been removed meanwhile (e.g. by an
+    // acknowledged chunk of the HTTP sender) there is nothing to send, and an empty batch is not valid.
+    Timing timing = {};
+    int first = 0;
+    if (version >= 2) {
+      total = scan(sequence, total, timing);
+    } else {
+      first = ringBuffer.getWindow(sequence, window, total < STREAM_WINDOW_SIZE ? total : STREAM_WINDOW_SIZE);
+    }
+    if ((version >= 2 ? total : first) == 0) {
+      return;
+    }
+
+    unsigned long requestStart = millis();
+    uint32_t heapAtStart = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    stats.requests++;
+    if (!connect()) {
+      LOG_WARN("Upload: can't connect to %s", host.c_str());
+      finish(0, 0);
+      return;
+    }
+
+    client->printf("POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\nConnection: keep-alive\r\n"
+                   "Transfer-Encoding: chunked\r\n", path.c_str(), host.c_str());
+    if (apiToken.length() > 0) {
+      client->printf("X-API-Token: %s\r\n", apiToken.c_str());
+    }
+    if (authHeader.length() > 0) {
+      client->printf("Authorization: %s\r\n", authHeader.c_str());
+    }
+    client->print("\r\n");
+
+    bool ok;
+    if (version >= 2) {
+      ok = streamColumns(sequence, total, timing);
+      sequence += total;
+    } else {
+      ok = streamRows(sequence, total, first);
+    }
+    ok = ok && client->write((const uint8_t *)"0\r\n\r\n", 5) == 5;
+
+    int httpCode = ok ? readResponse() : 0;
+    stats.lastSetupMs = millis() - requestStart;
+    if (stats.lastSetupMs > stats.maxSetupMs) {
+      stats.maxSetupMs = stats.lastSetupMs;
+    }
+    uint32_t heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    if (heapAtStart > heap && heapAtStart - heap > stats.maxHeapDrop) {
+      stats.maxHeapDrop = heapAtStart - heap;
+    }
+
+    int removed = 0;
+    if (httpCode >= 200 && httpCode < 300) {
+      // Acknowledged: exactly the streamed range (anything older has been overwritten already)
+      removed = ringBuffer.removeUntil(sequence);
+    }
+    finish(httpCode, removed);
+  }
+
+  // Streams the batch: {"device":..,"sentAt":..,"oldest":..,"measurements":[..],"newest":..}. The first count
+  // (> 0) records from sequence are in the window already. Moves sequence behind the streamed records.
+  bool streamRows(uint32_t &sequence, int total, int count) {
+    int streamed = 0;
+    int64_t newest = 0;
+    bool ok = true;
+    for (;;) {
+      sequence += count;
+      size_t len = 0;
+      if (streamed == 0) {
+        len = snprintf(chunk, sizeof(chunk), "{\"device\":\"%s\",\"sentAt\":%lld,\"oldest\":%lld,\"measurements\":[",
+                       deviceJson, clock != nullptr ? clock() : 0LL, window[0].timestamp);
+      }
+      for (int i = 0; i < count; i++) {
+        if (streamed > 0 || i > 0) {
+          chunk[len++] = ',';
+        }
+        len += formatMeasurementJson(chunk + len, window[i].timestamp, window[i].value);
+      }
+      newest = window[count - 1].timestamp;
+      streamed += count;
+      ok = writeChunk(chunk, len);
+      if (!ok || streamed >= total) {
+        break;
+      }
+
+      int max = total - streamed < STREAM_WINDOW_SIZE ? total - streamed : STREAM_WINDOW_SIZE;
+      // Records overwritten meanwhile are skipped
+      count = ringBuffer.getWindow(sequence, window, max);
+      if (count == 0) {
+        break;
+      }
+    }
+    if (ok) {
+      size_t len = snprintf(chunk, sizeof(chunk), "],\"newest\":%lld}", newest);
+      ok = writeChunk(chunk, len);
+    }
+    return ok;
+  }
+
+  // First pass of a version 2 batch over up to total records from sequence, which is moved forward if the oldest
+  // were overwritten. Returns the number of records.
+  int scan(uint32_t &sequence, int total, Timing &timing) {
+    int count = 0;
+    int64_t previous = 0;
+    while (count < total) {
+      uint32_t position = sequence + count;
+      int max = total - count < STREAM_WINDOW_SIZE ? total - count : STREAM_WINDOW_SIZE;
+      int n = ringBuffer.getWindow(position, window, max);
+      if (n == 0) {
+        break;
+      }
+      if (position != sequence + count) {
+        // Overwritten while scanning: start over from the oldest record
+        sequence = position;
+        count = 0;
+      }
+      for (int i = 0; i < n; i++, count++) {
+        int64_t timestamp = window[i].timestamp;
+        if (count == 0) {
+          timing = {.start = timestamp, .newest = timestamp, .interval = 0, .regular = true};
+        } else if (count == 1) {
+          timing.interval = timestamp - previous;
+        } else if (timestamp - previous != timing.interval) {
+          timing.regular = false;
+        }
+        previous = timestamp;
+      }
+      timing.newest = previous;
+    }
+    return count;
+  }
+
+  // Streams the batch: {"version":2,"device":..,"sentAt":..,"oldest":..,"newest":..,"start":..,"interval":..,
+  // "values":[..]}, "deltas":[..] in place of "interval" if the records are not evenly spaced.
+  bool streamColumns(uint32_t sequence, int count, const Timing &timing) {
+    chunkLength = snprintf(chunk, sizeof(chunk),
+                           "{\"version\":2,\"device\":\"%s\",\"sentAt\":%lld,\"oldest\":%lld,\"newest\":%lld,"
+                           "\"start\":%lld,",
+                           deviceJson, clock != nullptr ? clock() : 0LL, timing.start,
+                           timing.newest, timing.start);
+    bool ok = true;
+    if (timing.regular) {
+      chunkLength += snprintf(chunk + chunkLength, sizeof(chunk) - chunkLength, "\"interval\":%lld,",
+                              timing.interval);
+    } else {
+      // Relative to the last record still in the buffer, so the sum stays right across overwritten ones
+      int64_t previous = timing.start;
+      ok = appendColumn("\"deltas\":[", sequence, count, [&](char *out, const Measurement *m) {
+        int64_t delta = m != nullptr ? m->timestamp - previous : 0;
+        previous = m != nullptr ? m->timestamp : previous;
+        return formatInt64(out, delta);
+      }) && append(",", 1);
+    }
+    ok = ok && appendColumn("\"values\":[", sequence, count, [](char *out, const Measurement *m) {
+           if (m == nullptr) {
+             memcpy(out, "null", 4);
+             return (size_t)4;
+           }
+           return formatMilli(out, m->value);
+         });
+    return ok && append("}", 1) && flushChunk();
+  }
+
+  // Appends the array name and the count elements from sequence, formatted by format(out, record), record nullptr
+  // for a record overwritten meanwhile.
+  template <typename Format>
+  bool appendColumn(const char *name, uint32_t sequence, int count, Format &&format) {
+    if (!append(name, strlen(name))) {
+      return false;
+    }
+    int done = 0;
+    while (done < count) {
+      uint32_t position = sequence + done;
+      int max = count - done < STREAM_WINDOW_SIZE ? count - done : STREAM_WINDOW_SIZE;
+      int n = ringBuffer.getWindow(position, window, max);
+      int skipped = (int32_t)(position - (sequence + done));
+      if (n == 0 && skipped <= 0) {
+        return false;
+      }
+      for (int i = -skipped; i < n && done < count; i++, done++) {
+        if (done > 0) {
+          chunk[chunkLength++] = ',';
+        }
+        chunkLength += format(chunk + chunkLength, i < 0 ? nullptr : &window[i]);
+        if (chunkLength + INT64_STRING_SIZE + 1 > sizeof(chunk) && !flushChunk()) {
+          return false;
+        }
+      }
+    }
+    return append("]", 1);
+  }
+
+  // Appends data to the chunk, writing it out first if full.
+  bool append(const char *data, size_t len) {
+    if (chunkLength + len > sizeof(chunk) && !flushChunk()) {
+      return false;
+    }
+    memcpy(chunk + chunkLength, data, len);
+    chunkLength += len;
+    return true;
+  }
+
+  bool flushChunk() {
+    bool ok = chunkLength == 0 || writeChunk(chunk, chunkLength);
+    chunkLength = 0;
+    return ok;
+  }
+
+  // Reads the status line, the headers and the body of the response. Returns the HTTP code, 0 on error.
+  int readResponse() {
+    String line = client->readStringUntil('\n');
+    int httpCode = line.startsWith("HTTP/1.") ? line.substring(9, 12).toInt() : 0;
+    int contentLength = 0;
+    bool close = false;
+    while (client->connected() || client->available()) {
+      line = client->readStringUntil('\n');
+      line.trim();
+      if (line.length() == 0) {
+        break;
+      }
+      line.toLowerCase();
+      if (line.startsWith("content-length:")) {
+        contentLength = line.substring(15).toInt();
+      } else if ((line.startsWith("connection:") && line.indexOf("close") > 0) ||
+                 line.startsWith("transfer-encoding:")) {
+        // The body length is unknown: the connection can't be reused
+        close = true;
+      }
+    }
+    unsigned long deadline = millis() + STREAM_TIMEOUT;
+    while (contentLength > 0 && (long)(deadline - millis()) > 0 && (client->connected() || client->available())) {
+      if (client->read() >= 0) {
+        contentLength--;
+      } else {
+        delay(1);
+      }
+    }
+    if (httpCode == 0 || close) {
+      client->stop();
+    }
+    return httpCode;
+  }
+
+  void finish(int httpCode, int removed) {
+    if (httpCode <= 0 && client != nullptr) {
+      client->stop();
+    }
+    if (resultCallback) {
+      resultCallback(httpCode, removed);
+    }
+  }
+};
+
+#endif  // STREAM_UPLOADER_H
@@ -0,0 +1,137 @@
+#ifndef SYNTHETIC_SENSOR_H
+#define SYNTHETIC_SENSOR_H
+
+#include <Arduino.h>
+#include <math.h>
+
+#include "sensor.h"
+
+// Peak current of a clear day in mA.
+#ifndef SYNTHETIC_SENSOR_PEAK_MA
+#define SYNTHETIC_SENSOR_PEAK_MA 1500.0f
+#endif
+
+// Mean duration of clear and cloudy spells in simulated ms.
+#define SYNTHETIC_SENSOR_CLEAR_MS (20UL * 60 * 1000)
+#define SYNTHETIC_SENSOR_CLOUDY_MS (5UL * 60 * 1000)
+
+// Time constant of a cloud edge in simulated ms.
+#define SYNTHETIC_SENSOR_CLOUD_EDGE_MS 20000.0f
+
+// SyntheticSensor generates a solar current profile: a clear-sky day curve between sunrise and sunset, cloud
+// transients that dim it for minutes with edges of a few seconds, and measurement noise.
+//
+// The simulated time runs at speed times the time source, starting at startHour. With a fixed seed and a virtual
+// time source the sequence is fully deterministic, so it can drive the pipeline at any rate for load tests.
+class SyntheticSensor : public Sensor {
+ public:
+  SyntheticSensor(uint32_t seed = 1, float speed = 1.0f, float startHour = 6.0f)
+      : seed(seed ? seed : 1),
+        speed(speed),
+        startHour(startHour),
+        sunriseHour(6.0f),
+        sunsetHour(20.0f),
+        noiseMa(2.0f),
+        timeSource(sensorMillis) {}
+
+  // Sets the time base. Must be called before setup().
+  void setTimeSource(SensorTimeSource source) { timeSource = source; }
+
+  // Sets sunrise and sunset in hours of the day.
+  void setDaylight(float sunrise, float sunset) {
+    sunriseHour = sunrise;
+    sunsetHour = sunset;
+  }
+
+  // Sets the standard deviation of the noise in mA.
+  void setNoise(float sigmaMa) { noiseMa = sigmaMa; }
+
+  // Adds an inverter ripple to the burst captures: a sine of hz with the amplitude in mA.
+  void setRipple(float hz, float amplitudeMa) {
+    rippleHz = hz;
+    rippleMa = amplitudeMa;
+  }
+
+  void setup() override {
+    state = seed;
+    start = timeSource();
+    lastSimMs = 0;
+    cloudy = false;
+    attenuation = 1.0f;
+    targetAttenuation = 1.0f;
+  }
+
+  int32_t getCurrentInUa() override {
+    uint64_t simMs = (uint64_t)((timeSource() - start) * speed);
+    float dt = (float)(simMs - lastSimMs);
+    lastSimMs = simMs;
+
+    // Clouds: two-state Markov process, the attenuation follows the target with a first order lag.
+    float meanMs = cloudy ? SYNTHETIC_SENSOR_CLOUDY_MS : SYNTHETIC_SENSOR_CLEAR_MS;
+    if (uniform() < 1.0f - expf(-dt / meanMs)) {
+      cloudy = !cloudy;
+      targetAttenuation = cloudy ? 0.2f + 0.4f * uniform() : 1.0f;
+    }
+    attenuation += (targetAttenuation - attenuation) * (1.0f - expf(-dt / SYNTHETIC_SENSOR_CLOUD_EDGE_MS));
+
+    float hour = fmodf(startHour + simMs / 3600000.0f, 24.0f);
+    float clearSky = 0.0f;
+    if (hour > sunriseHour && hour < sunsetHour) {
+      float s = sinf((float)M_PI * (hour - sunriseHour) / (sunsetHour - sunriseHour));
+      clearSky = SYNTHETIC_SENSOR_PEAK_MA * s * sqrtf(s);
+    }
+
+    float current = clearSky * attenuation;
+    current += gaussian() * (noiseMa + 0.01f * current);
+    return current > 0.0f ? (int32_t)lroundf(current * 1000.0f) : 0;
+  }
+
+  // The current of now with the ripple and the noise on top, sampled every periodUs.
+  uint32_t captureBurst(int32_t *out, size_t n, uint32_t periodUs) override {
+    float current = getCurrentInUa() / 1000.0f;
+    for (size_t i = 0; i < n; i++) {
+      float t = i * periodUs / 1e6f;
+      float v = current + rippleMa * sinf(2.0f * (float)M_PI * rippleHz * t) + gaussian() * noiseMa;
+      out[i] = v > 0.0f ? (int32_t)lroundf(v * 1000.0f) : 0;
+    }
+    return n > 1 ? (n - 1) * periodUs : periodUs;
+  }
+
+ private:
+  uint32_t seed;
+  float speed;
+  float startHour;
+  float sunriseHour;
+  float sunsetHour;
+  float noiseMa;
+  float rippleHz = 100.0f;
+  float rippleMa = 0.0f;
+  SensorTimeSource timeSource;
+
+  uint32_t state = 1;
+  uint64_t start = 0;
+  uint64_t lastSimMs = 0;
+  bool cloudy = false;
+  float attenuation = 1.0f;
+  float targetAttenuation = 1.0f;
+
+  // xorshift32
+  uint32_t next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  // Uniform in [0, 1).
+  float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); }
+
+  // Standard normal (Box-Muller).
+  float gaussian() {
+    float u = uniform();
+    float v = uniform();
+    return sqrtf(-2.0f * logf(u + 1e-7f)) * cosf(2.0f * (float)M_PI * v);
+  }
+};
+
+#endif  // SYNTHETIC_SENSOR_H
@@ -0,0 +1,86 @@
+#ifndef WIFI_CACHE_H
+#define WIFI_CACHE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <WiFi.h>
+
+// Age up to which a cached DHCP lease is reused as static address, in ms. DHCP leases usually last a day or longer;
+// the address is only reused if the time is valid.
+#ifndef WIFI_LEASE_MAX_AGE
+#define WIFI_LEASE_MAX_AGE (12 * 3600 * 1000LL)
+#endif
+
+// Access point and address of the last good connection.
+struct WifiLease {
+  uint32_t magic;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  int64_t leasedAt;  // Epoch ms of the DHCP lease, 0 if unknown
+};
+
+// Survives deep sleep.
+static RTC_DATA_ATTR WifiLease rtcWifiLease;
+
+// WifiCache keeps the last good lease in RTC memory and in NVS, so a reconnect, a wake from deep sleep and a boot
+// after a power loss can skip the scan and DHCP. NVS is only written when the access point or the address changed.
+class WifiCache {
+ public:
+  // Loads the lease from NVS unless RTC memory holds one.
+  void begin() {
+    if (rtcWifiLease.magic == kMagic) {
+      return;
+    }
+    Preferences prefs;
+    prefs.begin("wifi", true);
+    WifiLease lease;
+    if (prefs.getBytes("lease", &lease, sizeof(lease)) == sizeof(lease) && lease.magic == kMagic) {
+      lease.leasedAt = 0;  // Age unknown after a power loss
+      rtcWifiLease = lease;
+    }
+    prefs.end();
+  }
+
+  // Returns the cached lease, nullptr if there is none.
+  const WifiLease *get() const { return rtcWifiLease.magic == kMagic ? &rtcWifiLease : nullptr; }
+
+  // Returns true if the cached address may be used as static address at the epoch time now (0: unknown).
+  bool isAddressValid(int64_t now) const {
+    const WifiLease *lease = get();
+    return lease != nullptr && lease->ip != 0 && lease->leasedAt > 0 && now > 0 &&
+           now - lease->leasedAt < WIFI_LEASE_MAX_AGE;
+  }
+
+  // Stores the current connection. dhcp: the address was leased now, at the epoch time now (0: unknown).
+  void store(bool dhcp, int64_t now) {
+    WifiLease lease = {};
+    lease.magic = kMagic;
+    memcpy(lease.bssid, WiFi.BSSID(), sizeof(lease.bssid));
+    lease.channel = WiFi.channel();
+    lease.ip = WiFi.localIP();
+    lease.gateway = WiFi.gatewayIP();
+    lease.subnet = WiFi.subnetMask();
+    lease.dns = WiFi.dnsIP();
+    lease.leasedAt = dhcp ? now : rtcWifiLease.leasedAt;
+
+    bool changed = rtcWifiLease.magic != kMagic || memcmp(lease.bssid, rtcWifiLease.bssid, 6) != 0 ||
+                   lease.channel != rtcWifiLease.channel || lease.ip != rtcWifiLease.ip ||
+                   lease.gateway != rtcWifiLease.gateway;
+    rtcWifiLease = lease;
+    if (changed) {
+      Preferences prefs;
+      prefs.begin("wifi", false);
+      prefs.putBytes("lease", &lease, sizeof(lease));
+      prefs.end();
+    }
+  }
+
+ private:
+  static const uint32_t kMagic = 0x57494649;  // "WIFI"
+};
+
+#endif  // WIFI_CACHE_H
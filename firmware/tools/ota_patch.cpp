@@ -0,0 +1,519 @@
+// Firmware patches for the OTA patch endpoint (src/delta_patch.h, src/patch_server.h).
+//
+//   ota_patch diff <running.bin> <new.bin> <patch.bin>   binary diff against the firmware running on the loggers
+//   ota_patch compress <new.bin> <patch.bin>             compressed full image, for loggers on unknown firmware
+//   ota_patch apply <running.bin> <patch.bin> <out.bin>  applies a patch with the decoder of the device
+//   ota_patch check [<running.bin> <new.bin>]            diff, apply and compare; synthetic images without files
+//
+// The images are the firmware.bin files of the builds (.pio/build/esp32dev/firmware.bin). check exits with 1 if an
+// image does not survive the round trip or a damaged patch is not rejected, so it can run in CI.
+//
+//   pio run -e ota_patch
+//   .pio/build/ota_patch/program diff old/firmware.bin .pio/build/esp32dev/firmware.bin fix.patch
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "delta_patch.h"
+
+typedef std::vector<uint8_t> Bytes;
+typedef std::chrono::steady_clock Clock;
+
+// Shortest match worth an op.
+#define MIN_MATCH 8
+
+// Bytes hashed to find match candidates.
+#define HASH_BYTES 6
+#define HASH_BITS 20
+
+// Candidates tried per position and source.
+#define MAX_CANDIDATES 64
+
+// Chunk size of the uploads on the device (HTTP_UPLOAD_BUFLEN).
+#define APPLY_CHUNK_SIZE 1436
+
+static uint32_t hashAt(const Bytes &data, size_t pos) {
+  uint64_t v = 0;
+  for (int i = 0; i < HASH_BYTES; i++) {
+    v = v << 8 | data[pos + i];
+  }
+  return (uint32_t)((v * 0x9E3779B97F4A7C15ULL) >> (64 - HASH_BITS));
+}
+
+// Hash chains over all positions of an image, the latest first.
+class MatchIndex {
+ public:
+  explicit MatchIndex(const Bytes &data) : data(data), head(1 << HASH_BITS, -1), prev(data.size(), -1) {}
+
+  void insert(size_t pos) {
+    if (pos + HASH_BYTES > data.size()) {
+      return;
+    }
+    uint32_t h = hashAt(data, pos);
+    prev[pos] = head[h];
+    head[h] = (int32_t)pos;
+  }
+
+  int32_t first(const Bytes &other, size_t pos) const {
+    return pos + HASH_BYTES <= other.size() ? head[hashAt(other, pos)] : -1;
+  }
+
+  int32_t next(int32_t pos) const { return prev[pos]; }
+
+ private:
+  const Bytes &data;
+  std::vector<int32_t> head;
+  std::vector<int32_t> prev;
+};
+
+static size_t matchLength(const Bytes &a, size_t i, const Bytes &b, size_t j) {
+  size_t n = 0;
+  while (i + n < a.size() && j + n < b.size() && a[i + n] == b[j + n]) {
+    n++;
+  }
+  return n;
+}
+
+static void putVarint(Bytes &out, uint32_t v) {
+  while (v >= 0x80) {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+static void putLe32(Bytes &out, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out.push_back((uint8_t)(v >> (8 * i)));
+  }
+}
+
+static void sha256(const Bytes &data, uint8_t digest[SHA256_SIZE]) {
+  Sha256 hash;
+  hash.update(data.data(), data.size());
+  hash.finish(digest);
+}
+
+// Greedy encoder. Source matches are extended over mismatches as long as they pay off (bsdiff style), so the moved
+// addresses in shifted code end up as a few bytes of an ADD instead of breaking the match.
+class PatchEncoder {
+ public:
+  PatchEncoder(const Bytes &source, const Bytes &target)
+      : source(source), target(target), sourceIndex(source), targetIndex(target) {
+    for (size_t i = 0; i < source.size(); i++) {
+      sourceIndex.insert(i);
+    }
+  }
+
+  Bytes encode() {
+    Bytes out(PATCH_MAGIC, PATCH_MAGIC + 4);
+    out.push_back(PATCH_VERSION);
+    out.insert(out.end(), 3, 0);
+    putLe32(out, source.size());
+    putLe32(out, target.size());
+    uint8_t digest[SHA256_SIZE];
+    sha256(source, digest);
+    out.insert(out.end(), digest, digest + SHA256_SIZE);
+    sha256(target, digest);
+    out.insert(out.end(), digest, digest + SHA256_SIZE);
+
+    size_t t = 0;
+    size_t literalStart = 0;
+    while (t < target.size()) {
+      Match m = findMatch(t);
+      if (m.length < MIN_MATCH) {
+        targetIndex.insert(t++);
+        continue;
+      }
+      putLiteral(out, literalStart, t);
+      if (m.fromSource) {
+        putAdd(out, m.position, t, m.length);
+      } else {
+        out.push_back(PATCH_OP_COPY);
+        putVarint(out, m.length);
+        putVarint(out, t - m.position);
+      }
+      for (size_t end = t + m.length; t < end; t++) {
+        targetIndex.insert(t);
+      }
+      literalStart = t;
+    }
+    putLiteral(out, literalStart, t);
+    out.push_back(PATCH_OP_END);
+    return out;
+  }
+
+ private:
+  struct Match {
+    bool fromSource;
+    size_t position;
+    size_t length;  // Including the approximate extension of source matches
+  };
+
+  const Bytes &source;
+  const Bytes &target;
+  MatchIndex sourceIndex;
+  MatchIndex targetIndex;
+  size_t sourcePos = 0;  // Source position after the previous ADD
+  size_t alignedTarget = 0;
+
+  Match findMatch(size_t t) {
+    Match best = {false, 0, 0};
+    // The source continues where the previous ADD ended, shifted by the bytes inserted since
+    size_t expected = sourcePos + (t - alignedTarget);
+    bool aligned = expected < source.size() && similar(expected, t);
+    if (aligned) {
+      best = {true, expected, matchLength(target, t, source, expected)};
+    }
+    int tries = 0;
+    for (int32_t c = sourceIndex.first(target, t); c >= 0 && tries < MAX_CANDIDATES; c = sourceIndex.next(c), tries++) {
+      size_t n = matchLength(target, t, source, c);
+      if (n > best.length) {
+        best = {true, (size_t)c, n};
+      }
+    }
+    tries = 0;
+    for (int32_t c = targetIndex.first(target, t); c >= 0 && tries < MAX_CANDIDATES; c = targetIndex.next(c), tries++) {
+      size_t n = matchLength(target, t, target, c);
+      if (n > best.length + 4) {  // An ADD would extend a source match
+        best = {false, (size_t)c, n};
+      }
+    }
+    if (best.fromSource && (best.length >= MIN_MATCH || (aligned && best.position == expected))) {
+      best.length = extend(best.position, t, best.length);
+      if (best.length < MIN_MATCH) {
+        best.length = 0;
+      }
+    }
+    return best;
+  }
+
+  // At least three quarters of the next 32 bytes match: code with changed addresses.
+  bool similar(size_t s, size_t t) const {
+    if (s + 32 > source.size() || t + 32 > target.size()) {
+      return false;
+    }
+    int matches = 0;
+    for (int i = 0; i < 32; i++) {
+      matches += source[s + i] == target[t + i];
+    }
+    return matches >= 24;
+  }
+
+  // Extends a source match while matches outweigh mismatches.
+  size_t extend(size_t s, size_t t, size_t length) const {
+    long score = 0, bestScore = 0;
+    size_t best = length;
+    for (size_t i = length; s + i < source.size() && t + i < target.size(); i++) {
+      score += source[s + i] == target[t + i] ? 1 : -1;
+      if (score > bestScore) {
+        bestScore = score;
+        best = i + 1;
+      } else if (score < bestScore - 32) {
+        break;
+      }
+    }
+    return best;
+  }
+
+  void putLiteral(Bytes &out, size_t from, size_t to) {
+    if (to == from) {
+      return;
+    }
+    out.push_back(PATCH_OP_LITERAL);
+    putVarint(out, to - from);
+    out.insert(out.end(), target.begin() + from, target.begin() + to);
+  }
+
+  void putAdd(Bytes &out, size_t s, size_t t, size_t length) {
+    out.push_back(PATCH_OP_ADD);
+    putVarint(out, length);
+    putVarint(out, zigzagEncode((int32_t)s - (int32_t)sourcePos));
+    size_t i = 0;
+    while (i < length) {
+      size_t zeros = 0;
+      while (i + zeros < length && target[t + i + zeros] == source[s + i + zeros]) {
+        zeros++;
+      }
+      i += zeros;
+      // Short runs of equal bytes between differences are cheaper as data than as a new pair
+      size_t count = 0;
+      while (i + count < length) {
+        size_t run = 0;
+        while (i + count + run < length && run < 3 && target[t + i + count + run] == source[s + i + count + run]) {
+          run++;
+        }
+        if (run == 3 || i + count + run == length) {
+          break;
+        }
+        count += run + 1;
+      }
+      putVarint(out, zeros);
+      putVarint(out, count);
+      for (size_t j = 0; j < count; j++) {
+        out.push_back((uint8_t)(target[t + i + j] - source[s + i + j]));
+      }
+      i += count;
+    }
+    if (length == 0) {
+      putVarint(out, 0);
+      putVarint(out, 0);
+    }
+    sourcePos = s + length;
+    alignedTarget = t + length;
+  }
+};
+
+// Images in memory, the device side of a patch.
+class MemoryFlash {
+ public:
+  explicit MemoryFlash(const Bytes &source) : source(source) {}
+
+  Bytes target;
+  bool aborted = false;
+
+  bool begin(const PatchHeader &header) {
+    target.clear();
+    target.reserve(header.targetSize);
+    aborted = false;
+    return true;
+  }
+
+  bool readSource(uint32_t offset, uint8_t *data, size_t len) {
+    if (offset + len > source.size()) {
+      return false;
+    }
+    memcpy(data, source.data() + offset, len);
+    return true;
+  }
+
+  bool readTarget(uint32_t offset, uint8_t *data, size_t len) {
+    if (offset + len > target.size()) {
+      return false;
+    }
+    memcpy(data, target.data() + offset, len);
+    return true;
+  }
+
+  bool writeTarget(const uint8_t *data, size_t len) {
+    target.insert(target.end(), data, data + len);
+    return true;
+  }
+
+  bool end() { return true; }
+
+  void abort() { aborted = true; }
+
+ private:
+  const Bytes &source;
+};
+
+static PatchError apply(const Bytes &source, const Bytes &patch, Bytes &target) {
+  MemoryFlash flash(source);
+  std::unique_ptr<DeltaPatcher<MemoryFlash>> patcher(new DeltaPatcher<MemoryFlash>(flash));
+  PatchError error = PATCH_OK;
+  for (size_t i = 0; i < patch.size() && error == PATCH_OK; i += APPLY_CHUNK_SIZE) {
+    size_t n = patch.size() - i < APPLY_CHUNK_SIZE ? patch.size() - i : APPLY_CHUNK_SIZE;
+    error = patcher->feed(patch.data() + i, n);
+  }
+  if (error == PATCH_OK) {
+    error = patcher->finish();
+  }
+  target = flash.target;
+  return error;
+}
+
+static bool readFile(const char *path, Bytes &data) {
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    fprintf(stderr, "Cannot read %s\n", path);
+    return false;
+  }
+  uint8_t block[4096];
+  size_t n;
+  while ((n = fread(block, 1, sizeof(block), f)) > 0) {
+    data.insert(data.end(), block, block + n);
+  }
+  fclose(f);
+  return true;
+}
+
+static bool writeFile(const char *path, const Bytes &data) {
+  FILE *f = fopen(path, "wb");
+  if (f == nullptr || fwrite(data.data(), 1, data.size(), f) != data.size()) {
+    fprintf(stderr, "Cannot write %s\n", path);
+    if (f != nullptr) {
+      fclose(f);
+    }
+    return false;
+  }
+  fclose(f);
+  return true;
+}
+
+static double msSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count() / 1000.0;
+}
+
+// xorshift32
+static uint32_t randomState = 1;
+
+static uint32_t nextRandom() {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+// Firmware-like image: code from a limited set of instruction words, literal pools of absolute addresses into the
+// image and strings, padded with 0xff.
+static const uint32_t kImageBase = 0x400d0000;
+
+static Bytes syntheticImage(size_t size) {
+  static const char *const kStrings[] = {"Measurement: %d uA", "HTTP request failed: %d", "OTA Update starting.",
+                                         "Loop stall: %u ms",  "Connected to MQTT.",      "Status: free heap %u"};
+  Bytes image;
+  randomState = 12345;
+  while (image.size() + 64 < size * 15 / 16) {
+    uint32_t kind = nextRandom() % 8;
+    if (kind < 5) {
+      for (int i = 0; i < 24; i++) {
+        uint32_t word = nextRandom() % 512;
+        image.push_back((uint8_t)(word * 37));
+        image.push_back((uint8_t)(word >> 1 | 0x40));
+        image.push_back((uint8_t)(word % 7));
+      }
+    } else if (kind < 7) {
+      for (int i = 0; i < 6; i++) {
+        putLe32(image, kImageBase + (nextRandom() % (size / 4)) * 4);
+      }
+    } else {
+      const char *s = kStrings[nextRandom() % 6];
+      image.insert(image.end(), s, s + strlen(s) + 1);
+    }
+  }
+  image.resize(size, 0xff);
+  return image;
+}
+
+// The next version: a function inserted at 30 %, a few bytes changed, the addresses behind the insertion moved.
+static Bytes syntheticUpdate(const Bytes &image, size_t inserted) {
+  size_t at = image.size() * 3 / 10;
+  Bytes update(image.begin(), image.begin() + at);
+  for (size_t i = 0; i < inserted; i++) {
+    update.push_back((uint8_t)nextRandom());
+  }
+  update.insert(update.end(), image.begin() + at, image.end() - inserted);
+  for (int i = 0; i < 16; i++) {
+    update[nextRandom() % update.size()] ^= 0x5a;
+  }
+  for (size_t i = 0; i + 4 <= update.size(); i += 4) {
+    uint32_t v = (uint32_t)update[i] | (uint32_t)update[i + 1] << 8 | (uint32_t)update[i + 2] << 16 |
+                 (uint32_t)update[i + 3] << 24;
+    if (v >= kImageBase + at && v < kImageBase + image.size()) {
+      v += inserted;
+      for (int b = 0; b < 4; b++) {
+        update[i + b] = (uint8_t)(v >> (8 * b));
+      }
+    }
+  }
+  return update;
+}
+
+static bool roundTrip(const char *name, const Bytes &source, const Bytes &target) {
+  Clock::time_point start = Clock::now();
+  Bytes patch = PatchEncoder(source, target).encode();
+  double diffMs = msSince(start);
+  start = Clock::now();
+  Bytes result;
+  PatchError error = apply(source, patch, result);
+  double applyMs = msSince(start);
+  bool ok = error == PATCH_OK && result == target;
+  printf("%-10s %8zu -> %8zu bytes, patch %8zu bytes (%5.1f %%), diff %7.1f ms, apply %6.1f ms: %s\n", name,
+         source.size(), target.size(), patch.size(), patch.size() * 100.0 / target.size(), diffMs, applyMs,
+         ok ? "ok" : patchErrorName(error));
+  return ok;
+}
+
+static bool expectError(const char *name, const Bytes &source, const Bytes &patch) {
+  Bytes result;
+  PatchError error = apply(source, patch, result);
+  printf("%-22s rejected: %s\n", name, error == PATCH_OK ? "NO" : patchErrorName(error));
+  return error != PATCH_OK;
+}
+
+static int check(const Bytes &source, const Bytes &target) {
+  bool ok = roundTrip("patch", source, target);
+  ok = roundTrip("compress", Bytes(), target) && ok;
+  ok = roundTrip("identical", source, source) && ok;
+
+  Bytes patch = PatchEncoder(source, target).encode();
+  Bytes other = source;
+  other[other.size() / 2] ^= 1;
+  ok = expectError("wrong source", other, patch) && ok;
+  ok = expectError("truncated", source, Bytes(patch.begin(), patch.begin() + patch.size() / 2)) && ok;
+  Bytes damaged = patch;
+  damaged[damaged.size() / 2] ^= 0x10;
+  ok = expectError("damaged", source, damaged) && ok;
+  Bytes header = patch;
+  header[0] = 'X';
+  ok = expectError("bad header", source, header) && ok;
+
+  printf("%s\n", ok ? "OK" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 2 && strcmp(argv[1], "check") == 0) {
+    Bytes source, target;
+    if (argc == 4) {
+      if (!readFile(argv[2], source) || !readFile(argv[3], target)) {
+        return 1;
+      }
+    } else {
+      source = syntheticImage(1024 * 1024);
+      target = syntheticUpdate(source, 236);
+    }
+    return check(source, target);
+  }
+
+  Bytes source, target, patch;
+  if (argc == 5 && strcmp(argv[1], "diff") == 0) {
+    if (!readFile(argv[2], source) || !readFile(argv[3], target)) {
+      return 1;
+    }
+    patch = PatchEncoder(source, target).encode();
+    printf("patch: %zu bytes, %.1f %% of %zu\n", patch.size(), patch.size() * 100.0 / target.size(), target.size());
+    return writeFile(argv[4], patch) ? 0 : 1;
+  }
+  if (argc == 4 && strcmp(argv[1], "compress") == 0) {
+    if (!readFile(argv[2], target)) {
+      return 1;
+    }
+    patch = PatchEncoder(source, target).encode();
+    printf("image: %zu bytes, %.1f %% of %zu\n", patch.size(), patch.size() * 100.0 / target.size(), target.size());
+    return writeFile(argv[3], patch) ? 0 : 1;
+  }
+  if (argc == 5 && strcmp(argv[1], "apply") == 0) {
+    if (!readFile(argv[2], source) || !readFile(argv[3], patch)) {
+      return 1;
+    }
+    PatchError error = apply(source, patch, target);
+    if (error != PATCH_OK) {
+      fprintf(stderr, "Patch failed: %s\n", patchErrorName(error));
+      return 1;
+    }
+    return writeFile(argv[4], target) ? 0 : 1;
+  }
+
+  fprintf(stderr,
+          "Usage: ota_patch diff <running.bin> <new.bin> <patch.bin>\n"
+          "       ota_patch compress <new.bin> <patch.bin>\n"
+          "       ota_patch apply <running.bin> <patch.bin> <out.bin>\n"
+          "       ota_patch check [<running.bin> <new.bin>]\n");
+  return 1;
+}
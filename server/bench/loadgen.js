@@ -0,0 +1,227 @@
+// Fleet load generator: simulates N loggers speaking the firmware protocol against the ingest server.
+//
+//   node bench/mock-influx.js --latency 5 --jitter 20 --failure-rate 0.01 &
+//   INFLUXDB_URL=http://localhost:8086 node index.js &
+//   node bench/loadgen.js --devices 500 --duration 120 --server-pid $! --mock http://localhost:8086
+//
+// Each device samples every --interval ms into a ring of --buffer samples (oldest overwritten) and sends one chunk of
+// up to --chunk samples every --send-interval ms over its own keep-alive connection, like the firmware: a failed
+// request leaves the data in the buffer for the next attempt. Every --outage-every s a device loses the network for
+// --outage-length s and then catches up with back-to-back chunks, like the burst upload of the duty-cycled modes.
+// --version 2 sends the columnar batch layout.
+const fs = require('fs');
+const http = require('http');
+const https = require('https');
+const { parseArgs } = require('./mock-influx');
+
+const options = parseArgs(process.argv, {
+  url: 'http://localhost:7777/api/v1/data',
+  token: '1234567890',
+  devices: 100,
+  duration: 60,
+  interval: 1000,
+  sendInterval: 5000,
+  chunk: 64,
+  buffer: 20000,
+  timeout: 10000,
+  outageEvery: 0,
+  outageLength: 60,
+  serverPid: 0,
+  mock: '',
+  version: 1,
+});
+
+const url = new URL(options.url);
+const transport = url.protocol === 'https:' ? https : http;
+
+const stats = {
+  requests: 0,
+  ok: 0,
+  failed: 0,
+  errors: 0,
+  samplesSent: 0,
+  samplesAcked: 0,
+  samplesOverwritten: 0,
+  latencies: [],
+  peakRssKb: 0,
+};
+
+// RSS of the process and its children (the cluster workers of the server)
+function readRssKb(pid) {
+  try {
+    const match = fs.readFileSync(`/proc/${pid}/status`, 'utf8').match(/VmRSS:\s+(\d+)/);
+    const children = fs.readFileSync(`/proc/${pid}/task/${pid}/children`, 'utf8').split(' ').filter(Boolean);
+    return (match ? Number(match[1]) : 0) + children.reduce((sum, child) => sum + readRssKb(child), 0);
+  } catch (e) {
+    return 0;
+  }
+}
+
+class Device {
+  constructor(id) {
+    this.id = id;
+    this.agent = new transport.Agent({ keepAlive: true, maxSockets: 1 });
+    this.samples = [];
+    this.inFlight = false;
+    this.lastSample = Date.now();
+    this.outageUntil = 0;
+    this.catchingUp = false;
+    this.phase = Math.random() * Math.PI * 2;
+  }
+
+  sample(now) {
+    while (now - this.lastSample >= options.interval) {
+      this.lastSample += options.interval;
+      const value = Math.max(0, 800 * Math.sin(this.lastSample / 3.6e6 + this.phase) + (Math.random() - 0.5) * 4);
+      this.samples.push({ timestamp: this.lastSample, value: Math.round(value * 100) / 100 });
+    }
+    if (this.samples.length > options.buffer) {
+      stats.samplesOverwritten += this.samples.length - options.buffer;
+      this.samples.splice(0, this.samples.length - options.buffer);
+    }
+  }
+
+  tick(now) {
+    this.sample(now);
+    if (options.outageEvery > 0 && this.outageUntil === 0 && Math.random() < options.sendInterval / 1000 / options.outageEvery) {
+      this.outageUntil = now + options.outageLength * 1000;
+    }
+    if (now < this.outageUntil) {
+      return;
+    }
+    if (this.outageUntil !== 0) {
+      this.outageUntil = 0;
+      this.catchingUp = true;
+    }
+    this.send();
+  }
+
+  send() {
+    if (this.inFlight || this.samples.length === 0) {
+      return;
+    }
+    const batch = this.samples.slice(0, options.chunk);
+    const header = {
+      device: `loadgen-${this.id}`,
+      sentAt: Date.now(),
+      oldest: batch[0].timestamp,
+      newest: batch[batch.length - 1].timestamp,
+    };
+    const body = JSON.stringify(options.version >= 2 ? {
+      version: 2,
+      ...header,
+      start: batch[0].timestamp,
+      interval: options.interval,
+      values: batch.map(m => m.value),
+    } : { ...header, measurements: batch });
+    const start = process.hrtime.bigint();
+    this.inFlight = true;
+    stats.requests++;
+    stats.samplesSent += batch.length;
+
+    const req = transport.request(url, {
+      method: 'POST',
+      agent: this.agent,
+      timeout: options.timeout,
+      headers: {
+        'Content-Type': 'application/json',
+        'Content-Length': Buffer.byteLength(body),
+        'Connection': 'keep-alive',
+        'X-API-Token': options.token,
+      },
+    }, res => {
+      res.resume();
+      res.on('end', () => {
+        stats.latencies.push(Number(process.hrtime.bigint() - start) / 1e6);
+        this.inFlight = false;
+        if (res.statusCode >= 200 && res.statusCode < 300) {
+          stats.ok++;
+          stats.samplesAcked += batch.length;
+          // Remove the acknowledged samples, unless they were overwritten meanwhile
+          if (this.samples[0] === batch[0]) {
+            this.samples.splice(0, batch.length);
+          }
+          if (this.catchingUp && this.samples.length > 0) {
+            return this.send();
+          }
+        } else {
+          stats.failed++;
+        }
+        this.catchingUp = false;
+      });
+    });
+    req.on('timeout', () => req.destroy(new Error('timeout')));
+    req.on('error', () => {
+      stats.errors++;
+      this.inFlight = false;
+      this.catchingUp = false;
+    });
+    req.end(body);
+  }
+}
+
+function percentile(sorted, p) {
+  if (sorted.length === 0) return 0;
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+function fetchJson(target) {
+  return new Promise(resolve => {
+    http.get(target, res => {
+      let data = '';
+      res.on('data', chunk => { data += chunk; });
+      res.on('end', () => {
+        try { resolve(JSON.parse(data)); } catch (e) { resolve(null); }
+      });
+    }).on('error', () => resolve(null));
+  });
+}
+
+async function main() {
+  console.log(`${options.devices} devices -> ${options.url}, chunk ${options.chunk}, ` +
+    `send interval ${options.sendInterval} ms, ${options.duration} s`);
+  const devices = [];
+  for (let i = 0; i < options.devices; i++) {
+    const device = new Device(i);
+    devices.push(device);
+    // Spread the devices over the send interval
+    setTimeout(() => {
+      device.timer = setInterval(() => device.tick(Date.now()), options.sendInterval);
+      device.tick(Date.now());
+    }, Math.random() * options.sendInterval);
+  }
+
+  const rssTimer = options.serverPid > 0
+    ? setInterval(() => { stats.peakRssKb = Math.max(stats.peakRssKb, readRssKb(options.serverPid)); }, 500)
+    : null;
+  const mockBefore = options.mock ? await fetchJson(`${options.mock}/stats`) : null;
+
+  const startedAt = Date.now();
+  await new Promise(resolve => setTimeout(resolve, options.duration * 1000));
+  const elapsedS = (Date.now() - startedAt) / 1000;
+  devices.forEach(d => { clearInterval(d.timer); d.agent.destroy(); });
+  if (rssTimer) clearInterval(rssTimer);
+
+  const sorted = stats.latencies.sort((a, b) => a - b);
+  const backlog = devices.reduce((sum, d) => sum + d.samples.length, 0);
+  console.log(`requests/s:     ${(stats.requests / elapsedS).toFixed(1)} (ok ${stats.ok}, http errors ${stats.failed}, ` +
+    `network errors ${stats.errors})`);
+  console.log(`samples/s:      ${(stats.samplesAcked / elapsedS).toFixed(0)} acknowledged, ` +
+    `${stats.samplesOverwritten} overwritten, ${backlog} left in device buffers`);
+  console.log(`latency ms:     p50 ${percentile(sorted, 0.5).toFixed(1)}, p99 ${percentile(sorted, 0.99).toFixed(1)}, ` +
+    `max ${(sorted[sorted.length - 1] || 0).toFixed(1)}`);
+  if (options.serverPid > 0) {
+    console.log(`server memory:  peak RSS ${(stats.peakRssKb / 1024).toFixed(1)} MB, ` +
+      `now ${(readRssKb(options.serverPid) / 1024).toFixed(1)} MB`);
+  }
+  if (mockBefore) {
+    const mockAfter = await fetchJson(`${options.mock}/stats`);
+    if (mockAfter) {
+      console.log(`influx writes/s: ${((mockAfter.writes - mockBefore.writes) / elapsedS).toFixed(1)}, ` +
+        `lines/s ${((mockAfter.lines - mockBefore.lines) / elapsedS).toFixed(0)}, ` +
+        `injected failures ${mockAfter.failures - mockBefore.failures}`);
+    }
+  }
+}
+
+main();
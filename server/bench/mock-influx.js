@@ -0,0 +1,79 @@
+// Local stand-in for the InfluxDB write API (POST /api/v2/write) for load tests of the ingest server.
+//
+//   node bench/mock-influx.js --port 8086 --latency 5 --jitter 20 --failure-rate 0.01
+//
+// Every write is answered with 204 after latency + random(0..jitter) ms, or with 503 at the failure rate.
+// GET /stats returns the counters as JSON.
+const http = require('http');
+
+function parseArgs(argv, defaults) {
+  const options = { ...defaults };
+  for (let i = 2; i + 1 < argv.length; i += 2) {
+    const key = argv[i].replace(/^--/, '').replace(/-([a-z])/g, (m, c) => c.toUpperCase());
+    if (!(key in defaults)) {
+      throw new Error(`Unknown option ${argv[i]}`);
+    }
+    options[key] = typeof defaults[key] === 'number' ? Number(argv[i + 1]) : argv[i + 1];
+  }
+  return options;
+}
+
+function start(options) {
+  const stats = { writes: 0, failures: 0, lines: 0, bytes: 0, startedAt: Date.now() };
+
+  const server = http.createServer((req, res) => {
+    if (req.method === 'GET' && req.url === '/stats') {
+      res.writeHead(200, { 'Content-Type': 'application/json' });
+      return res.end(JSON.stringify({ ...stats, uptimeMs: Date.now() - stats.startedAt }));
+    }
+    if (req.method !== 'POST' || !req.url.startsWith('/api/v2/write')) {
+      res.writeHead(404);
+      return res.end();
+    }
+
+    let bytes = 0;
+    let lines = 0;
+    req.on('data', chunk => {
+      bytes += chunk.length;
+      for (let i = 0; i < chunk.length; i++) {
+        if (chunk[i] === 10) lines++;
+      }
+    });
+    req.on('end', () => {
+      const delay = options.latency + Math.random() * options.jitter;
+      setTimeout(() => {
+        if (Math.random() < options.failureRate) {
+          stats.failures++;
+          res.writeHead(503, { 'Content-Type': 'application/json' });
+          return res.end('{"code":"unavailable","message":"injected failure"}');
+        }
+        stats.writes++;
+        stats.lines += bytes > 0 ? lines + 1 : 0;
+        stats.bytes += bytes;
+        res.writeHead(204);
+        res.end();
+      }, delay);
+    });
+  });
+
+  server.keepAliveTimeout = 65000;
+  server.listen(options.port, () => {
+    console.log(`Mock InfluxDB on port ${options.port}, latency ${options.latency}+${options.jitter} ms, ` +
+      `failure rate ${options.failureRate}`);
+  });
+  return { server, stats };
+}
+
+if (require.main === module) {
+  const options = parseArgs(process.argv, { port: 8086, latency: 5, jitter: 0, failureRate: 0, report: 10 });
+  const { stats } = start(options);
+  let last = { ...stats };
+  setInterval(() => {
+    const s = options.report;
+    console.log(`writes/s ${((stats.writes - last.writes) / s).toFixed(1)}, ` +
+      `lines/s ${((stats.lines - last.lines) / s).toFixed(0)}, failures ${stats.failures - last.failures}`);
+    last = { ...stats };
+  }, options.report * 1000).unref();
+}
+
+module.exports = { start, parseArgs };
@@ -1,8 +1,10 @@
+const cluster = require('cluster');
+const os = require('os');
 const express = require('express');
 const axios = require('axios');
+const { MeasurementParser } = require('./measurement-parser');
 
 const app = express();
-app.use(express.json()); // Middleware to parse JSON
 
 const PORT = process.env.PORT || 7777;
 const INFLUXDB_URL = process.env.INFLUXDB_URL || 'http://localhost:8086';
@@ -10,6 +12,25 @@ const INFLUXDB_BUCKET = process.env.INFLUXDB_BUCKET || 'mybucket';
 const INFLUXDB_ORG = process.env.INFLUXDB_ORG || 'myorg';
 const INFLUXDB_TOKEN = process.env.INFLUXDB_TOKEN || '1234567890';
 const API_TOKEN = process.env.API_TOKEN || '1234567890'; // API token from environment
+const MIN_VALID_TIMESTAMP = Date.UTC(2020, 0, 1); // ms, older timestamps come from an unsynchronized clock
+// Number of worker processes sharing the port, 0: one per CPU core
+const WORKERS = process.env.WORKERS !== undefined ? Number(process.env.WORKERS) : 0;
+const WORKER_COUNT = WORKERS > 0 ? WORKERS : (os.availableParallelism ? os.availableParallelism() : os.cpus().length);
+const WORKER_ID = cluster.isWorker ? cluster.worker.id : 0;
+const INFLUX_BATCH_LINES = Number(process.env.INFLUX_BATCH_LINES) || 5000; // Lines per coalesced write
+const INFLUX_BATCH_DELAY = Number(process.env.INFLUX_BATCH_DELAY) || 20; // ms a coalesced write waits for more lines
+const SLICE_LINES = Number(process.env.SLICE_LINES) || 1000; // Lines per write slice of an upload
+const MAX_PENDING_SLICES = 4; // Slice writes in flight per upload before reading pauses
+const LATENCY_FLUSH_INTERVAL = Number(process.env.LATENCY_FLUSH_INTERVAL) || 60000; // ms
+const WORKER_RESTART_MIN_DELAY = 1000; // ms before a died worker is replaced, doubled per crash in a row
+const WORKER_RESTART_MAX_DELAY = 60000; // ms, a worker that ran longer than this resets the delay
+
+// Tells the client whether its connection was reused: 1 for the first request on a connection
+app.use((req, res, next) => {
+  req.socket.requestCount = (req.socket.requestCount || 0) + 1;
+  res.set('X-Connection-Request', String(req.socket.requestCount));
+  next();
+});
 
 // Middleware for token verification
 app.use((req, res, next) => {
@@ -26,43 +47,301 @@ app.use((req, res, next) => {
   next();
 });
 
-app.post('/api/v1/data', async (req, res) => {
-  console.log('Received JSON data:', req.body);
+// Writes line protocol data (ms precision) to InfluxDB
+function writeToInflux(data) {
+  return axios.post(
+    `${INFLUXDB_URL}/api/v2/write?org=${INFLUXDB_ORG}&bucket=${INFLUXDB_BUCKET}&precision=ms`,
+    data,
+    {
+      headers: {
+        'Content-Type': 'text/plain',
+        'Authorization': `Token ${INFLUXDB_TOKEN}`
+      }
+    }
+  );
+}
 
-  if (!req.body.measurements) {
-    return res.status(400).json({ error: 'Invalid payload' });
+// Coalesces the measurement writes of concurrent requests into one InfluxDB request. The returned promise settles
+// with the write of the batch the lines were added to, so a request is still only acknowledged once its data is
+// persisted. A line InfluxDB rejects fails the whole batch, i.e. the requests of other devices as well, so only
+// validated lines may be queued.
+let pendingBatch = null;
+
+function queueWrite(data, lineCount) {
+  if (!pendingBatch) {
+    const batch = { parts: [], lines: 0 };
+    batch.promise = new Promise((resolve, reject) => {
+      batch.resolve = resolve;
+      batch.reject = reject;
+    });
+    batch.timer = setTimeout(() => flushBatch(batch), INFLUX_BATCH_DELAY);
+    pendingBatch = batch;
+  }
+  const batch = pendingBatch;
+  batch.parts.push(data);
+  batch.lines += lineCount;
+  if (batch.lines >= INFLUX_BATCH_LINES) {
+    flushBatch(batch);
+  }
+  return batch.promise;
+}
+
+function flushBatch(batch) {
+  if (pendingBatch === batch) {
+    pendingBatch = null;
   }
+  clearTimeout(batch.timer);
+  writeToInflux(batch.parts.join('\n')).then(batch.resolve, batch.reject);
+}
+
+// Escapes a tag value for the line protocol
+function escapeTag(value) {
+  return String(value).replace(/[ ,=\\]/g, m => `\\${m}`);
+}
+
+// End-to-end latency per device and stage (ms), collected from the batches since the last flush:
+//   oldest_to_send / newest_to_send: age of the oldest / newest sample of a batch when the logger sent it
+//   send_to_receive: logger send time to server receive time (includes the clock offset of the logger)
+//   receive_to_persist: server receive time to the InfluxDB write acknowledge
+const latencies = new Map();
 
-  let lines = req.body.measurements.map(m => {
-    return `current value=${m.value} ${m.timestamp}`;
+function recordLatency(device, batch, receivedAt, persistedAt) {
+  if (!(batch.sentAt >= MIN_VALID_TIMESTAMP)) {
+    return; // Older firmware or unsynchronized clock
+  }
+  if (!latencies.has(device)) {
+    latencies.set(device, { oldest_to_send: [], newest_to_send: [], send_to_receive: [], receive_to_persist: [] });
+  }
+  const stages = latencies.get(device);
+  if (batch.oldest >= MIN_VALID_TIMESTAMP) stages.oldest_to_send.push(batch.sentAt - batch.oldest);
+  if (batch.newest >= MIN_VALID_TIMESTAMP) stages.newest_to_send.push(batch.sentAt - batch.newest);
+  stages.send_to_receive.push(receivedAt - batch.sentAt);
+  stages.receive_to_persist.push(persistedAt - receivedAt);
+}
+
+function percentile(sorted, p) {
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+// Writes the latency distributions as measurement "latency" (tags device, stage and worker, as every worker process
+// collects its own) and starts new ones
+async function flushLatency() {
+  const now = Date.now();
+  const lines = [];
+  latencies.forEach((stages, device) => {
+    Object.entries(stages).forEach(([stage, values]) => {
+      if (values.length === 0) return;
+      const sorted = values.sort((a, b) => a - b);
+      lines.push(`latency,device=${escapeTag(device)},stage=${stage},worker=${WORKER_ID} p50=${percentile(sorted, 0.5)}i,` +
+        `p90=${percentile(sorted, 0.9)}i,p99=${percentile(sorted, 0.99)}i,max=${sorted[sorted.length - 1]}i,` +
+        `count=${sorted.length}i ${now}`);
+    });
   });
+  latencies.clear();
+  if (lines.length > 0) {
+    await writeToInflux(lines.join('\n'));
+  }
+}
 
-  let data = lines.join('\n');
-  console.log("Line Protocol Data:\n", data);
+setInterval(() => {
+  flushLatency().catch(error => {
+    console.error('Error sending latency to InfluxDB:', error.response ? error.response.data : error);
+  });
+}, LATENCY_FLUSH_INTERVAL).unref();
 
-  try {
-    const response = await axios.post(
-      `${INFLUXDB_URL}/api/v2/write?org=${INFLUXDB_ORG}&bucket=${INFLUXDB_BUCKET}&precision=ms`,
-      data,
-      {
-        headers: {
-          'Content-Type': 'text/plain',
-          'Authorization': `Token ${INFLUXDB_TOKEN}`
-        }
+// The body is parsed while it arrives (see measurement-parser.js) and written to InfluxDB in slices of
+// SLICE_LINES lines, so memory stays flat for large catch-up uploads and the first write starts before the upload
+// has finished. At most MAX_PENDING_SLICES writes are in flight per request, further reading waits for them.
+// If a slice fails, the request fails and the logger resends the batch; rewriting the same points is harmless.
+app.post('/api/v1/data', (req, res) => {
+  const receivedAt = Date.now();
+  const writes = [];
+  let pending = 0;
+  let slice = [];
+  let stored = 0;
+  let dropped = 0;
+  let failed = false;
+
+  const writeSlice = () => {
+    const write = queueWrite(slice.join('\n'), slice.length);
+    stored += slice.length;
+    slice = [];
+    pending++;
+    if (pending >= MAX_PENDING_SLICES) {
+      req.pause();
+    }
+    write.catch(() => {}).then(() => {
+      pending--;
+      req.resume();
+    });
+    writes.push(write);
+  };
+
+  const parser = new MeasurementParser(m => {
+    // Values and timestamps that would not make a valid line are dropped
+    if (!Number.isFinite(m.value) || !Number.isSafeInteger(m.timestamp)) {
+      dropped++;
+      return;
+    }
+    // A sample stamped before the logger clock was synchronized (1970-based) rejects the batch: the logger keeps it
+    // until it has been restamped and sends it again
+    if (m.timestamp < MIN_VALID_TIMESTAMP) {
+      const error = new Error(`Unsynchronized timestamp ${m.timestamp}, resend after the time sync`);
+      error.status = 422;
+      throw error;
+    }
+    slice.push(`current value=${m.value} ${m.timestamp}`);
+    if (slice.length >= SLICE_LINES) {
+      writeSlice();
+    }
+  });
+
+  const fail = (status, error) => {
+    if (!failed) {
+      failed = true;
+      res.status(status).json({ error: error.toString() });
+    }
+  };
+
+  req.setEncoding('utf8');
+  req.on('data', chunk => {
+    if (failed) {
+      return;
+    }
+    try {
+      parser.write(chunk);
+    } catch (error) {
+      fail(error.status || 400, error);
+    }
+  });
+
+  req.on('end', async () => {
+    if (failed) {
+      return;
+    }
+    let fields;
+    try {
+      fields = parser.end();
+    } catch (error) {
+      return fail(error.status || 400, error);
+    }
+    if (!parser.hasMeasurements) {
+      return fail(400, 'Invalid payload');
+    }
+    if (slice.length > 0) {
+      writeSlice();
+    }
+    if (dropped > 0) {
+      console.warn(`Dropped ${dropped} measurements without valid value or timestamp`);
+    }
+
+    try {
+      await Promise.all(writes);
+      console.log(`Stored ${stored} measurements from ${fields.device || 'unknown'}`);
+      if (stored > 0) {
+        recordLatency(fields.device || 'unknown', fields, receivedAt, Date.now());
       }
-    );
-    console.log('Data sent to InfluxDB:', response.statusText);
+      res.sendStatus(200);
+    } catch (error) {
+      console.error('Error sending data to InfluxDB:', error.response ? error.response.data : error);
+      fail(500, error);
+    }
+  });
+});
+
+app.post('/api/v1/status', express.json(), async (req, res) => {
+  const s = req.body;
+  if (!s || !s.device) {
+    return res.status(400).json({ error: 'Invalid payload' });
+  }
+
+  const now = Date.now();
+  const device = escapeTag(s.device);
+  const lines = [
+    `status,device=${device} uptime=${s.uptime}i,free_heap=${s.freeHeap}i,min_free_heap=${s.minFreeHeap}i,` +
+    `largest_free_block=${s.largestFreeBlock}i,fragmentation=${s.fragmentation}i,free_psram=${s.freePsram}i,` +
+    `rssi=${s.rssi}i,cpu_temp=${s.cpuTemp},wifi_reconnects=${s.wifiReconnects}i,` +
+    `wifi_fast_reconnects=${s.wifiFastReconnects || 0}i,wifi_reconnect_ms=${s.wifiReconnectMs || 0}i,` +
+    `wifi_max_reconnect_ms=${s.wifiMaxReconnectMs || 0}i,` +
+    `events=${s.events || 0}i,event_samples=${s.eventSamples || 0}i,event_records=${s.eventRecords || 0}i,` +
+    `ripple_rms_ua=${s.rippleRmsUa || 0}i,ripple_p2p_ua=${s.ripplePeakToPeakUa || 0}i,` +
+    `ripple_hz=${(s.rippleMilliHz || 0) / 1000},ripple_amplitude_ua=${s.rippleAmplitudeUa || 0}i,` +
+    `ripple_analyze_us=${s.rippleAnalyzeUs || 0}i,` +
+    `buffer_count=${s.bufferCount}i,buffer_capacity=${s.bufferCapacity}i,` +
+    `buffer_recovered=${s.bufferRecovered || 0}i,buffer_recover_us=${s.bufferRecoverUs || 0}i,` +
+    `radio_on_ms_per_hour=${s.radioOnMsPerHour || 0}i,wakes_per_hour=${s.wakesPerHour || 0}i,` +
+    `http_requests=${s.httpRequests || 0}i,http_connections=${s.httpConnections || 0}i,` +
+    `http_setup_ms=${s.httpSetupMs || 0}i,http_max_setup_ms=${s.httpMaxSetupMs || 0}i,` +
+    `http_max_heap_drop=${s.httpMaxHeapDrop || 0}i,log_dropped=${s.logDropped || 0}i,` +
+    `task_total=${s.taskTotal || 0}i,` +
+    `loop_stalls=${s.loopStalls || 0}i,loop_max_stall_ms=${s.loopMaxStallMs || 0}i,` +
+    `samples_missed=${s.samplesMissed || 0}i,sample_max_gap_ms=${s.sampleMaxGapMs || 0}i,` +
+    `ota_updates=${s.otaUpdates || 0}i,ota_failures=${s.otaFailures || 0}i,ota_last_ms=${s.otaLastMs || 0}i,` +
+    `ota_last_bytes=${s.otaLastBytes || 0}i,ota_last_image_bytes=${s.otaLastImageBytes || 0}i,` +
+    `ota_last_bytes_per_sec=${s.otaLastBytesPerSec || 0}i ${now}`
+  ];
+  (s.loopSubsystems || []).forEach(l => {
+    const buckets = (l.histogram || []).map((count, i) => `b${i}=${count}i`).join(',');
+    lines.push(`loop_stall,device=${device},subsystem=${escapeTag(l.name)} stalls=${l.stalls}i,max_ms=${l.maxMs}i` +
+      `${buckets ? ',' + buckets : ''} ${now}`);
+  });
+  if (s.watchdog) {
+    lines.push(`watchdog_reset,device=${device},subsystem=${escapeTag(s.watchdog.subsystem)} ` +
+      `stalled_ms=${s.watchdog.stalledMs}i,backtrace=${JSON.stringify(String(s.watchdog.backtrace))} ${now}`);
+  }
+  (s.coreLoad || []).forEach((load, core) => {
+    lines.push(`core_status,device=${device},core=${core} load=${load}i ${now}`);
+  });
+  (s.tasks || []).forEach(t => {
+    lines.push(`task_status,device=${device},task=${escapeTag(t.name)} stack_hwm=${t.stack}i,cpu=${t.cpu}i,core=${t.core}i ${now}`);
+  });
+
+  try {
+    await writeToInflux(lines.join('\n'));
     res.sendStatus(200);
   } catch (error) {
-    console.error('Error sending data to InfluxDB:', error.response ? error.response.data : error);
+    console.error('Error sending status to InfluxDB:', error.response ? error.response.data : error);
     res.status(500).json({ error: error.toString() });
   }
 });
 
-app.listen(PORT, '0.0.0.0', () => {
-  console.log(`Server is running on port ${PORT}`);
-  console.log(`InfluxDB URL: ${INFLUXDB_URL}`);
-  console.log(`InfluxDB Bucket: ${INFLUXDB_BUCKET}`);
-  console.log(`InfluxDB Org: ${INFLUXDB_ORG}`);
-  console.log(`API Token: ${API_TOKEN}`);
-});
+// The primary process only forks the workers; the connections are distributed round-robin among them. A worker
+// that dies is replaced after a delay that doubles while workers keep dying early (e.g. InfluxDB misconfigured), so
+// a crash loop does not spin the CPU.
+if (cluster.isPrimary && WORKER_COUNT > 1) {
+  let restartDelay = WORKER_RESTART_MIN_DELAY;
+  const fork = () => {
+    cluster.fork().startedAt = Date.now();
+  };
+
+  console.log(`Starting ${WORKER_COUNT} workers`);
+  for (let i = 0; i < WORKER_COUNT; i++) {
+    fork();
+  }
+  cluster.on('exit', (worker, code, signal) => {
+    const uptime = Date.now() - worker.startedAt;
+    if (uptime > WORKER_RESTART_MAX_DELAY) {
+      restartDelay = WORKER_RESTART_MIN_DELAY;
+    }
+    console.error(`Worker ${worker.process.pid} exited (${signal || code}) after ${uptime} ms, ` +
+      `restarting in ${restartDelay} ms`);
+    setTimeout(fork, restartDelay);
+    restartDelay = Math.min(restartDelay * 2, WORKER_RESTART_MAX_DELAY);
+  });
+} else {
+  const server = app.listen(PORT, '0.0.0.0', () => {
+    if (WORKER_ID > 1) {
+      return;
+    }
+    console.log(`Server is running on port ${PORT}`);
+    console.log(`InfluxDB URL: ${INFLUXDB_URL}`);
+    console.log(`InfluxDB Bucket: ${INFLUXDB_BUCKET}`);
+    console.log(`InfluxDB Org: ${INFLUXDB_ORG}`);
+    console.log(`API Token: ${API_TOKEN}`);
+  });
+
+  // Keep idle connections open longer than the send interval of the loggers, so they are reused
+  // instead of paying a new TCP connect / TLS handshake per batch.
+  server.keepAliveTimeout = 65000;
+  server.headersTimeout = 66000;
+}
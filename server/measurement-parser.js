@@ -0,0 +1,253 @@
+// Incremental parser for the batch formats of /api/v1/data:
+//   {"device":..,"sentAt":..,"oldest":..,"newest":..,"measurements":[{"timestamp":..,"value":..}, ..]}
+//   {"version":2,"device":..,"sentAt":..,"oldest":..,"newest":..,"start":..,"interval":..,"values":[..]}
+//
+// Version 2 is columnar: the timestamps follow from "start" and "interval", or for irregular sampling from "start"
+// and "deltas", the difference of each timestamp to the previous one (the first to start). The timing members must
+// precede "values". A null value (a sample lost on the logger) is skipped.
+//
+// The body is fed in chunks as it arrives. Each element of "measurements" or "values" is handed to the callback as
+// {timestamp, value} as soon as it is complete, the other top-level members are collected in fields. Only one element
+// or member is held at a time, so memory does not grow with the size of the upload; only "deltas" is kept, as numbers,
+// until the values arrive.
+const MAX_MEMBER_LENGTH = 4096;
+const MAX_NUMBER_LENGTH = 32;
+const MAX_COLUMN_LENGTH = 1000000;
+const COLUMNS = ['values', 'deltas'];
+
+class MeasurementParser {
+  constructor(onMeasurement) {
+    this.onMeasurement = onMeasurement;
+    this.fields = {};
+    this.count = 0;
+    this.hasMeasurements = false;
+    this.depth = 0;
+    this.mode = null; // 'key', 'value' or 'measurements' on the top level
+    this.key = null;
+    this.inString = false;
+    this.escape = false;
+    this.capturing = false;
+    this.buffer = '';
+    this.done = false;
+    this.element = ''; // Number of a column being read
+    this.elementEnded = false; // Whitespace after it
+    this.deltas = null;
+    this.values = 0;
+    this.timestamp = 0;
+  }
+
+  // Feeds the next chunk of the body (string).
+  write(text) {
+    for (let i = 0; i < text.length; i++) {
+      const c = text[i];
+
+      if (this.inString) {
+        this.append(c);
+        if (this.escape) {
+          this.escape = false;
+        } else if (c === '\\') {
+          this.escape = true;
+        } else if (c === '"') {
+          this.inString = false;
+        }
+        continue;
+      }
+
+      switch (c) {
+        case '"':
+          this.inString = true;
+          if (!this.capturing && this.depth === 1 && this.mode === 'key') {
+            this.capturing = true;
+            this.buffer = '';
+          }
+          if (!this.capturing) {
+            throw new SyntaxError('Unexpected string');
+          }
+          this.append(c);
+          break;
+
+        case '{':
+        case '[':
+          if (this.capturing) {
+            this.append(c);
+            this.depth++;
+          } else {
+            this.depth++;
+            if (this.depth === 1 && c === '{' && !this.done) {
+              this.mode = 'key';
+            } else if (this.depth === 2 && c === '[' && this.mode === 'measurements') {
+              this.hasMeasurements = true;
+            } else if (this.depth === 2 && c === '[' && COLUMNS.includes(this.mode)) {
+              this.startColumn();
+            } else if (this.depth === 3 && c === '{' && this.mode === 'measurements') {
+              this.capturing = true;
+              this.buffer = c;
+            } else {
+              throw new SyntaxError(`Unexpected ${c}`);
+            }
+          }
+          break;
+
+        case '}':
+        case ']':
+          this.depth--;
+          if (this.capturing && this.depth >= 1 && this.mode !== 'key') {
+            this.append(c);
+            if (this.mode === 'measurements' && this.depth === 2) {
+              this.capturing = false;
+              this.count++;
+              this.onMeasurement(JSON.parse(this.buffer));
+            }
+          } else if (this.depth === 0 && c === '}') {
+            if (this.capturing) {
+              this.finishValue();
+            }
+            this.done = true;
+          } else if (this.depth === 1 && c === ']' && COLUMNS.includes(this.mode)) {
+            this.finishElement(true);
+          } else if (!(this.depth === 1 && c === ']' && this.mode === 'measurements')) {
+            throw new SyntaxError(`Unexpected ${c}`);
+          }
+          break;
+
+        case ',':
+          if (this.depth === 1) {
+            if (this.capturing) {
+              this.finishValue();
+            }
+            this.mode = 'key';
+          } else if (this.capturing) {
+            this.append(c);
+          } else if (this.depth === 2 && COLUMNS.includes(this.mode)) {
+            this.finishElement(false);
+          }
+          break;
+
+        case ':':
+          if (this.depth === 1 && this.mode === 'key' && this.capturing) {
+            this.key = JSON.parse(this.buffer);
+            if (this.key === 'measurements' || COLUMNS.includes(this.key)) {
+              this.mode = this.key;
+              this.capturing = false;
+            } else {
+              this.mode = 'value';
+              this.buffer = '';
+            }
+          } else if (this.capturing) {
+            this.append(c);
+          } else {
+            throw new SyntaxError('Unexpected :');
+          }
+          break;
+
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+          this.elementEnded = this.element !== '';
+          break;
+
+        default:
+          if (this.depth === 2 && COLUMNS.includes(this.mode)) {
+            if (this.elementEnded) {
+              throw new SyntaxError(`Unexpected ${c} in "${this.mode}"`);
+            }
+            this.element += c;
+            if (this.element.length > MAX_NUMBER_LENGTH) {
+              throw new SyntaxError('Number too long');
+            }
+            break;
+          }
+          if (!this.capturing) {
+            throw new SyntaxError(`Unexpected ${c}`);
+          }
+          this.append(c);
+      }
+    }
+  }
+
+  // Completes parsing. Returns the top-level members other than "measurements".
+  end() {
+    if (!this.done) {
+      throw new SyntaxError('Unexpected end of JSON input');
+    }
+    if (this.deltas !== null && this.deltas.length !== this.values) {
+      throw new SyntaxError(`${this.deltas.length} deltas for ${this.values} values`);
+    }
+    return this.fields;
+  }
+
+  append(c) {
+    if (this.capturing) {
+      this.buffer += c;
+      if (this.buffer.length > MAX_MEMBER_LENGTH) {
+        throw new SyntaxError('Member too long');
+      }
+    }
+  }
+
+  finishValue() {
+    this.fields[this.key] = JSON.parse(this.buffer);
+    this.capturing = false;
+    if (this.key === 'version' && this.fields.version !== 1 && this.fields.version !== 2) {
+      throw new SyntaxError(`Unsupported version ${JSON.stringify(this.fields.version)}`);
+    }
+  }
+
+  startColumn() {
+    if (this.fields.version !== 2) {
+      throw new SyntaxError(`"${this.mode}" requires version 2`);
+    }
+    if (this.mode === 'deltas') {
+      this.deltas = [];
+      return;
+    }
+    this.hasMeasurements = true;
+  }
+
+  // Completes the number read in a column, closing: at the end of the column.
+  finishElement(closing) {
+    const text = this.element;
+    this.element = '';
+    this.elementEnded = false;
+    if (text === '') {
+      if (closing && (this.mode === 'deltas' ? this.deltas.length : this.values) === 0) {
+        return; // Empty column
+      }
+      throw new SyntaxError(`Unexpected ${closing ? ']' : ','} in "${this.mode}"`);
+    }
+    const number = JSON.parse(text);
+    if (typeof number !== 'number' && !(number === null && this.mode === 'values')) {
+      throw new SyntaxError(`Unexpected ${text} in "${this.mode}"`);
+    }
+
+    if (this.mode === 'deltas') {
+      if (this.deltas.length >= MAX_COLUMN_LENGTH) {
+        throw new SyntaxError('Too many deltas');
+      }
+      this.deltas.push(number);
+      return;
+    }
+    if (this.values === 0) {
+      if (!Number.isFinite(this.fields.start) || (!Number.isFinite(this.fields.interval) && this.deltas === null)) {
+        throw new SyntaxError('"values" without preceding "start" and "interval" or "deltas"');
+      }
+      this.timestamp = this.fields.start;
+    }
+    if (this.deltas !== null) {
+      if (this.values >= this.deltas.length) {
+        throw new SyntaxError(`More values than deltas (${this.deltas.length})`);
+      }
+      this.timestamp += this.deltas[this.values];
+    } else if (this.values > 0) {
+      this.timestamp += this.fields.interval;
+    }
+    this.values++;
+    if (number !== null) {
+      this.count++;
+      this.onMeasurement({ timestamp: this.timestamp, value: number });
+    }
+  }
+}
+
+module.exports = { MeasurementParser };